@@ -3,6 +3,7 @@
 
     #define     SF_PLAYING_FILE             0x00000001
     #define     SF_PLAYING_AUDIOBOOK        0x00000002
+    #define     SF_AUDIO_STARTED            0x00000004      // first audio data of the actual file sent to the decoder
 
 
     #define     SF_                         0x00000000
@@ -0,0 +1,183 @@
+#include "latencyTrace.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+    #include "esp32-hal-log.h"
+#else
+    static const char *TAG = "LatencyTrace";
+#endif
+
+
+LatencyTrace::Trace_s       LatencyTrace::m_traces[TRACE_COUNT];
+uint32_t                    LatencyTrace::m_started     = 0;
+portMUX_TYPE                LatencyTrace::m_mux         = portMUX_INITIALIZER_UNLOCKED;
+
+static const char          *StageNames[LatencyTrace::STAGE_COUNT] = {
+                                "card present",
+                                "serial read",
+                                "card read",
+                                "queue send",
+                                "player receive",
+                                "file open",
+                                "first data",
+                                "decoding",
+                            };
+
+
+//prints a time in us as ms with one decimal, "-" if there is none
+static void PrintTime(int64_t time)
+{
+    if (time < 0)
+    {
+        Serial.printf("%9s", "-");
+    }
+    else
+    {
+        Serial.printf("%7u.%u", (uint32_t)(time / 1000), (uint32_t)((time / 100) % 10));
+    }
+}
+
+
+void LatencyTrace::start( void )
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&m_mux);
+    Trace_s *pTrace = &m_traces[m_started % TRACE_COUNT];
+    memset(pTrace, 0, sizeof(Trace_s));
+    pTrace->Time[STAGE_CARD_PRESENT] = now;
+    m_started++;
+    portEXIT_CRITICAL(&m_mux);
+}
+
+
+void LatencyTrace::mark(Stage_e stage)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&m_mux);
+    Trace_s *pTrace = actualTrace(now);
+
+    //only the first pass counts
+    if ((pTrace != NULL) && (pTrace->Time[stage] == 0))
+    {
+        pTrace->Time[stage] = now;
+    }
+    portEXIT_CRITICAL(&m_mux);
+}
+
+
+bool LatencyTrace::waiting(Stage_e stage)
+{
+    bool result;
+
+    portENTER_CRITICAL(&m_mux);
+    Trace_s *pTrace = actualTrace(esp_timer_get_time());
+    result = (pTrace != NULL) && (pTrace->Time[stage] == 0);
+    portEXIT_CRITICAL(&m_mux);
+
+    return result;
+}
+
+
+LatencyTrace::Trace_s *LatencyTrace::actualTrace(int64_t now)
+{
+    Trace_s *pTrace;
+
+    if (m_started == 0)
+    {
+        return NULL;
+    }
+
+    pTrace = &m_traces[(m_started - 1) % TRACE_COUNT];
+
+    //closed by the decoder or too old
+    if ((pTrace->Time[STAGE_DECODING] != 0) || ((now - pTrace->Time[STAGE_CARD_PRESENT]) > TRACE_TIMEOUT))
+    {
+        return NULL;
+    }
+
+    return pTrace;
+}
+
+
+void LatencyTrace::print( void )
+{
+    Trace_s     traces[TRACE_COUNT];
+    uint32_t    started;
+    uint32_t    count;
+
+    //a copy, the stages go on meanwhile
+    portENTER_CRITICAL(&m_mux);
+    memcpy(traces, m_traces, sizeof(traces));
+    started = m_started;
+    portEXIT_CRITICAL(&m_mux);
+
+    if (started == 0)
+    {
+        Serial.println("No card traced yet");
+        return;
+    }
+
+    count = (started < TRACE_COUNT) ? started : TRACE_COUNT;
+    Trace_s *pLast = &traces[(started - 1) % TRACE_COUNT];
+
+    Serial.printf("Card to first sound, %u cards traced (last %u kept), ms since the card was detected:\n", started, count);
+    Serial.printf("  %-16s %9s %9s %9s %9s %6s\n", "stage", "last", "step", "avg", "max", "seen");
+
+    for (uint32_t stage = 0; stage < STAGE_COUNT; stage++)
+    {
+        int64_t     last    = -1;
+        int64_t     step    = -1;
+        int64_t     sum     = 0;
+        int64_t     max     = -1;
+        uint32_t    seen    = 0;
+
+        if (pLast->Time[stage] != 0)
+        {
+            last = pLast->Time[stage] - pLast->Time[STAGE_CARD_PRESENT];
+
+            //since the stage before (a known card is played before it is read)
+            for (int32_t previous = stage - 1; previous >= 0; previous--)
+            {
+                if (pLast->Time[previous] != 0)
+                {
+                    step = pLast->Time[stage] - pLast->Time[previous];
+                    break;
+                }
+            }
+        }
+
+        for (uint32_t trace = 0; trace < count; trace++)
+        {
+            if (traces[trace].Time[stage] != 0)
+            {
+                int64_t time = traces[trace].Time[stage] - traces[trace].Time[STAGE_CARD_PRESENT];
+
+                sum += time;
+                seen++;
+                if (time > max)
+                {
+                    max = time;
+                }
+            }
+        }
+
+        Serial.printf("  %-16s", StageNames[stage]);
+        PrintTime(last);
+        PrintTime(step);
+        PrintTime(seen ? (sum / seen) : -1);
+        PrintTime(max);
+        Serial.printf(" %6u\n", seen);
+    }
+}
+
+
+void LatencyTrace::reset( void )
+{
+    portENTER_CRITICAL(&m_mux);
+    memset(m_traces, 0, sizeof(m_traces));
+    m_started = 0;
+    portEXIT_CRITICAL(&m_mux);
+
+    ESP_LOGD(TAG, "Latency traces cleared");
+}
@@ -0,0 +1,51 @@
+#ifndef _LATENCY_TRACE_H
+    #define _LATENCY_TRACE_H
+
+    #include "Arduino.h"
+
+
+    // Time stamps of the way from a card on the reader to the first sound.
+    //
+    // Every card placed starts a new trace in a small ring, the stages on the way
+    // (user interface, player task, decoder) mark their first pass. A trace is closed
+    // when the decoder plays or after TRACE_TIMEOUT, so later commands (e.g. from the
+    // console) do not end up in the trace of an old card. The time base is
+    // esp_timer_get_time(), it is the same on both cores.
+    class LatencyTrace
+    {
+        public:
+            typedef enum {
+                STAGE_CARD_PRESENT,                             // IsNewCardPresent() / IRQ of the reader
+                STAGE_SERIAL_READ,                              // Uid of the card
+                STAGE_CARD_READ,                                // ReadCardInformation() done
+                STAGE_QUEUE_SEND,                               // play command sent to the player
+                STAGE_PLAYER_RECEIVE,                           // play command taken by the player task
+                STAGE_FILE_OPEN,                                // connecttoSD() opened the file
+                STAGE_FIRST_DATA,                               // first data sent to the decoder
+                STAGE_DECODING,                                 // decoder recognised the stream
+                STAGE_COUNT,
+            } Stage_e;
+
+            static void         start( void );                  // a new card, begins the next trace
+            static void         mark(Stage_e stage);
+            static bool         waiting(Stage_e stage);         // the actual trace is open and has not seen the stage
+
+            static void         print( void );
+            static void         reset( void );
+
+        private:
+            typedef struct {
+                int64_t         Time[STAGE_COUNT];              // us, 0 if the stage was not seen
+            } Trace_s;
+
+            static const uint32_t   TRACE_COUNT     = 8;
+            static const int64_t    TRACE_TIMEOUT   = 10000000; // us
+
+            static Trace_s          m_traces[TRACE_COUNT];
+            static uint32_t         m_started;                  // traces since reset(), the last one is the actual
+            static portMUX_TYPE     m_mux;
+
+            static Trace_s         *actualTrace(int64_t now);
+    };
+
+#endif
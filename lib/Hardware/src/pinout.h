@@ -14,6 +14,7 @@
 
     #define MFRC522_RST      5
     #define MFRC522_CS      21
+    // #define MFRC522_IRQ     22       // optional: card detection by the interrupt of the reader
 
     #define LED_RED_1        2
     #define LED_RED_2       15
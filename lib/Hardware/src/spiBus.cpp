@@ -0,0 +1,163 @@
+#include "spiBus.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+    #include "esp32-hal-log.h"
+#else
+    static const char *TAG = "SpiBus";
+#endif
+
+
+SpiBus::Profile_s           SpiBus::m_profiles[DEVICE_COUNT] = {
+                                { 200000,  SPI_MODE0, "audio" },     // slow until the decoder clock is set
+                                { 4000000, SPI_MODE0, "SD card" },
+                                { 4000000, SPI_MODE0, "RFID" },      // fixed by the MFRC522 library
+                            };
+SpiBus::Statistics_s        SpiBus::m_stats[DEVICE_COUNT];
+volatile uint32_t           SpiBus::m_waiting[DEVICE_COUNT];
+
+SemaphoreHandle_t           SpiBus::m_lock      = NULL;
+portMUX_TYPE                SpiBus::m_mux       = portMUX_INITIALIZER_UNLOCKED;
+uint32_t                    SpiBus::m_depth     = 0;
+uint32_t                    SpiBus::m_holdStart = 0;
+
+
+void SpiBus::begin( void )
+{
+    if (m_lock == NULL)
+    {
+        m_lock = xSemaphoreCreateRecursiveMutex();
+
+        if (m_lock == NULL)
+        {
+            ESP_LOGE(TAG, "Could not create the bus lock");
+        }
+
+        resetStatistics();
+    }
+}
+
+
+void SpiBus::setProfile(Device_e device, uint32_t clock, uint8_t mode)
+{
+    m_profiles[device].Clock    = clock;
+    m_profiles[device].Mode     = mode;
+}
+
+
+SPISettings SpiBus::settings(Device_e device)
+{
+    return SPISettings(m_profiles[device].Clock, MSBFIRST, m_profiles[device].Mode);
+}
+
+
+uint32_t SpiBus::getClock(Device_e device)
+{
+    return m_profiles[device].Clock;
+}
+
+
+void SpiBus::acquire(Device_e device)
+{
+    uint32_t startTime = micros();
+    uint32_t waitTime;
+
+    //without begin() there is nobody to arbitrate
+    if (m_lock == NULL)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&m_mux);
+    m_waiting[device]++;
+    portEXIT_CRITICAL(&m_mux);
+
+    //step back as long as a more important user waits, a tick is enough for it to take the bus
+    //(but not within a step of our own, the other one would wait for us then)
+    while (contended(device) && (xSemaphoreGetMutexHolder(m_lock) != xTaskGetCurrentTaskHandle()))
+    {
+        m_stats[device].Yields++;
+        vTaskDelay(1);
+    }
+
+    xSemaphoreTakeRecursive(m_lock, portMAX_DELAY);
+
+    portENTER_CRITICAL(&m_mux);
+    m_waiting[device]--;
+    portEXIT_CRITICAL(&m_mux);
+
+    //only the outermost step counts
+    if (m_depth++ != 0)
+    {
+        return;
+    }
+
+    m_holdStart = micros();
+    waitTime    = m_holdStart - startTime;
+
+    m_stats[device].Acquisitions++;
+    m_stats[device].WaitTime += waitTime;
+    if (waitTime > m_stats[device].MaxWait)
+    {
+        m_stats[device].MaxWait = waitTime;
+    }
+}
+
+
+void SpiBus::release(Device_e device)
+{
+    if (m_lock == NULL)
+    {
+        return;
+    }
+
+    if (--m_depth == 0)
+    {
+        uint32_t holdTime = micros() - m_holdStart;
+
+        if (holdTime > m_stats[device].MaxHold)
+        {
+            m_stats[device].MaxHold = holdTime;
+        }
+    }
+
+    xSemaphoreGiveRecursive(m_lock);
+}
+
+
+bool SpiBus::contended(Device_e device)
+{
+    for (uint32_t counter = 0; counter < device; counter++)
+    {
+        if (m_waiting[counter] != 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void SpiBus::printStatistics(bool reset)
+{
+    for (uint32_t device = 0; device < DEVICE_COUNT; device++)
+    {
+        Statistics_s *pStats = &m_stats[device];
+
+        Serial.printf("- SPI bus %-10s : %u steps at %u kHz, wait avg %u us max %u us, hold max %u us, %u yields\n",
+                      m_profiles[device].pName, pStats->Acquisitions, m_profiles[device].Clock / 1000,
+                      pStats->Acquisitions ? (uint32_t)(pStats->WaitTime / pStats->Acquisitions) : 0,
+                      pStats->MaxWait, pStats->MaxHold, pStats->Yields);
+    }
+
+    if (reset)
+    {
+        resetStatistics();
+    }
+}
+
+
+void SpiBus::resetStatistics( void )
+{
+    memset(m_stats, 0, sizeof(m_stats));
+}
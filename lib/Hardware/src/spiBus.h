@@ -0,0 +1,84 @@
+#ifndef _SPI_BUS_H
+    #define _SPI_BUS_H
+
+    #include "Arduino.h"
+    #include "SPI.h"
+
+
+    // Arbitration of the SPI bus shared by the decoder, the SD card and the RFID reader.
+    //
+    // SPI.beginTransaction() only serializes single transfers, so a card read of the
+    // user interface could get in between every chunk sent to the decoder. Every user takes
+    // the bus for one step of its work (one SDI burst, one SD read, one RF command) and a
+    // user of lower priority steps back as long as a more important one is waiting.
+    // Long transactions (e.g. writing a card) must be split into such steps, otherwise
+    // the audio has to wait for all of it.
+    //
+    // The lock is recursive, so a step could call other functions taking the bus again.
+    class SpiBus
+    {
+        public:
+            // the users of the bus, ordered by priority (lower value wins)
+            typedef enum {
+                DEVICE_AUDIO,                                   // VS1053, feeding must never wait long
+                DEVICE_SDCARD,                                  // read ahead for the audio
+                DEVICE_RFID,                                    // MFRC522
+                DEVICE_COUNT,
+            } Device_e;
+
+            static void         begin( void );
+
+            // clock and mode of each device, drivers with their own transactions use settings()
+            static void         setProfile(Device_e device, uint32_t clock, uint8_t mode);
+            static SPISettings  settings(Device_e device);
+            static uint32_t     getClock(Device_e device);
+
+            static void         acquire(Device_e device);
+            static void         release(Device_e device);
+            static bool         contended(Device_e device);     // a more important user waits for the bus
+
+            static void         printStatistics(bool reset);
+            static void         resetStatistics( void );
+
+        private:
+            typedef struct {
+                uint32_t        Clock;
+                uint8_t         Mode;
+                const char      *pName;
+            } Profile_s;
+
+            typedef struct {
+                uint32_t        Acquisitions;
+                uint64_t        WaitTime;                       // us
+                uint32_t        MaxWait;                        // us
+                uint32_t        MaxHold;                        // us
+                uint32_t        Yields;                         // stepped back for a more important user
+            } Statistics_s;
+
+            static Profile_s            m_profiles[DEVICE_COUNT];
+            static Statistics_s         m_stats[DEVICE_COUNT];
+            static volatile uint32_t    m_waiting[DEVICE_COUNT];
+
+            static SemaphoreHandle_t    m_lock;
+            static portMUX_TYPE         m_mux;
+            static uint32_t             m_depth;                // nesting of the actual owner
+            static uint32_t             m_holdStart;            // micros() of the outermost acquire
+    };
+
+
+    // takes the bus for the lifetime of the object, e.g. one step of a longer transaction
+    class SpiBusLock
+    {
+        public:
+            SpiBusLock(SpiBus::Device_e device) : m_device(device) {
+                SpiBus::acquire(m_device);
+            }
+            ~SpiBusLock() {
+                SpiBus::release(m_device);
+            }
+
+        private:
+            SpiBus::Device_e    m_device;
+    };
+
+#endif
@@ -0,0 +1,702 @@
+#include "mediaLibrary.h"
+
+#include "mediaTags.h"
+#include "mp3FrameIndex.h"
+
+#include "rom/crc.h"
+#include "esp_heap_caps.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+    #include "esp32-hal-log.h"
+#else
+    static const char *TAG = "MediaLibrary";
+#endif
+
+MediaLibrary::MediaLibrary()
+{
+    m_handle        = NULL;
+    m_lock          = NULL;
+    m_scanning      = false;
+
+    m_valid         = false;
+    m_pageOffset    = 0xFFFFFFFF;
+    m_pageLength    = 0;
+
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+MediaLibrary::~MediaLibrary()
+{
+
+}
+
+
+bool MediaLibrary::begin( void )
+{
+    bool result = true;
+
+    if (m_lock == NULL)
+    {
+        m_lock = xSemaphoreCreateMutex();
+
+        xSemaphoreTake(m_lock, portMAX_DELAY);
+        openCatalog();
+        xSemaphoreGive(m_lock);
+
+        //create the task that will scan the SD card, only when nothing else has to be done
+        if (xTaskCreate(
+                        TaskFunctionAdapter,        /* Task function. */
+                        "Media Library",            /* String with name of task. */
+                        8 * 1024,                   /* Stack size in bytes (ESP-IDF), recursion and tag reading */
+                        this,                       /* Parameter passed as input of the task */
+                        tskIDLE_PRIORITY,           /* Priority of the task. */
+                        &m_handle) != pdPASS)       /* Task handle. */
+        {
+            ESP_LOGE(TAG, "Could not create media library task");
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+
+void MediaLibrary::startScan( void )
+{
+    if (m_handle != NULL)
+    {
+        xTaskNotifyGive(m_handle);
+    }
+}
+
+
+bool MediaLibrary::isScanning( void )
+{
+    return m_scanning;
+}
+
+
+uint32_t MediaLibrary::count( void )
+{
+    return m_valid ? m_header.RecordCount : 0;
+}
+
+
+bool MediaLibrary::findById(uint32_t id, CatalogRecord_s *pRecord, String *pPath)
+{
+    bool result;
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    result = findByIdLocked(id, pRecord);
+
+    if (result && (pPath != NULL))
+    {
+        char path[257];
+
+        result = (pRecord->PathLength < sizeof(path)) &&
+                 readCatalog(m_header.StringsOffset + pRecord->PathOffset, path, pRecord->PathLength);
+
+        path[result ? pRecord->PathLength : 0] = 0;
+        *pPath = String(path);
+    }
+
+    xSemaphoreGive(m_lock);
+
+    return result;
+}
+
+
+uint32_t MediaLibrary::findByPrefix(String prefix, uint32_t *pFirst)
+{
+    CatalogRecord_s record;
+    String          path;
+    uint32_t        low     = 0;
+    uint32_t        high;
+    uint32_t        matches = 0;
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    high = m_valid ? m_header.RecordCount : 0;
+
+    // the records are sorted by path: find the first one that is not smaller than the prefix ...
+    while (low < high)
+    {
+        uint32_t middle = (low + high) / 2;
+
+        if (!readRecordLocked(middle, &record, &path))
+        {
+            high = 0;
+            break;
+        }
+
+        if (strcmp(path.c_str(), prefix.c_str()) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    *pFirst = low;
+
+    // ... and count the ones that start with it
+    while (m_valid && ((low + matches) < m_header.RecordCount) &&
+           readRecordLocked(low + matches, &record, &path) && path.startsWith(prefix))
+    {
+        matches++;
+    }
+
+    xSemaphoreGive(m_lock);
+
+    return matches;
+}
+
+
+bool MediaLibrary::readRecord(uint32_t index, CatalogRecord_s *pRecord, String *pPath)
+{
+    bool result;
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    result = readRecordLocked(index, pRecord, pPath);
+    xSemaphoreGive(m_lock);
+
+    return result;
+}
+
+
+uint32_t MediaLibrary::contentId(String path)
+{
+    return crc32_le(0, (const uint8_t *) path.c_str(), path.length());
+}
+
+
+bool MediaLibrary::openCatalog( void )
+{
+    fs::FS &fs = SD;
+
+    if (m_catalog)
+    {
+        m_catalog.close();
+    }
+
+    m_valid         = false;
+    m_pageOffset    = 0xFFFFFFFF;
+
+    m_catalog = fs.open(CATALOG_PATH);
+
+    if (!m_catalog)
+    {
+        ESP_LOGD(TAG, "No catalog yet");
+        return false;
+    }
+
+    m_valid = (m_catalog.read((uint8_t *) &m_header, sizeof(m_header)) == sizeof(m_header)) &&
+              (m_header.Magic == CATALOG_MAGIC) &&
+              (m_header.Version == CATALOG_VERSION) &&
+              (m_header.RecordSize == sizeof(CatalogRecord_s)) &&
+              (m_catalog.size() == (m_header.StringsOffset + m_header.StringsSize));
+
+    if (!m_valid)
+    {
+        ESP_LOGW(TAG, "Catalog is invalid");
+        m_catalog.close();
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Catalog with %u media", m_header.RecordCount);
+    }
+
+    return m_valid;
+}
+
+
+bool MediaLibrary::readCatalog(uint32_t offset, void *pData, uint32_t length)
+{
+    uint8_t *pTarget = (uint8_t *) pData;
+
+    if (!m_valid)
+    {
+        return false;
+    }
+
+    // everything goes through a one page cache, binary searches end up in the same page
+    while (length)
+    {
+        uint32_t pageOffset = offset - (offset % PAGE_SIZE);
+        uint32_t inPage     = offset - pageOffset;
+        uint32_t chunk;
+
+        if (pageOffset != m_pageOffset)
+        {
+            if (!m_catalog.seek(pageOffset))
+            {
+                return false;
+            }
+            m_pageLength = m_catalog.read(m_page, PAGE_SIZE);
+            m_pageOffset = pageOffset;
+        }
+
+        if (inPage >= m_pageLength)
+        {
+            return false;
+        }
+
+        chunk = ((m_pageLength - inPage) < length) ? (m_pageLength - inPage) : length;
+
+        memcpy(pTarget, &m_page[inPage], chunk);
+
+        pTarget += chunk;
+        offset  += chunk;
+        length  -= chunk;
+    }
+
+    return true;
+}
+
+
+bool MediaLibrary::readRecordLocked(uint32_t index, CatalogRecord_s *pRecord, String *pPath)
+{
+    char path[257];
+
+    if (!m_valid || (index >= m_header.RecordCount) ||
+        !readCatalog(m_header.RecordsOffset + (index * sizeof(CatalogRecord_s)), pRecord, sizeof(CatalogRecord_s)))
+    {
+        return false;
+    }
+
+    if (pPath != NULL)
+    {
+        if ((pRecord->PathLength >= sizeof(path)) ||
+            !readCatalog(m_header.StringsOffset + pRecord->PathOffset, path, pRecord->PathLength))
+        {
+            return false;
+        }
+
+        path[pRecord->PathLength] = 0;
+        *pPath = String(path);
+    }
+
+    return true;
+}
+
+
+bool MediaLibrary::findByIdLocked(uint32_t id, CatalogRecord_s *pRecord)
+{
+    IdEntry_s   entry;
+    uint32_t    low     = 0;
+    uint32_t    high    = m_valid ? m_header.RecordCount : 0;
+
+    while (low < high)
+    {
+        uint32_t middle = (low + high) / 2;
+
+        if (!readCatalog(m_header.IdTableOffset + (middle * sizeof(IdEntry_s)), &entry, sizeof(entry)))
+        {
+            return false;
+        }
+
+        if (entry.Id == id)
+        {
+            return readRecordLocked(entry.Record, pRecord, NULL);
+        }
+
+        if (entry.Id < id)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return false;
+}
+
+
+void MediaLibrary::scan( void )
+{
+    fs::FS          &fs = SD;
+    ScanState_s     state;
+    uint32_t        startTime = millis();
+
+    // usually nothing has changed since the last boot, so the catalog is not written again
+    if (!catalogChanged())
+    {
+        ESP_LOGI(TAG, "Scan done: %u media unchanged in %u ms", m_header.RecordCount, millis() - startTime);
+        return;
+    }
+
+    state.Count     = 0;
+    state.Reused    = 0;
+    state.Failed    = false;
+    state.DryRun    = false;
+    state.Changed   = false;
+
+    // the id table is sorted in RAM, use the external RAM if there is some
+    state.pIds = (IdEntry_s *) heap_caps_malloc(MAX_MEDIA * sizeof(IdEntry_s), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (state.pIds == NULL)
+    {
+        state.pIds = (IdEntry_s *) heap_caps_malloc(MAX_MEDIA * sizeof(IdEntry_s), MALLOC_CAP_8BIT);
+    }
+
+    state.Records   = fs.open(RECORDS_PATH, FILE_WRITE);
+    state.Strings   = fs.open(STRINGS_PATH, FILE_WRITE);
+
+    if ((state.pIds == NULL) || !state.Records || !state.Strings)
+    {
+        ESP_LOGE(TAG, "Could not start the scan");
+        state.Failed = true;
+    }
+    else
+    {
+        CatalogHeader_s header;
+
+        // placeholder, the header is written at the end
+        memset(&header, 0, sizeof(header));
+        state.Records.write((uint8_t *) &header, sizeof(header));
+
+        scanDirectory("", 0, &state);
+    }
+
+    if (state.Strings)
+    {
+        state.Strings.close();
+    }
+
+    if (!state.Failed)
+    {
+        state.Failed = !finishCatalog(&state, millis() - startTime);
+    }
+    else if (state.Records)
+    {
+        state.Records.close();
+    }
+
+    fs.remove(STRINGS_PATH);
+
+    if (state.Failed)
+    {
+        fs.remove(RECORDS_PATH);
+    }
+
+    if (state.pIds != NULL)
+    {
+        heap_caps_free(state.pIds);
+    }
+
+    ESP_LOGI(TAG, "Scan %s: %u media (%u unchanged) in %u ms", state.Failed ? "FAILED" : "done", state.Count, state.Reused, millis() - startTime);
+}
+
+
+bool MediaLibrary::catalogChanged( void )
+{
+    ScanState_s state;
+
+    state.pIds      = NULL;
+    state.Count     = 0;
+    state.Reused    = 0;
+    state.Failed    = false;
+    state.DryRun    = true;
+    state.Changed   = false;
+
+    // a walk through the directories without tag reading or writing, it stops at the first change
+    scanDirectory("", 0, &state);
+
+    // removed media only show in the count
+    return !m_valid || state.Failed || state.Changed || (state.Count != m_header.RecordCount);
+}
+
+
+void MediaLibrary::scanDirectory(String path, uint8_t depth, ScanState_s *pState)
+{
+    fs::FS      &fs = SD;
+    File        directory;
+    File        entry;
+    DirEntry_s  *pEntries;
+    uint32_t    count = 0;
+
+    directory = fs.open((path.length() == 0) ? "/" : path.c_str());
+
+    if (!directory || !directory.isDirectory())
+    {
+        return;
+    }
+
+    pEntries = new DirEntry_s[MAX_DIR_ENTRIES];
+
+    while ((entry = directory.openNextFile()))
+    {
+        String name = entry.name();
+
+        // depending on the core version name() is the full path or just the name
+        name = name.substring(name.lastIndexOf('/') + 1);
+
+        // hidden and system entries and our own files are not interesting
+        if ((name.charAt(0) != '.') && (name != "System Volume Information") &&
+            (entry.isDirectory() || (codecOf(name) != CODEC_UNKNOWN)))
+        {
+            if (count < MAX_DIR_ENTRIES)
+            {
+                pEntries[count].Name        = name;
+                pEntries[count].Size        = entry.size();
+                pEntries[count].LastWrite   = entry.getLastWrite();
+                pEntries[count].Directory   = entry.isDirectory();
+                count++;
+            }
+            else
+            {
+                ESP_LOGW(TAG, "Too many entries in %s, ignoring %s", path.c_str(), name.c_str());
+            }
+        }
+
+        entry.close();
+    }
+
+    directory.close();
+
+    // Sort by name, directories as "name/". So the media end up sorted by their full path
+    // and findByPrefix() could do a binary search over them.
+    for (uint32_t counter = 1; counter < count; counter++)
+    {
+        DirEntry_s  actual  = pEntries[counter];
+        String      key     = actual.Name + (actual.Directory ? "/" : "");
+        uint32_t    target  = counter;
+
+        while ((target > 0) && (strcmp((pEntries[target - 1].Name + (pEntries[target - 1].Directory ? "/" : "")).c_str(), key.c_str()) > 0))
+        {
+            pEntries[target] = pEntries[target - 1];
+            target--;
+        }
+        pEntries[target] = actual;
+    }
+
+    for (uint32_t counter = 0; (counter < count) && !pState->Failed && !(pState->DryRun && pState->Changed); counter++)
+    {
+        String fullPath = path + "/" + pEntries[counter].Name;
+
+        if (pEntries[counter].Directory)
+        {
+            if (depth < MAX_DEPTH)
+            {
+                scanDirectory(fullPath, depth + 1, pState);
+            }
+        }
+        else
+        {
+            addMedia(fullPath, &pEntries[counter], pState);
+        }
+    }
+
+    delete[] pEntries;
+}
+
+
+void MediaLibrary::addMedia(String &path, DirEntry_s *pEntry, ScanState_s *pState)
+{
+    CatalogRecord_s record;
+
+    if (pState->Count >= MAX_MEDIA)
+    {
+        ESP_LOGW(TAG, "Too many media, ignoring %s", path.c_str());
+        return;
+    }
+
+    // the dry run only counts what is still the same
+    if (pState->DryRun)
+    {
+        pState->Count++;
+    }
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    // unchanged files keep what we found out last time
+    if (findByIdLocked(contentId(path), &record) &&
+        (record.FileSize == pEntry->Size) &&
+        (record.LastWrite == pEntry->LastWrite))
+    {
+        xSemaphoreGive(m_lock);
+        pState->Reused++;
+
+        if (pState->DryRun)
+        {
+            return;
+        }
+    }
+    else if (pState->DryRun)
+    {
+        xSemaphoreGive(m_lock);
+        pState->Changed = true;
+        return;
+    }
+    else
+    {
+        fs::FS  &fs = SD;
+        File    file;
+
+        xSemaphoreGive(m_lock);
+
+        memset(&record, 0, sizeof(record));
+        record.Id           = contentId(path);
+        record.Codec        = codecOf(path);
+        record.FileSize     = pEntry->Size;
+        record.LastWrite    = pEntry->LastWrite;
+
+        if (record.Codec == CODEC_MP3)
+        {
+            file = fs.open(path);
+
+            if (file)
+            {
+                MediaTags tags;
+
+                tags.read(file);
+                record.AudioStart   = tags.audioStart();
+                record.Duration     = Mp3FrameIndex::estimateDuration(file, tags.audioStart(), tags.audioEnd(), &record.Bitrate);
+
+                file.close();
+            }
+        }
+
+        ESP_LOGV(TAG, "%08X %s: %u ms, %u kbit/s", record.Id, path.c_str(), record.Duration, record.Bitrate);
+
+        // leave the SD card to the player for a moment
+        vTaskDelay(1);
+    }
+
+    record.PathOffset   = pState->Strings.position();
+    record.PathLength   = path.length();
+
+    if ((pState->Strings.write((const uint8_t *) path.c_str(), path.length()) != path.length()) ||
+        (pState->Records.write((uint8_t *) &record, sizeof(record)) != sizeof(record)))
+    {
+        ESP_LOGE(TAG, "Writing catalog failed");
+        pState->Failed = true;
+        return;
+    }
+
+    pState->pIds[pState->Count].Id      = record.Id;
+    pState->pIds[pState->Count].Record  = pState->Count;
+    pState->Count++;
+}
+
+
+bool MediaLibrary::finishCatalog(ScanState_s *pState, uint32_t scanTime)
+{
+    fs::FS          &fs = SD;
+    File            strings;
+    CatalogHeader_s header;
+    uint8_t         buffer[PAGE_SIZE];
+    int32_t         bytesRead;
+    bool            result = true;
+
+    qsort(pState->pIds, pState->Count, sizeof(IdEntry_s), compareIds);
+
+    for (uint32_t counter = 1; counter < pState->Count; counter++)
+    {
+        if (pState->pIds[counter].Id == pState->pIds[counter - 1].Id)
+        {
+            ESP_LOGW(TAG, "Two media with id %08X", pState->pIds[counter].Id);
+        }
+    }
+
+    header.Magic            = CATALOG_MAGIC;
+    header.Version          = CATALOG_VERSION;
+    header.RecordSize       = sizeof(CatalogRecord_s);
+    header.RecordCount      = pState->Count;
+    header.RecordsOffset    = sizeof(header);
+    header.IdTableOffset    = header.RecordsOffset + (pState->Count * sizeof(CatalogRecord_s));
+    header.StringsOffset    = header.IdTableOffset + (pState->Count * sizeof(IdEntry_s));
+    header.StringsSize      = 0;
+    header.ScanTime         = scanTime;
+
+    // id table and strings follow the records
+    result = (pState->Records.write((uint8_t *) pState->pIds, pState->Count * sizeof(IdEntry_s)) == (pState->Count * sizeof(IdEntry_s)));
+
+    strings = fs.open(STRINGS_PATH);
+    result = result && strings;
+
+    while (result && ((bytesRead = strings.read(buffer, sizeof(buffer))) > 0))
+    {
+        result = (pState->Records.write(buffer, bytesRead) == (size_t) bytesRead);
+        header.StringsSize += bytesRead;
+    }
+
+    if (strings)
+    {
+        strings.close();
+    }
+
+    result = result && pState->Records.seek(0) && (pState->Records.write((uint8_t *) &header, sizeof(header)) == sizeof(header));
+
+    pState->Records.close();
+
+    // replace the catalog, lookups wait for this
+    if (result)
+    {
+        xSemaphoreTake(m_lock, portMAX_DELAY);
+
+        m_catalog.close();
+        m_valid = false;
+
+        fs.remove(CATALOG_PATH);
+        result = fs.rename(RECORDS_PATH, CATALOG_PATH);
+
+        openCatalog();
+
+        xSemaphoreGive(m_lock);
+    }
+
+    return result;
+}
+
+
+MediaLibrary::Codec_e MediaLibrary::codecOf(String &name)
+{
+    String extension = name.substring(name.lastIndexOf('.') + 1);
+
+    if (extension.equalsIgnoreCase("MP3"))
+    {
+        return CODEC_MP3;
+    }
+    if (extension.equalsIgnoreCase("M3U"))
+    {
+        return CODEC_M3U;
+    }
+
+    return CODEC_UNKNOWN;
+}
+
+
+int MediaLibrary::compareIds(const void *pFirst, const void *pSecond)
+{
+    uint32_t first  = ((const IdEntry_s *) pFirst)->Id;
+    uint32_t second = ((const IdEntry_s *) pSecond)->Id;
+
+    return (first < second) ? -1 : ((first > second) ? 1 : 0);
+}
+
+
+void MediaLibrary::TaskFunctionAdapter(void *pvParameters)
+{
+    MediaLibrary *library = static_cast<MediaLibrary *>(pvParameters);
+
+    library->Run();
+
+    vTaskDelete(library->m_handle);
+}
+
+
+void MediaLibrary::Run( void )
+{
+    // an update at every start, after that only on request
+    do
+    {
+        m_scanning = true;
+        scan();
+        m_scanning = false;
+    } while (ulTaskNotifyTake(pdTRUE, portMAX_DELAY));
+}
@@ -0,0 +1,138 @@
+#ifndef _MEDIA_LIBRARY_H
+    #define _MEDIA_LIBRARY_H
+
+    #include "Arduino.h"
+    #include "SD.h"
+    #include "FS.h"
+
+
+    // Catalog of all media on the SD card.
+    //
+    // A background task walks the card and writes a compact binary catalog (/enrav.cat):
+    //
+    //      header
+    //      records     one per media file, sorted by path
+    //      id table    {id, record} sorted by id
+    //      strings     the paths
+    //
+    // The id of a media is the CRC32 of its path, so cards could refer to "#<id>" instead of
+    // a full path. The catalog is never loaded completely, lookups read it in pages (binary
+    // search over the id table or the path sorted records). On a rescan files with unchanged
+    // size and modification time take their data from the old catalog.
+    class MediaLibrary
+    {
+        public:
+            typedef enum {
+                CODEC_UNKNOWN,
+                CODEC_MP3,
+                CODEC_M3U,
+            } Codec_e;
+
+            typedef struct {
+                uint32_t    Id;                                         // CRC32 of the path
+                uint32_t    PathOffset;                                 // in the string table
+                uint16_t    PathLength;
+                uint8_t     Codec;                                      // Codec_e
+                uint8_t     Reserved;
+                uint32_t    Duration;                                   // ms (0 if unknown)
+                uint16_t    Bitrate;                                    // kbit/s (average for VBR)
+                uint16_t    Reserved2;
+                uint32_t    AudioStart;                                 // first byte after the tags
+                uint32_t    FileSize;
+                uint32_t    LastWrite;                                  // modification time of the file
+            } CatalogRecord_s;
+
+            MediaLibrary();
+            ~MediaLibrary();
+
+            bool        begin( void );                                  // open the catalog and start a scan
+            void        startScan( void );
+            bool        isScanning( void );
+
+            uint32_t    count( void );
+            bool        findById(uint32_t id, CatalogRecord_s *pRecord, String *pPath);
+            uint32_t    findByPrefix(String prefix, uint32_t *pFirst);  // number of matching records, first one
+            bool        readRecord(uint32_t index, CatalogRecord_s *pRecord, String *pPath);
+
+            static uint32_t contentId(String path);
+
+        private:
+            static const uint32_t CATALOG_MAGIC     = 0x54414345;       // "ECAT"
+            static const uint16_t CATALOG_VERSION   = 1;
+            static const uint32_t PAGE_SIZE         = 512;
+            static const uint32_t MAX_MEDIA         = 4096;
+            static const uint32_t MAX_DIR_ENTRIES   = 128;
+            static const uint8_t  MAX_DEPTH         = 8;
+
+            const char  *CATALOG_PATH               = "/enrav.cat";
+            const char  *RECORDS_PATH               = "/enrav.ctp";     // catalog under construction
+            const char  *STRINGS_PATH               = "/enrav.cst";     // its string table
+
+            typedef struct {
+                uint32_t    Magic;
+                uint16_t    Version;
+                uint16_t    RecordSize;
+                uint32_t    RecordCount;
+                uint32_t    RecordsOffset;
+                uint32_t    IdTableOffset;
+                uint32_t    StringsOffset;
+                uint32_t    StringsSize;
+                uint32_t    ScanTime;                                   // ms the last scan took
+            } CatalogHeader_s;
+
+            typedef struct {
+                uint32_t    Id;
+                uint32_t    Record;
+            } IdEntry_s;
+
+            typedef struct {
+                String      Name;
+                uint32_t    Size;
+                uint32_t    LastWrite;
+                bool        Directory;
+            } DirEntry_s;
+
+            typedef struct {
+                File        Records;
+                File        Strings;
+                IdEntry_s   *pIds;
+                uint32_t    Count;
+                uint32_t    Reused;                                     // records taken from the old catalog
+                bool        Failed;
+                bool        DryRun;                                     // only compare with the catalog, nothing is written
+                bool        Changed;                                    // dry run: a media is new or changed
+            } ScanState_s;
+
+            TaskHandle_t        m_handle;
+            SemaphoreHandle_t   m_lock;                                 // catalog file and page cache
+            volatile bool       m_scanning;
+
+            File                m_catalog;
+            CatalogHeader_s     m_header;
+            bool                m_valid;
+
+            uint8_t             m_page[PAGE_SIZE];
+            uint32_t            m_pageOffset;
+            uint32_t            m_pageLength;
+
+            bool        openCatalog( void );
+            bool        readCatalog(uint32_t offset, void *pData, uint32_t length);
+            bool        readRecordLocked(uint32_t index, CatalogRecord_s *pRecord, String *pPath);
+            bool        findByIdLocked(uint32_t id, CatalogRecord_s *pRecord);
+
+            void        scan( void );
+            bool        catalogChanged( void );
+            void        scanDirectory(String path, uint8_t depth, ScanState_s *pState);
+            void        addMedia(String &path, DirEntry_s *pEntry, ScanState_s *pState);
+            bool        finishCatalog(ScanState_s *pState, uint32_t scanTime);
+
+            static Codec_e  codecOf(String &name);
+            static int      compareIds(const void *pFirst, const void *pSecond);
+
+            //
+            void Run( void );
+
+            static void TaskFunctionAdapter(void *pvParameters);
+    };
+
+#endif
@@ -1,12 +1,25 @@
 
 #include "mp3player.h"
+#include "latencyTrace.h"
 
 Mp3player::Mp3player(uint8_t _cs_pin = 25, uint8_t _dcs_pin = 26, uint8_t _dreq_pin = 32)
 {
     m_pPlayer = new VS1053(_cs_pin, _dcs_pin, _dreq_pin);
 
     m_SystemFlagGroup   = NULL;
+    m_pLibrary          = NULL;
     m_volume            = 15;
+
+    m_events            = NULL;
+    m_wakeup            = NULL;
+
+    m_commandCount      = 0;
+    m_maxCommandTime    = 0;
+    m_maxLatency        = 0;
+
+    memset(m_latencyHistogram, 0, sizeof(m_latencyHistogram));
+    memset(m_wakeups, 0, sizeof(m_wakeups));
+    m_statsStart        = millis();
 }
 
 Mp3player::~Mp3player()
@@ -24,11 +37,26 @@ void Mp3player::begin( QueueHandle_t *pCommandQueue )
         m_pPlayer->setSystemFlagGroup(m_SystemFlagGroup);
     }
 
+    //one wait for the commands and the decoder, the queue must still be empty here
+    //(so its free spaces are its length, the set needs room for all of them and the semaphore)
+    m_wakeup = xSemaphoreCreateBinary();
+    m_events = xQueueCreateSet(uxQueueSpacesAvailable(*m_pPlayerQueue) + 1);
+
+    if ((m_wakeup == NULL) || (m_events == NULL) ||
+        (xQueueAddToSet(*m_pPlayerQueue, m_events) != pdPASS) ||
+        (xQueueAddToSet(m_wakeup, m_events) != pdPASS))
+    {
+        ESP_LOGE(TAG, "Could not create the wait of the player, no playback");
+        return;
+    }
+
+    m_pPlayer->setWakeup(m_wakeup);
+
     //create the task that will handle the playback
     xTaskCreate(
                     TaskFunctionAdapter,        /* Task function. */
                     "MP3 Player",       	    /* String with name of task. */
-                    4* 1024,                    /* Stack size in words. */
+                    8 * 1024,                   /* Stack size in bytes (ESP-IDF), the SD and FatFs calls go deep */
                     this,                       /* Parameter passed as input of the task */
                     1,                          /* Priority of the task. */
                     &m_handle);                 /* Task handle. */
@@ -40,6 +68,20 @@ void Mp3player::SetSystemFlagGroup(EventGroupHandle_t eventGroup)
 }
 
 
+void Mp3player::setMediaLibrary(MediaLibrary *pLibrary)
+{
+    m_pLibrary = pLibrary;
+}
+
+
+bool Mp3player::sendCommand(QueueHandle_t *pQueue, PlayerControlMessage_s &message)
+{
+    message.SendTime = micros();
+
+    return (xQueueSend(*pQueue, &message, ( TickType_t ) 0) == pdPASS) ? true : false;
+}
+
+
 void Mp3player::TaskFunctionAdapter(void *pvParameters)
 {
     Mp3player *mp3player = static_cast<Mp3player *>(pvParameters);
@@ -73,79 +115,243 @@ void Mp3player::Run( void ) {
 
     while (true)
     {
-        m_pPlayer->loop();
+        uint32_t feedStart = millis();
 
-        if( xQueueReceive( *m_pPlayerQueue, &(PlayerControlMessage), ( TickType_t ) 50 ) ) 
+        // feed the decoder until it is saturated or the time budget is used up
+        do
         {
-            ESP_LOGV(TAG, "Received Command %u", PlayerControlMessage.Command);
+            m_pPlayer->loop();
+        } while (m_pPlayer->feedPending() && ((millis() - feedStart) < FEED_TIME_BUDGET));
 
-            if ((PlayerControlMessage.Command == CMD_PLAY_FILE) || 
-                (PlayerControlMessage.Command == CMD_RESUME_FILE))
-            {
-                //make sure the file exists
-                if (PlayerControlMessage.pFileToPlay != NULL)
-                {
-                    //remove white characters
-                    PlayerControlMessage.pFileToPlay->trim();
+        // sleep until a command arrives or the decoder has something to do, the timer is
+        // only needed while playing (streams, checkpoints, a missed edge of DREQ)
+        QueueSetMemberHandle_t event = xQueueSelectFromSet(m_events, (m_pPlayer->isRunning() && !m_pPlayer->isPaused()) ? TIMER_PERIOD : portMAX_DELAY);
 
-                    ESP_LOGD(TAG, "Received Path %s", PlayerControlMessage.pFileToPlay->c_str());
-                    
-                    if (PlayerControlMessage.pFileToPlay->charAt(0) == '/') 
-                    {
-                        String fileExtension = PlayerControlMessage.pFileToPlay->substring(PlayerControlMessage.pFileToPlay->lastIndexOf('.') + 1, PlayerControlMessage.pFileToPlay->length());
-                        
-                        fileExtension.toUpperCase();
-
-                        ESP_LOGV(TAG, "Play File with Extension \"%s\"", fileExtension.c_str());
-
-                        if (fileExtension.equals("MP3") || fileExtension.equals("M3U"))
-                        {
-                            m_pPlayer->connecttoSD(*(PlayerControlMessage.pFileToPlay), (PlayerControlMessage.Command == CMD_RESUME_FILE)?true:false);
-                        }
-                        else 
-                        {
-                            ESP_LOGW(TAG, "Unsupported File Extension");
-                        }
-                    } 
-                    else if (PlayerControlMessage.pFileToPlay->startsWith("http"))
-                    {
-                        ESP_LOGV(TAG, "Play Stream");
+        if (event == m_wakeup)
+        {
+            xSemaphoreTake(m_wakeup, 0);
+            m_wakeups[WAKE_EVENT]++;
+        }
+        else if (event == *m_pPlayerQueue)
+        {
+            m_wakeups[WAKE_COMMAND]++;
 
-                        m_pPlayer->connecttohost(*(PlayerControlMessage.pFileToPlay));
-                    } 
-                    else 
-                    {
-                        ESP_LOGW(TAG, "Unsupported File Type");
-                    }
+            if( xQueueReceive( *m_pPlayerQueue, &(PlayerControlMessage), 0 ) ) 
+            {
+                uint32_t commandStart = millis();
 
-                    delete PlayerControlMessage.pFileToPlay;
+                RecordLatency(PlayerControlMessage);
+                HandleCommand(PlayerControlMessage);
+
+                m_commandCount++;
+                if ((millis() - commandStart) > m_maxCommandTime)
+                {
+                    m_maxCommandTime = millis() - commandStart;
                 }
             }
-            else if (PlayerControlMessage.Command == CMD_STOP) 
-            {
-                ESP_LOGD(TAG, "Received stop");
-                m_pPlayer->stop_mp3client();
-            }
-            else if (PlayerControlMessage.Command == CMD_VOL_UP)
+        }
+        else
+        {
+            m_wakeups[WAKE_TIMER]++;
+        }
+    };
+}
+
+
+void Mp3player::RecordLatency( PlayerControlMessage_s &PlayerControlMessage )
+{
+    uint32_t latency;
+    uint32_t bucket = 0;
+
+    //not sent by sendCommand()
+    if (PlayerControlMessage.SendTime == 0)
+    {
+        return;
+    }
+
+    latency = micros() - PlayerControlMessage.SendTime;
+
+    while ((bucket < (LATENCY_BUCKETS - 1)) && (latency >= (125UL << bucket)))
+    {
+        bucket++;
+    }
+    m_latencyHistogram[bucket]++;
+
+    if (latency > m_maxLatency)
+    {
+        m_maxLatency = latency;
+    }
+}
+
+
+void Mp3player::HandleCommand( PlayerControlMessage_s &PlayerControlMessage )
+{
+    ESP_LOGV(TAG, "Received Command %u", PlayerControlMessage.Command);
+
+    if ((PlayerControlMessage.Command == CMD_PLAY_FILE) || 
+        (PlayerControlMessage.Command == CMD_RESUME_FILE))
+    {
+        LatencyTrace::mark(LatencyTrace::STAGE_PLAYER_RECEIVE);
+
+        //make sure the file exists
+        if (PlayerControlMessage.pFileToPlay != NULL)
+        {
+            //remove white characters
+            PlayerControlMessage.pFileToPlay->trim();
+
+            ESP_LOGD(TAG, "Received Path %s", PlayerControlMessage.pFileToPlay->c_str());
+
+            //a media of the library, look up its path
+            if ((PlayerControlMessage.pFileToPlay->charAt(0) == '#') && (m_pLibrary != NULL))
             {
-                if (m_volume < 21)
+                MediaLibrary::CatalogRecord_s record;
+                uint32_t id = strtoul(PlayerControlMessage.pFileToPlay->c_str() + 1, NULL, 16);
+
+                if (!m_pLibrary->findById(id, &record, PlayerControlMessage.pFileToPlay))
+                {
+                    ESP_LOGW(TAG, "Media #%08X not in the library", id);
+                }
+                else
                 {
-                    m_volume++;
-                    m_pPlayer->setVolume(m_volume);
+                    ESP_LOGD(TAG, "Media #%08X is %s", id, PlayerControlMessage.pFileToPlay->c_str());
                 }
             }
-            else if (PlayerControlMessage.Command == CMD_VOL_DOWN)
+
+            if (PlayerControlMessage.pFileToPlay->charAt(0) == '/')
             {
-                if (m_volume > 0)
+                String fileExtension = PlayerControlMessage.pFileToPlay->substring(PlayerControlMessage.pFileToPlay->lastIndexOf('.') + 1, PlayerControlMessage.pFileToPlay->length());
+                
+                fileExtension.toUpperCase();
+
+                ESP_LOGV(TAG, "Play File with Extension \"%s\"", fileExtension.c_str());
+
+                if (fileExtension.equals("MP3") || fileExtension.equals("M3U"))
                 {
-                    m_volume--;
-                    m_pPlayer->setVolume(m_volume);
+                    if (m_pPlayer->connecttoSD(*(PlayerControlMessage.pFileToPlay), (PlayerControlMessage.Command == CMD_RESUME_FILE)?true:false) &&
+                        (PlayerControlMessage.Command == CMD_PLAY_FILE) && (PlayerControlMessage.Value != 0))
+                    {
+                        ESP_LOGD(TAG, "Start at %u s", PlayerControlMessage.Value);
+                        m_pPlayer->seekTo(PlayerControlMessage.Value);
+                    }
                 }
+                else 
+                {
+                    ESP_LOGW(TAG, "Unsupported File Extension");
+                }
+            } 
+            else if (PlayerControlMessage.pFileToPlay->startsWith("http"))
+            {
+                ESP_LOGV(TAG, "Play Stream");
+
+                m_pPlayer->connecttohost(*(PlayerControlMessage.pFileToPlay));
+            } 
+            else 
+            {
+                ESP_LOGW(TAG, "Unsupported File Type");
             }
+
+            delete PlayerControlMessage.pFileToPlay;
         }
+    }
+    else if (PlayerControlMessage.Command == CMD_STOP) 
+    {
+        ESP_LOGD(TAG, "Received stop");
+        m_pPlayer->stop_mp3client();
+    }
+    else if (PlayerControlMessage.Command == CMD_PAUSE) 
+    {
+        ESP_LOGD(TAG, "Received pause");
 
-        delay(50);
-    };
+        if (!m_pPlayer->pause())
+        {
+            m_pPlayer->stop_mp3client();
+        }
+    }
+    else if (PlayerControlMessage.Command == CMD_CONTINUE) 
+    {
+        ESP_LOGD(TAG, "Received continue");
+        m_pPlayer->resume();
+    }
+    else if ((PlayerControlMessage.Command == CMD_NEXT) ||
+             (PlayerControlMessage.Command == CMD_PREV))
+    {
+        ESP_LOGD(TAG, "Received skip %s", (PlayerControlMessage.Command == CMD_NEXT) ? "forward" : "back");
+        m_pPlayer->skip((PlayerControlMessage.Command == CMD_NEXT) ? true : false);
+    }
+    else if (PlayerControlMessage.Command == CMD_VOL_UP)
+    {
+        if (m_volume < 21)
+        {
+            m_volume++;
+            m_pPlayer->setVolume(m_volume);
+        }
+    }
+    else if (PlayerControlMessage.Command == CMD_VOL_DOWN)
+    {
+        if (m_volume > 0)
+        {
+            m_volume--;
+            m_pPlayer->setVolume(m_volume);
+        }
+    }
+    else if (PlayerControlMessage.Command == CMD_SET_VOLUME)
+    {
+        if ((PlayerControlMessage.Value > 0) && (PlayerControlMessage.Value <= 100))
+        {
+            //the decoder knows 0..21
+            m_volume = (PlayerControlMessage.Value * 21 + 50) / 100;
+            m_pPlayer->setVolume(m_volume);
+        }
+    }
+    else if ((PlayerControlMessage.Command == CMD_STATS) ||
+             (PlayerControlMessage.Command == CMD_STATS_RESET))
+    {
+        PrintStatistics((PlayerControlMessage.Command == CMD_STATS_RESET) ? true : false);
+    }
+    else if (PlayerControlMessage.Command == CMD_SEEK)
+    {
+        ESP_LOGD(TAG, "Received seek to %u s", PlayerControlMessage.Value);
+        m_pPlayer->seekTo(PlayerControlMessage.Value);
+    }
+}
+
+
+void Mp3player::PrintStatistics( bool reset )
+{
+    m_pPlayer->printStatistics(reset);
+
+    Serial.printf("- player commands    : %u, longest %u ms\n", m_commandCount, m_maxCommandTime);
+    Serial.printf("- command latency    : max %u us, <125us %u", m_maxLatency, m_latencyHistogram[0]);
+    for (uint32_t bucket = 1; bucket < LATENCY_BUCKETS; bucket++)
+    {
+        if (bucket == (LATENCY_BUCKETS - 1))
+        {
+            Serial.printf(", more %u", m_latencyHistogram[bucket]);
+        }
+        else
+        {
+            Serial.printf(", <%uus %u", 125UL << bucket, m_latencyHistogram[bucket]);
+        }
+    }
+    Serial.printf("\n");
+    uint32_t duration = millis() - m_statsStart;
+    uint32_t wakeups  = m_wakeups[WAKE_COMMAND] + m_wakeups[WAKE_EVENT] + m_wakeups[WAKE_TIMER];
+
+    Serial.printf("- player wakeups     : %u commands, %u read ahead, %u timer, %u per second\n",
+                  m_wakeups[WAKE_COMMAND], m_wakeups[WAKE_EVENT], m_wakeups[WAKE_TIMER],
+                  duration ? (uint32_t)(((uint64_t)wakeups * 1000) / duration) : 0);
+    Serial.printf("- player stack left  : %u bytes\n", uxTaskGetStackHighWaterMark(NULL));
+
+    if (reset)
+    {
+        m_commandCount      = 0;
+        m_maxCommandTime    = 0;
+        m_maxLatency        = 0;
+
+        memset(m_latencyHistogram, 0, sizeof(m_latencyHistogram));
+        memset(m_wakeups, 0, sizeof(m_wakeups));
+        m_statsStart        = millis();
+    }
 }
 
 
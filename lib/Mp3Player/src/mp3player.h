@@ -7,6 +7,7 @@
     #include "FS.h"
 
     #include "vs1053_ext.h"
+    #include "mediaLibrary.h"
 
 
     class Mp3player
@@ -14,18 +15,31 @@
         public:
             typedef enum {
                 CMD_UNKNOWN,
-                CMD_PLAY_FILE,
+                CMD_PLAY_FILE,                                  // Value: seconds to start at (0 = beginning)
                 CMD_RESUME_FILE,
                 CMD_STOP,
                 CMD_VOL_UP,
                 CMD_VOL_DOWN,
+                CMD_STATS,
+                CMD_STATS_RESET,
+                CMD_SEEK,
+                CMD_SET_VOLUME,                                 // Value: 1..100
+                CMD_PAUSE,                                      // keep the file open, stop if that's not possible
+                CMD_CONTINUE,
+                CMD_NEXT,                                       // next playlist entry
+                CMD_PREV,                                       // previous playlist entry, restart of a single file
             } PlayerCommand_e;
 
             typedef struct {
                 PlayerCommand_e Command;
                 String         *pFileToPlay;
+                uint32_t        Value;              // command parameter (e.g. seconds for CMD_SEEK)
+                uint32_t        SendTime;           // micros(), set by sendCommand()
             } PlayerControlMessage_s;
 
+            // stamps the message, so the player knows how long it waited
+            static bool     sendCommand(QueueHandle_t *pQueue, PlayerControlMessage_s &message);
+
             // Constructor.  Only sets pin values.  Doesn't touch the chip.  Be sure to call begin()!
             Mp3player(uint8_t _cs_pin, uint8_t _dcs_pin, uint8_t _dreq_pin);
             ~Mp3player();
@@ -33,6 +47,7 @@
             void            begin( QueueHandle_t *commandQueue );
 
             void            SetSystemFlagGroup(EventGroupHandle_t eventGroup);
+            void            setMediaLibrary(MediaLibrary *pLibrary);    // resolves "#<id>" instead of a path
             QueueHandle_t   *getQueue( void );
 
         private:
@@ -40,11 +55,40 @@
             QueueHandle_t       *m_pPlayerQueue;
             EventGroupHandle_t  m_SystemFlagGroup;
             VS1053              *m_pPlayer;
+            MediaLibrary        *m_pLibrary;
 
             uint8_t             m_volume;
 
+            // the task sleeps until a command arrives, the read ahead has data or the timer is over (not on DREQ,
+            // it rises for every 32 bytes played, the timer refills the decoder FIFO in larger batches)
+            QueueSetHandle_t    m_events;
+            SemaphoreHandle_t   m_wakeup;
+
+            uint32_t            m_commandCount;                         // statistics of the command handling
+            uint32_t            m_maxCommandTime;                       // longest command in ms (e.g. opening a file)
+
+            static const uint32_t LATENCY_BUCKETS   = 8;                // <125us, <250us, ... <8ms, more
+            uint32_t            m_latencyHistogram[LATENCY_BUCKETS];    // from sendCommand() until the command is handled
+            uint32_t            m_maxLatency;                           // us
+
+            typedef enum {
+                WAKE_COMMAND,
+                WAKE_EVENT,                                             // read ahead data
+                WAKE_TIMER,
+                WAKE_COUNT,
+            } Wake_e;
+            uint32_t            m_wakeups[WAKE_COUNT];
+            uint32_t            m_statsStart;                           // millis() of the last reset, for the wake rate
+
+            const uint32_t      FEED_TIME_BUDGET    = 20;                   // max. ms to feed before commands are checked
+            const TickType_t    TIMER_PERIOD        = pdMS_TO_TICKS(20);    // feeds the decoder while playing, less than half the time
+                                                                        // its 2 KB FIFO lasts at 320 kbit/s
+
             //
             void Run( void );
+            void HandleCommand( PlayerControlMessage_s &PlayerControlMessage );
+            void RecordLatency( PlayerControlMessage_s &PlayerControlMessage );
+            void PrintStatistics( bool reset );
             void CleanUp( void );
 
             static void TaskFunctionAdapter(void *pvParameters);
@@ -1,5 +1,7 @@
 #include "UserInterface.h"
 #include "pinout.h"
+#include "SystemEventFlags.h"
+#include "latencyTrace.h"
 
 #ifdef ARDUINO_ARCH_ESP32
     #include "esp32-hal-log.h"
@@ -14,8 +16,32 @@ UserInterface::UserInterface() : m_CardHandler(),m_BtnVolumeUp(BUTTON_2),m_BtnVo
     m_CardStatus            = RfidCardStatus::NoCard;
     m_InterfaceCommandQueue = xQueueCreate( 5, sizeof( InterfaceCommandMessage_s ) );
 
+    m_CardDetectTime        = 0;
+    m_CardFromCache         = false;
+
+    m_CardInsertTime        = 0;
+
+    m_Paused                = false;
+    m_PauseTime             = 0;
+
+    m_BtnVolumeUpLong       = false;
+    m_BtnVolumeDownLong     = false;
+
+    m_Provision.Active      = false;
+    m_Provision.Queue       = xQueueCreate( PROVISION_QUEUE_SIZE, sizeof( CardData * ) );
+    m_Provision.pJob        = NULL;
+
+    m_CardIrq               = false;
+    m_CardIrqPending        = false;
+    m_CardDetectArmed       = false;
+    m_CardMisses            = 0;
+    m_CardChecks            = 0;
+    m_CardCheckTime         = 0;
+    memset(m_CardLatency, 0, sizeof(m_CardLatency));
+
     // these pointer must be set from "extern"
     m_pPlayerQueue          = NULL;    
+    m_SystemFlagGroup       = NULL;
     
 }
 
@@ -36,6 +62,12 @@ void UserInterface::setPlayerCommandQueue(QueueHandle_t *pCommandQueue)
 }
 
 
+void UserInterface::setSystemFlagGroup(EventGroupHandle_t eventGroup)
+{
+    m_SystemFlagGroup = eventGroup;
+}
+
+
 void UserInterface::begin( void )
 {
     ESP_LOGD(TAG, "Start User Interface Task");
@@ -47,6 +79,7 @@ void UserInterface::begin( void )
     }
 
     m_CardHandler.connectCardReader();
+    m_CardCache.begin();
 
     m_BtnPauseResume.begin();
     m_BtnVolumeUp.begin();
@@ -82,6 +115,11 @@ void UserInterface::run( void )
     InterfaceCommandMessage_s       InterfaceCommandMessage;
     ESP_LOGD(TAG, "User Interface Thread started");
 
+    #ifdef MFRC522_IRQ
+        //the card reader signals card answers by interrupt instead of being polled
+        m_CardIrq = m_CardHandler.beginCardDetect(MFRC522_IRQ, xTaskGetCurrentTaskHandle());
+    #endif
+
     while (true)
     {
         //check buttons
@@ -89,196 +127,90 @@ void UserInterface::run( void )
         m_BtnVolumeUp.read();
         m_BtnVolumeDown.read();
 
-        if (m_BtnVolumeUp.wasPressed())
+        if (m_BtnPauseResume.wasPressed())
         {
-            Mp3player::PlayerControlMessage_s newMessage = { .Command = Mp3player::CMD_VOL_UP, 
-                                                             .pFileToPlay = NULL };
-
-            if (xQueueSend( *m_pPlayerQueue, &newMessage, ( TickType_t ) 0 ) )
+            if (m_Paused)
             {
-                ESP_LOGD(TAG, "Send \"Volume Up\" Message to queue");
-            } 
-            else 
+                continuePlayback();
+            }
+            else if (m_CardStatus == RfidCardStatus::ValidCard)
             {
-                ESP_LOGE(TAG, "Send to player queue failed");
+                pausePlayback();
             }
         }
 
-        if (m_BtnVolumeDown.wasPressed())
+        //a long press skips the track, once per press
+        if (m_BtnVolumeUp.pressedFor(LONG_PRESS_TIME) && !m_BtnVolumeUpLong)
         {
-            Mp3player::PlayerControlMessage_s newMessage = { .Command = Mp3player::CMD_VOL_DOWN, 
-                                                             .pFileToPlay = NULL };
-
-            if (xQueueSend( *m_pPlayerQueue, &newMessage, ( TickType_t ) 0 ) )
-            {
-                ESP_LOGD(TAG, "Send \"Volume Down\" Message to queue");
-            } 
-            else 
-            {
-                ESP_LOGE(TAG, "Send to player queue failed");
-            }
+            m_BtnVolumeUpLong = true;
+            skipTrack(true);
         }
 
-        //check GyroSensor
-
+        if (m_BtnVolumeDown.pressedFor(LONG_PRESS_TIME) && !m_BtnVolumeDownLong)
+        {
+            m_BtnVolumeDownLong = true;
+            skipTrack(false);
+        }
 
-        //handle RFID-Cards        
-        switch (m_CardStatus)
+        //a short press changes the volume when it is released
+        if (m_BtnVolumeUp.wasReleased())
         {
-            case RfidCardStatus::UnknownCard:
-            case RfidCardStatus::ValidCard:
+            if (!m_BtnVolumeUpLong)
+            {
+                Mp3player::PlayerControlMessage_s newMessage = { .Command = Mp3player::CMD_VOL_UP, 
+                                                                 .pFileToPlay = NULL };
 
-                //do this check only if at least 1000ms have elapsed since the last check
-                if (TimeElapsed(m_CardTimestamp) >= 1000)
+                if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
+                {
+                    ESP_LOGD(TAG, "Send \"Volume Up\" Message to queue");
+                } 
+                else 
                 {
-                    
-                    //remember the new time
-                    m_CardTimestamp = millis();
+                    ESP_LOGE(TAG, "Send to player queue failed");
+                }
+            }
 
-                    //check if the card was removed
-                    if (m_CardHandler.IsCardPresent(&m_CardSerialNumber) == false)
-                    {
-                        //if it was a valid card, we must stop the playback
-                        if (m_CardStatus == RfidCardStatus::ValidCard)
-                        {
-                            ESP_LOGI(TAG,"EnRav Card removed, stopping playback.");
-
-                            //make sure we have a player queue available
-                            if (m_pPlayerQueue != NULL)
-                            {
-                                // stop playback
-                                Mp3player::PlayerControlMessage_s newMessage = { .Command = Mp3player::CMD_STOP };
-
-                                // the message is copied to the queue, so no need for the original one :)
-                                if (xQueueSend( *m_pPlayerQueue, &newMessage, ( TickType_t ) 0 ) )
-                                {
-                                    ESP_LOGD(TAG, "Send Stop Command to queue");
-                                } else {
-                                    ESP_LOGE(TAG, "Send to queue failed");
-                                }
-                            }
-                            else
-                            {
-                                ESP_LOGW(TAG, "No Player Queue");
-                            }
-                        }
-                        // if it is an unkown card we must do nothing
-                        else 
-                        {
-                            ESP_LOGI(TAG,"Card removed from reader");
-                        }
+            m_BtnVolumeUpLong = false;
+        }
 
-                        m_CardStatus = RfidCardStatus::NoCard;
+        if (m_BtnVolumeDown.wasReleased())
+        {
+            if (!m_BtnVolumeDownLong)
+            {
+                Mp3player::PlayerControlMessage_s newMessage = { .Command = Mp3player::CMD_VOL_DOWN, 
+                                                                 .pFileToPlay = NULL };
 
-                    } 
-                    else 
-                    {
-                        //end communication with the card
-                        m_CardHandler.StopCommunication();
-                    }
+                if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
+                {
+                    ESP_LOGD(TAG, "Send \"Volume Down\" Message to queue");
+                } 
+                else 
+                {
+                    ESP_LOGE(TAG, "Send to player queue failed");
                 }
+            }
 
-                break;
-            
-            //there is no known card on the reader
-            case RfidCardStatus::NoCard:
+            m_BtnVolumeDownLong = false;
+        }
 
-                //do this check only if at least 250ms have elapsed
-                if (TimeElapsed(m_CardTimestamp) >= 250)
-                {
-                    
-                    //remember the new time
-                    m_CardTimestamp = millis();
+        //check GyroSensor
 
-                    //check if a card is put onto the reader
-                    if ( m_CardHandler.IsNewCardPresent() == true) 
-                    {
 
-                        ESP_LOGD(TAG, "New card detected");
+        //measure how long a new card took until it could be heard
+        checkCardLatency();
 
-                        m_CardStatus = RfidCardStatus::UnknownCard;
+        //a removed card stops the playback only after a while
+        checkPauseGrace();
 
-                        // Try to get the serial of the card
-                        if ( m_CardHandler.GetCardSerial(&m_CardSerialNumber)) 
-                        {
 
-                            ESP_LOGI(TAG, "Card Serial is \"%s\"", m_CardSerialNumber.toString().c_str());
-
-                            //try to read the information from the card
-                            if ((m_CardHandler.ReadCardInformation(&m_CardData)) && (m_CardData.GetValid()))
-                            {
-                                ESP_LOGI(TAG, "Valid EnRav tag found");
-                                m_CardStatus = RfidCardStatus::ValidCard;
-
-                                //check check for "special" volume
-                                if (m_CardData.m_Volume != 0)
-                                {
-                                    Mp3player::PlayerControlMessage_s newMessage = { .Command = Mp3player::CMD_PLAY_FILE };
-
-                                    //TODO add volume
-
-                                    if (xQueueSend( *m_pPlayerQueue, &newMessage, ( TickType_t ) 0 ) )
-                                        {
-                                            ESP_LOGD(TAG, "Send \"Play File Message\" to queue");
-                                        } else {
-                                            ESP_LOGE(TAG, "Send to player queue failed");
-
-                                            // //if the send failed, we must do the job of deleting the string
-                                            delete(newMessage.pFileToPlay);
-                                        }
-                                }
-                                //play file (if set)
-                                if (m_CardData.m_fileName.length()) 
-                                {
-
-                                    if (m_pPlayerQueue != NULL) 
-                                    {
-                                        Mp3player::PlayerControlMessage_s newMessage;
-                                        
-                                        if (m_CardData.m_Resumeable)
-                                        {
-                                            newMessage.Command = Mp3player::CMD_RESUME_FILE;
-                                        }
-                                        else
-                                        {
-                                            newMessage.Command = Mp3player::CMD_PLAY_FILE;
-                                        }
-
-                                        //create a new String Object and attach the pointer to the new message
-                                        newMessage.pFileToPlay = new String(m_CardData.m_fileName);
-
-                                        if (xQueueSend( *m_pPlayerQueue, &newMessage, ( TickType_t ) 0 ) )
-                                        {
-                                            ESP_LOGD(TAG, "Send \"Play File Message\" to queue");
-                                        } else {
-                                            ESP_LOGE(TAG, "Send to player queue failed");
-
-                                            // //if the send failed, we must do the job of deleting the string
-                                            delete(newMessage.pFileToPlay);
-                                        }
-                                    }
-
-                                    ESP_LOGD(TAG, "Requesting file \"%s\"", m_CardData.m_fileName.c_str() );
-                                }
-                            } 
-                            else 
-                            {
-                                ESP_LOGI(TAG, "No valid tag found / could no read information");
-                                m_CardStatus = RfidCardStatus::UnknownCard;
-                            }
-                        } // serial read
-
-                        // end communication with the card
-                        m_CardHandler.StopCommunication();
-
-                    } // new card found
-                } // time elapsed
-
-               break;
-            default:
-                m_CardStatus = RfidCardStatus::NoCard;
-                ESP_LOGE(TAG, "illegal rfid card status");
-                break;
+        //handle RFID-Cards
+        if (m_CardIrq)
+        {
+            handleCardDetect();
+        }
+        else
+        {
+            pollCard();
         }
 
         //check for "external" commands
@@ -289,17 +221,7 @@ void UserInterface::run( void )
             // CMD_SET_VOLUME,
             if (InterfaceCommandMessage.Command == UserInterface::CMD_SET_VOLUME) 
             {
-                //make sure there is a volume
-                if (InterfaceCommandMessage.pData != NULL)
-                {
-                    // String *pFileName = (String *) InterfaceCommandMessage.pData;
-
-                    // ESP_LOGV(TAG, "Received FileName %s", pFileName->c_str());
-
-                    // //TODO create "next" message
-
-                    // delete (String*) InterfaceCommandMessage.pData;
-                }
+                sendVolumeCommand(InterfaceCommandMessage.Value);
             }
             // CMD_VOLUME_UP, 
             else if (InterfaceCommandMessage.Command == UserInterface::CMD_VOLUME_UP) 
@@ -307,7 +229,7 @@ void UserInterface::run( void )
                 Mp3player::PlayerControlMessage_s newMessage = { .Command = Mp3player::CMD_VOL_UP, 
                                                                  .pFileToPlay = NULL };
 
-                if (xQueueSend( *m_pPlayerQueue, &newMessage, ( TickType_t ) 0 ) )
+                if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
                 {
                     ESP_LOGD(TAG, "Send \"Volume Up\" Message to queue");
                 } 
@@ -322,7 +244,7 @@ void UserInterface::run( void )
                 Mp3player::PlayerControlMessage_s newMessage = { .Command = Mp3player::CMD_VOL_DOWN, 
                                                                  .pFileToPlay = NULL };
 
-                if (xQueueSend( *m_pPlayerQueue, &newMessage, ( TickType_t ) 0 ) )
+                if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
                 {
                     ESP_LOGD(TAG, "Send \"Volume Down\" Message to queue");
                 } 
@@ -344,6 +266,9 @@ void UserInterface::run( void )
                     if (m_CardHandler.WriteCardInformation(pNewCard, &m_CardSerialNumber)) 
                     {
                         ESP_LOGI(TAG, "Wrote card successfully");
+
+                        // the next time this card is seen, it should play the new content right away
+                        m_CardCache.store(&m_CardSerialNumber, pNewCard);
                     } 
                     else
                     {
@@ -353,6 +278,60 @@ void UserInterface::run( void )
                     delete (CardData *) InterfaceCommandMessage.pData;
                 }
             }
+            // CMD_PROVISION_START,
+            else if (InterfaceCommandMessage.Command == UserInterface::CMD_PROVISION_START)
+            {
+                String *pJobFile = (String *) InterfaceCommandMessage.pData;
+
+                if (m_Provision.Jobs)
+                {
+                    m_Provision.Jobs.close();
+                }
+
+                if (pJobFile != NULL)
+                {
+                    fs::FS &fs = SD;
+
+                    m_Provision.Jobs = fs.open(*pJobFile);
+
+                    if (!m_Provision.Jobs)
+                    {
+                        ESP_LOGW(TAG, "Could not open job list %s", pJobFile->c_str());
+                    }
+
+                    delete pJobFile;
+                }
+
+                startProvisioning();
+            }
+            // CMD_PROVISION_ADD,
+            else if (InterfaceCommandMessage.Command == UserInterface::CMD_PROVISION_ADD)
+            {
+                CardData *pJob = (CardData *) InterfaceCommandMessage.pData;
+
+                if (pJob != NULL)
+                {
+                    if (!xQueueSend( m_Provision.Queue, &pJob, ( TickType_t ) 0 ) )
+                    {
+                        ESP_LOGE(TAG, "Too many provisioning jobs");
+                        delete pJob;
+                    }
+                    else
+                    {
+                        startProvisioning();
+                    }
+                }
+            }
+            // CMD_PROVISION_STOP,
+            else if (InterfaceCommandMessage.Command == UserInterface::CMD_PROVISION_STOP)
+            {
+                stopProvisioning();
+            }
+            // CMD_PROVISION_STATUS,
+            else if (InterfaceCommandMessage.Command == UserInterface::CMD_PROVISION_STATUS)
+            {
+                printProvisionStatus();
+            }
             // CMD_PLAY_FILE,                
             else if (InterfaceCommandMessage.Command == UserInterface::CMD_PLAY_FILE) 
             {
@@ -368,7 +347,7 @@ void UserInterface::run( void )
                         //attach the pointer to the next message
                         newMessage.pFileToPlay = pFileName;
 
-                        if (xQueueSend( *m_pPlayerQueue, &newMessage, ( TickType_t ) 0 ) )
+                        if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
                         {
                             ESP_LOGD(TAG, "Send \"Play File Message\" for \"%s\" to queue", newMessage.pFileToPlay->c_str());
                         } 
@@ -401,7 +380,7 @@ void UserInterface::run( void )
                         //attach the pointer to the next message
                         newMessage.pFileToPlay = pFileName;
 
-                        if (xQueueSend( *m_pPlayerQueue, &newMessage, ( TickType_t ) 0 ) )
+                        if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
                         {
                             ESP_LOGD(TAG, "Send \"Resume File Message\" for \"%s\" to queue", newMessage.pFileToPlay->c_str());
                         } 
@@ -424,6 +403,8 @@ void UserInterface::run( void )
             {
                 ESP_LOGV(TAG, "Received stop");
 
+                m_Paused = false;
+
                 //make sure we have a player queue available
                 if (m_pPlayerQueue != NULL)
                 {
@@ -431,7 +412,7 @@ void UserInterface::run( void )
                     Mp3player::PlayerControlMessage_s newMessage = { .Command = Mp3player::CMD_STOP };
 
                     // the message is copied to the queue, so no need for the original one :)
-                    if (xQueueSend( *m_pPlayerQueue, &newMessage, ( TickType_t ) 0 ) )
+                    if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
                     {
                         ESP_LOGD(TAG, "Send Stop Command to queue");
                     } else {
@@ -442,12 +423,68 @@ void UserInterface::run( void )
                 {
                     ESP_LOGW(TAG, "No Player Queue");
                 }                                
+            }
+            // CMD_PLAY_NEXT, CMD_PLAY_PREV
+            else if ((InterfaceCommandMessage.Command == UserInterface::CMD_PLAY_NEXT) ||
+                     (InterfaceCommandMessage.Command == UserInterface::CMD_PLAY_PREV))
+            {
+                skipTrack((InterfaceCommandMessage.Command == UserInterface::CMD_PLAY_NEXT) ? true : false);
+            }
+            // CMD_PLAY_SEEK,
+            else if (InterfaceCommandMessage.Command == UserInterface::CMD_PLAY_SEEK)
+            {
+                //make sure we have a player queue available
+                if (m_pPlayerQueue != NULL)
+                {
+                    Mp3player::PlayerControlMessage_s newMessage = { .Command       = Mp3player::CMD_SEEK,
+                                                                     .pFileToPlay   = NULL,
+                                                                     .Value         = InterfaceCommandMessage.Value };
+
+                    if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
+                    {
+                        ESP_LOGD(TAG, "Send Seek Command to queue");
+                    } else {
+                        ESP_LOGE(TAG, "Send to queue failed");
+                    }
+                }
+                else
+                {
+                    ESP_LOGW(TAG, "No Player Queue");
+                }
+            }
+            // CMD_STATS, CMD_STATS_RESET
+            else if ((InterfaceCommandMessage.Command == UserInterface::CMD_STATS) ||
+                     (InterfaceCommandMessage.Command == UserInterface::CMD_STATS_RESET))
+            {
+                printStatistics((InterfaceCommandMessage.Command == UserInterface::CMD_STATS_RESET) ? true : false);
+
+                //make sure we have a player queue available
+                if (m_pPlayerQueue != NULL)
+                {
+                    Mp3player::PlayerControlMessage_s newMessage = { .Command = (InterfaceCommandMessage.Command == UserInterface::CMD_STATS_RESET) ? Mp3player::CMD_STATS_RESET : Mp3player::CMD_STATS,
+                                                                     .pFileToPlay = NULL };
+
+                    if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
+                    {
+                        ESP_LOGD(TAG, "Send Statistics Command to queue");
+                    } else {
+                        ESP_LOGE(TAG, "Send to queue failed");
+                    }
+                }
+                else
+                {
+                    ESP_LOGW(TAG, "No Player Queue");
+                }
             } else {
                 ESP_LOGW(TAG, "Unknown command reveived!");
             }
         }
 
-        delay(5);        
+        //sleep until the next button check, the card reader interrupt wakes us earlier
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(5)))
+        {
+            m_CardIrqPending = true;
+        }
     }
 }
 
@@ -457,6 +494,743 @@ void UserInterface::cleanUp( void )
 }     
 
 
+void UserInterface::pollCard( void )
+{
+    uint32_t    checkStart;
+    bool        present;
+
+    switch (m_CardStatus)
+    {
+        case RfidCardStatus::UnknownCard:
+        case RfidCardStatus::ValidCard:
+
+            //fast checks while something would notice the removal, slow ones otherwise
+            if (TimeElapsed(m_CardTimestamp) >= cardCheckInterval())
+            {
+                
+                //remember the new time
+                m_CardTimestamp = millis();
+
+                //check if the card was removed
+                checkStart = micros();
+                present = m_CardHandler.IsCardPresent(&m_CardSerialNumber);
+                m_CardCheckTime += micros() - checkStart;
+                m_CardChecks++;
+
+                if (present == false)
+                {
+                    cardRemoved();
+                } 
+                else 
+                {
+                    //end communication with the card
+                    m_CardHandler.StopCommunication();
+                }
+            }
+
+            break;
+        
+        //there is no known card on the reader
+        case RfidCardStatus::NoCard:
+
+            //do this check only if at least 250ms have elapsed
+            if (TimeElapsed(m_CardTimestamp) >= 250)
+            {
+                
+                //remember the new time
+                m_CardTimestamp = millis();
+
+                //check if a card is put onto the reader
+                checkStart = micros();
+                present = m_CardHandler.IsNewCardPresent();
+                m_CardCheckTime += micros() - checkStart;
+                m_CardChecks++;
+
+                if (present == true)
+                {
+
+                    ESP_LOGD(TAG, "New card detected");
+
+                    m_CardStatus        = RfidCardStatus::UnknownCard;
+                    m_CardDetectTime    = millis();
+                    m_CardInsertTime    = millis();
+
+                    LatencyTrace::start();
+
+                    handleNewCard();
+
+                    // end communication with the card
+                    m_CardHandler.StopCommunication();
+
+                } // new card found
+            } // time elapsed
+
+           break;
+        default:
+            m_CardStatus = RfidCardStatus::NoCard;
+            ESP_LOGE(TAG, "illegal rfid card status");
+            break;
+    }
+}
+
+
+uint32_t UserInterface::cardCheckInterval( void )
+{
+    // right after the insertion the card might be taken away again quickly
+    if (TimeElapsed(m_CardInsertTime) < CARD_SETTLE_TIME)
+    {
+        return CARD_CHECK_FAST;
+    }
+
+    // the playback must stop as soon as the card is gone
+    if ((m_SystemFlagGroup != NULL) && (xEventGroupGetBits(m_SystemFlagGroup) & SF_PLAYING_FILE))
+    {
+        return CARD_CHECK_FAST;
+    }
+
+    return CARD_CHECK_SLOW;
+}
+
+
+void UserInterface::handleCardDetect( void )
+{
+    uint32_t    checkStart;
+    bool        present;
+
+    // the reader answers with an interrupt, either from the card or from its timeout
+    if (m_CardDetectArmed)
+    {
+        // a lost interrupt must not stop the detection
+        if (!m_CardIrqPending && (TimeElapsed(m_CardTimestamp) < CARD_IRQ_TIMEOUT))
+        {
+            return;
+        }
+
+        m_CardDetectArmed   = false;
+        m_CardIrqPending    = false;
+
+        checkStart = micros();
+
+        if (m_CardStatus == RfidCardStatus::NoCard)
+        {
+            present = m_CardHandler.cardDetected(NULL);
+            m_CardCheckTime += micros() - checkStart;
+
+            if (present)
+            {
+                ESP_LOGD(TAG, "New card detected");
+
+                m_CardStatus        = RfidCardStatus::UnknownCard;
+                m_CardDetectTime    = millis();
+                m_CardMisses        = 0;
+
+                LatencyTrace::start();
+
+                handleNewCard();
+
+                // end communication with the card
+                m_CardHandler.StopCommunication();
+            }
+        }
+        else
+        {
+            present = m_CardHandler.cardDetected(&m_CardSerialNumber);
+
+            // back to halt, so the next WUPA gets an answer again
+            m_CardHandler.StopCommunication();
+            m_CardCheckTime += micros() - checkStart;
+
+            // since wireless communication is voodoo we'll give it a few retrys before killing the music
+            if (present)
+            {
+                m_CardMisses = 0;
+            }
+            else if (++m_CardMisses >= CARD_MISSES)
+            {
+                cardRemoved();
+            }
+        }
+
+        m_CardTimestamp = millis();
+        return;
+    }
+
+    // retries are done right away
+    if ((m_CardMisses != 0) || (TimeElapsed(m_CardTimestamp) >= CARD_DETECT_PERIOD))
+    {
+        checkStart = micros();
+
+        m_CardIrqPending    = false;
+        m_CardHandler.armCardDetect(m_CardStatus != RfidCardStatus::NoCard);
+
+        m_CardCheckTime += micros() - checkStart;
+        m_CardChecks++;
+
+        m_CardDetectArmed   = true;
+        m_CardTimestamp     = millis();
+    }
+}
+
+
+void UserInterface::cardRemoved( void )
+{
+    //if it was a valid card, we must stop the playback
+    if (m_CardStatus == RfidCardStatus::ValidCard)
+    {
+        ESP_LOGI(TAG,"EnRav Card removed, pausing playback.");
+
+        //the card might be back in a moment, so only pause (maybe it is paused by the button already)
+        if (!m_Paused)
+        {
+            pausePlayback();
+        }
+
+        m_PauseTime = millis();
+    }
+    // if it is an unkown card we must do nothing
+    else 
+    {
+        ESP_LOGI(TAG,"Card removed from reader");
+    }
+
+    m_CardStatus = RfidCardStatus::NoCard;
+    m_CardMisses = 0;
+}
+
+
+void UserInterface::handleProvisionCard( void )
+{
+    CardData    existing;
+    CardData    *pJob;
+    bool        foreign;
+    uint32_t    startTime = millis();
+
+    // the card stays "unknown", so the next one is only taken after it was removed
+    m_CardStatus        = RfidCardStatus::UnknownCard;
+    m_CardDetectTime    = 0;
+
+    // never overwrite a card that is in use already (e.g. placed a second time)
+    if (m_CardHandler.ReadCardInformation(&existing, &foreign) && existing.GetValid())
+    {
+        ESP_LOGW(TAG, "Card holds \"%s\" already, skipped", existing.m_fileName.c_str());
+        m_Provision.Skipped++;
+        return;
+    }
+
+    // only a card that was read and is blank (or foreign) is written, an RF error could hide a valid one
+    if (!foreign)
+    {
+        ESP_LOGW(TAG, "Could not read the card, not written");
+        Serial.println("Could not read the card, please remove it and place it again");
+
+        m_CardHandler.StopCommunication();
+        return;
+    }
+
+    m_CardHandler.StopCommunication();
+
+    pJob = nextProvisionJob();
+
+    if (pJob == NULL)
+    {
+        ESP_LOGI(TAG, "No more provisioning jobs");
+        stopProvisioning();
+        return;
+    }
+
+    if (m_CardHandler.WriteCardInformation(pJob, &m_CardSerialNumber) &&
+        m_CardHandler.VerifyCardInformation(pJob, &m_CardSerialNumber))
+    {
+        m_Provision.Written++;
+
+        ESP_LOGI(TAG, "Card %u written with \"%s\" in %u ms", m_Provision.Written, pJob->m_fileName.c_str(), millis() - startTime);
+
+        m_CardCache.store(&m_CardSerialNumber, pJob);
+
+        delete pJob;
+        m_Provision.pJob = NULL;
+    }
+    else
+    {
+        // the job stays for the next card
+        m_Provision.Failed++;
+
+        ESP_LOGW(TAG, "Writing \"%s\" FAILED, try another card", pJob->m_fileName.c_str());
+    }
+
+    printProvisionStatus();
+}
+
+
+CardData *UserInterface::nextProvisionJob( void )
+{
+    // a failed job is tried again first, then the ones given by command, then the job list
+    if ((m_Provision.pJob == NULL) && !xQueueReceive( m_Provision.Queue, &(m_Provision.pJob), ( TickType_t ) 0 ))
+    {
+        m_Provision.pJob = NULL;
+    }
+
+    while ((m_Provision.pJob == NULL) && m_Provision.Jobs && m_Provision.Jobs.available())
+    {
+        String  line = m_Provision.Jobs.readStringUntil('\n');
+        int32_t separator;
+
+        line.trim();
+
+        if ((line.length() == 0) || (line.charAt(0) == '#'))
+        {
+            continue;
+        }
+
+        m_Provision.pJob = new CardData();
+        m_Provision.pJob->m_Volume      = 0;
+        m_Provision.pJob->m_Resumeable  = false;
+        m_Provision.pJob->m_valid       = true;
+
+        // the flags follow the file name, separated by ','
+        separator = line.indexOf(',');
+        m_Provision.pJob->m_fileName = (separator < 0) ? line : line.substring(0, separator);
+        m_Provision.pJob->m_fileName.trim();
+
+        while (separator >= 0)
+        {
+            int32_t next = line.indexOf(',', separator + 1);
+            String  flag = line.substring(separator + 1, (next < 0) ? line.length() : next);
+
+            flag.trim();
+
+            if (flag.equalsIgnoreCase("RESUME"))
+            {
+                m_Provision.pJob->m_Resumeable = true;
+            }
+            else if (flag.startsWith("start="))
+            {
+                m_Provision.pJob->m_StartOffset = flag.substring(6).toInt();
+            }
+            else if (flag.toInt() > 0)
+            {
+                m_Provision.pJob->m_Volume = flag.toInt();
+            }
+
+            separator = next;
+        }
+    }
+
+    return m_Provision.pJob;
+}
+
+
+void UserInterface::startProvisioning( void )
+{
+    if (m_Provision.Active)
+    {
+        return;
+    }
+
+    m_Provision.Active      = true;
+    m_Provision.Written     = 0;
+    m_Provision.Failed      = 0;
+    m_Provision.Skipped     = 0;
+    m_Provision.StartTime   = millis();
+
+    ESP_LOGI(TAG, "Provisioning started, place the blank cards one after the other");
+}
+
+
+void UserInterface::stopProvisioning( void )
+{
+    CardData *pJob;
+
+    if (!m_Provision.Active)
+    {
+        return;
+    }
+
+    printProvisionStatus();
+
+    if (m_Provision.Jobs)
+    {
+        m_Provision.Jobs.close();
+    }
+
+    if (m_Provision.pJob != NULL)
+    {
+        delete m_Provision.pJob;
+        m_Provision.pJob = NULL;
+    }
+
+    while (xQueueReceive( m_Provision.Queue, &pJob, ( TickType_t ) 0 ))
+    {
+        delete pJob;
+    }
+
+    m_Provision.Active = false;
+
+    ESP_LOGI(TAG, "Provisioning stopped");
+}
+
+
+void UserInterface::printProvisionStatus( void )
+{
+    uint32_t duration = TimeElapsed(m_Provision.StartTime);
+
+    if (!m_Provision.Active)
+    {
+        Serial.println("Provisioning is not active");
+        return;
+    }
+
+    Serial.printf("Provisioning: %u written, %u failed, %u skipped, %u jobs waiting, %u.%u cards/min\n",
+                  m_Provision.Written, m_Provision.Failed, m_Provision.Skipped, uxQueueMessagesWaiting(m_Provision.Queue),
+                  duration ? ((m_Provision.Written * 60000) / duration) : 0, duration ? (((m_Provision.Written * 600000) / duration) % 10) : 0);
+}
+
+
+void UserInterface::handleNewCard( void )
+{
+    CardData    cachedData;
+    bool        cached;
+    bool        foreign;
+
+    // Try to get the serial of the card
+    if (!m_CardHandler.GetCardSerial(&m_CardSerialNumber))
+    {
+        return;
+    }
+
+    LatencyTrace::mark(LatencyTrace::STAGE_SERIAL_READ);
+
+    ESP_LOGI(TAG, "Card Serial is \"%s\"", m_CardSerialNumber.toString().c_str());
+
+    // the paused card is back, the player still has everything (unless the file has ended meanwhile)
+    if (m_Paused && (m_PauseTime != 0) &&
+        ((m_SystemFlagGroup == NULL) || (xEventGroupGetBits(m_SystemFlagGroup) & SF_PLAYING_FILE)) &&
+        (m_CardSerialNumber.SerialNumberLength == m_PausedSerial.SerialNumberLength) &&
+        (memcmp(m_CardSerialNumber.SerialNumber, m_PausedSerial.SerialNumber, m_PausedSerial.SerialNumberLength) == 0))
+    {
+        ESP_LOGI(TAG, "Paused card is back, continue playback");
+
+        m_CardStatus        = RfidCardStatus::ValidCard;
+        m_CardDetectTime    = 0;
+
+        continuePlayback();
+        return;
+    }
+
+    // while provisioning cards nothing is played
+    if (m_Provision.Active)
+    {
+        handleProvisionCard();
+        return;
+    }
+
+    // a known card is played right away, the card itself is read while the player opens the file
+    cached = m_CardCache.lookup(&m_CardSerialNumber, &cachedData);
+
+    if (cached)
+    {
+        ESP_LOGI(TAG, "Known card, start playback from the cache");
+
+        m_CardData          = cachedData;
+        m_CardStatus        = RfidCardStatus::ValidCard;
+        m_CardFromCache     = true;
+
+        sendPlayCommand();
+    }
+
+    //try to read the information from the card
+    if ((m_CardHandler.ReadCardInformation(&m_CardData, &foreign)) && (m_CardData.GetValid()))
+    {
+        LatencyTrace::mark(LatencyTrace::STAGE_CARD_READ);
+
+        // only written if something has changed
+        m_CardCache.store(&m_CardSerialNumber, &m_CardData);
+
+        if (!cached)
+        {
+            ESP_LOGI(TAG, "Valid EnRav tag found");
+
+            m_CardStatus    = RfidCardStatus::ValidCard;
+            m_CardFromCache = false;
+
+            sendPlayCommand();
+        }
+        else if ((m_CardData.m_fileName != cachedData.m_fileName) ||
+                 (m_CardData.m_Resumeable != cachedData.m_Resumeable) ||
+                 (m_CardData.m_Volume != cachedData.m_Volume) ||
+                 (m_CardData.m_StartOffset != cachedData.m_StartOffset))
+        {
+            ESP_LOGI(TAG, "Card was rewritten, playing the new content");
+
+            // the wrong file might have been started already, that's no useful latency
+            sendPlayCommand();
+            m_CardDetectTime = 0;
+        }
+    }
+    else if (cached && foreign)
+    {
+        // the card was read fine but erased or rewritten by something else, the cached content is wrong
+        ESP_LOGW(TAG, "Known card is no EnRav card anymore, stopping");
+
+        m_CardCache.remove(&m_CardSerialNumber);
+        sendPlayerCommand(Mp3player::CMD_STOP);
+
+        m_CardStatus        = RfidCardStatus::UnknownCard;
+        m_CardDetectTime    = 0;
+    }
+    else if (cached)
+    {
+        // could be a bad moment of the RF as well, so keep on playing but read the card next time
+        ESP_LOGW(TAG, "Could not verify the known card");
+
+        m_CardCache.remove(&m_CardSerialNumber);
+        m_CardData = cachedData;
+    }
+    else
+    {
+        ESP_LOGI(TAG, "No valid tag found / could no read information");
+
+        m_CardStatus        = RfidCardStatus::UnknownCard;
+        m_CardDetectTime    = 0;
+    }
+}
+
+
+bool UserInterface::sendPlayCommand( void )
+{
+    bool result = false;
+
+    //the player closes a paused file when it opens the new one
+    m_Paused = false;
+
+    //check check for "special" volume
+    if (m_CardData.m_Volume != 0)
+    {
+        sendVolumeCommand(m_CardData.m_Volume);
+    }
+    //play file (if set)
+    if (m_CardData.m_fileName.length()) 
+    {
+
+        if (m_pPlayerQueue != NULL) 
+        {
+            Mp3player::PlayerControlMessage_s newMessage;
+            
+            if (m_CardData.m_Resumeable)
+            {
+                newMessage.Command = Mp3player::CMD_RESUME_FILE;
+            }
+            else
+            {
+                newMessage.Command = Mp3player::CMD_PLAY_FILE;
+            }
+
+            //create a new String Object and attach the pointer to the new message
+            newMessage.pFileToPlay = new String(m_CardData.m_fileName);
+
+            //the start offset goes with the file, a separate seek could be lost in a full queue
+            //(a resumed file continues at its own position)
+            newMessage.Value = m_CardData.m_Resumeable ? 0 : m_CardData.m_StartOffset;
+
+            //the flag of the previous file must not end the latency measurement
+            if (m_SystemFlagGroup)
+            {
+                xEventGroupClearBits(m_SystemFlagGroup, SF_AUDIO_STARTED);
+            }
+
+            //before the send, the player might take the command right away
+            LatencyTrace::mark(LatencyTrace::STAGE_QUEUE_SEND);
+
+            if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
+            {
+                ESP_LOGD(TAG, "Send \"Play File Message\" to queue");
+                result = true;
+            } else {
+                ESP_LOGE(TAG, "Send to player queue failed");
+
+                // //if the send failed, we must do the job of deleting the string
+                delete(newMessage.pFileToPlay);
+            }
+        }
+
+        ESP_LOGD(TAG, "Requesting file \"%s\"", m_CardData.m_fileName.c_str() );
+    }
+
+    return result;
+}
+
+
+bool UserInterface::sendPlayerCommand( Mp3player::PlayerCommand_e command )
+{
+    bool result = false;
+
+    //make sure we have a player queue available
+    if (m_pPlayerQueue != NULL)
+    {
+        Mp3player::PlayerControlMessage_s newMessage = { .Command       = command,
+                                                         .pFileToPlay   = NULL,
+                                                         .Value         = 0 };
+
+        // the message is copied to the queue, so no need for the original one :)
+        if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
+        {
+            ESP_LOGD(TAG, "Send Command %u to queue", command);
+            result = true;
+        } else {
+            ESP_LOGE(TAG, "Send to queue failed");
+        }
+    }
+    else
+    {
+        ESP_LOGW(TAG, "No Player Queue");
+    }
+
+    return result;
+}
+
+
+void UserInterface::pausePlayback( void )
+{
+    //a stream can't wait for us
+    if (m_CardData.m_fileName.startsWith("http"))
+    {
+        sendPlayerCommand(Mp3player::CMD_STOP);
+        return;
+    }
+
+    if (sendPlayerCommand(Mp3player::CMD_PAUSE))
+    {
+        m_Paused        = true;
+        m_PauseTime     = 0;
+        m_PausedSerial  = m_CardSerialNumber;
+    }
+}
+
+
+void UserInterface::continuePlayback( void )
+{
+    if (sendPlayerCommand(Mp3player::CMD_CONTINUE))
+    {
+        m_Paused        = false;
+        m_PauseTime     = 0;
+    }
+}
+
+
+void UserInterface::checkPauseGrace( void )
+{
+    //paused by the button with the card on the reader, that could last
+    if (!m_Paused || (m_PauseTime == 0))
+    {
+        return;
+    }
+
+    if (TimeElapsed(m_PauseTime) >= PAUSE_GRACE_TIME)
+    {
+        ESP_LOGI(TAG, "Card did not come back, stopping playback.");
+
+        // the player saves the position and closes the file now
+        sendPlayerCommand(Mp3player::CMD_STOP);
+
+        m_Paused        = false;
+        m_PauseTime     = 0;
+    }
+}
+
+
+void UserInterface::skipTrack( bool forward )
+{
+    //the player would continue with the new track, but the card is away
+    if (m_Paused)
+    {
+        ESP_LOGD(TAG, "Paused, no skip");
+        return;
+    }
+
+    sendPlayerCommand(forward ? Mp3player::CMD_NEXT : Mp3player::CMD_PREV);
+}
+
+
+void UserInterface::sendVolumeCommand( uint32_t volume )
+{
+    if (m_pPlayerQueue != NULL)
+    {
+        Mp3player::PlayerControlMessage_s newMessage = { .Command       = Mp3player::CMD_SET_VOLUME,
+                                                         .pFileToPlay   = NULL,
+                                                         .Value         = volume };
+
+        if (Mp3player::sendCommand( m_pPlayerQueue, newMessage ) )
+        {
+            ESP_LOGD(TAG, "Send \"Set Volume %u\" to queue", volume);
+        } else {
+            ESP_LOGE(TAG, "Send to player queue failed");
+        }
+    }
+    else
+    {
+        ESP_LOGW(TAG, "No Player Queue");
+    }
+}
+
+
+void UserInterface::checkCardLatency( void )
+{
+    uint32_t latency;
+
+    if ((m_CardDetectTime == 0) || (m_SystemFlagGroup == NULL))
+    {
+        return;
+    }
+
+    latency = TimeElapsed(m_CardDetectTime);
+
+    if (xEventGroupGetBits(m_SystemFlagGroup) & SF_AUDIO_STARTED)
+    {
+        CardLatency_s *pLatency = &m_CardLatency[m_CardFromCache ? 1 : 0];
+
+        pLatency->Count++;
+        pLatency->Sum += latency;
+        if (latency > pLatency->Max)
+        {
+            pLatency->Max = latency;
+        }
+
+        ESP_LOGI(TAG, "Card to first audio: %u ms (%s)", latency, m_CardFromCache ? "cached" : "read from card");
+
+        m_CardDetectTime = 0;
+    }
+    else if (latency > LATENCY_TIMEOUT)
+    {
+        m_CardDetectTime = 0;
+    }
+}
+
+
+void UserInterface::printStatistics( bool reset )
+{
+    const char *pName[] = { "read", "cached" };
+
+    Serial.printf("- card cache         : %u hits, %u misses\n", m_CardCache.getHits(), m_CardCache.getMisses());
+    Serial.printf("- card RF commands   : %u\n", m_CardHandler.getRfTransactions());
+    Serial.printf("- card checks        : %u (%s), %u ms on SPI\n", m_CardChecks, m_CardIrq ? "interrupt" : "polling", m_CardCheckTime / 1000);
+
+    for (uint32_t counter = 0; counter < 2; counter++)
+    {
+        Serial.printf("- card to audio (%-6s): %u cards, avg %u ms, max %u ms\n", pName[counter], m_CardLatency[counter].Count,
+                      m_CardLatency[counter].Count ? (m_CardLatency[counter].Sum / m_CardLatency[counter].Count) : 0, m_CardLatency[counter].Max);
+    }
+
+    if (reset)
+    {
+        m_CardCache.resetStatistics();
+        m_CardHandler.resetStatistics();
+        m_CardChecks        = 0;
+        m_CardCheckTime     = 0;
+        memset(m_CardLatency, 0, sizeof(m_CardLatency));
+    }
+}
+
+
 uint32_t UserInterface::TimeElapsed(uint32_t TimeStamp)
 {
     uint32_t result;
@@ -4,6 +4,7 @@
     #include "Arduino.h"    
 
     #include "cardHandler.h"
+    #include "cardCache.h"
 
     #include "mp3player.h"
 
@@ -28,11 +29,23 @@
                 CMD_PLAY_FILE,
                 CMD_RESUME_FILE,
                 CMD_PLAY_STOP,
+                CMD_PLAY_SEEK,
+                CMD_PLAY_NEXT,
+                CMD_PLAY_PREV,
+
+                CMD_STATS,
+                CMD_STATS_RESET,
+
+                CMD_PROVISION_START,                            // pData: String with a CSV file of jobs (or NULL)
+                CMD_PROVISION_ADD,                              // pData: CardData of one job
+                CMD_PROVISION_STOP,
+                CMD_PROVISION_STATUS,
             } InterfaceCommand_e;
 
             typedef struct {
                 InterfaceCommand_e      Command;
                 void                    *pData;
+                uint32_t                Value;                  // command parameter without allocated data
             } InterfaceCommandMessage_s;
 
 
@@ -41,6 +54,7 @@
             ~UserInterface();
 
             void setPlayerCommandQueue(QueueHandle_t *pCommandQueue);
+            void setSystemFlagGroup(EventGroupHandle_t eventGroup);
 
             void begin(void);
 
@@ -57,6 +71,65 @@
             CardHandler             m_CardHandler;          // the class that handels all RFID card communication
             CardSerialNumber        m_CardSerialNumber;     // the last read Uid                        
             uint32_t                m_CardTimestamp;        // 
+            CardCache               m_CardCache;            // known cards, so playback could start before the card is read
+
+            // time from a new card until its first audio, without (0) and with (1) the cache
+            typedef struct {
+                uint32_t            Count;
+                uint32_t            Sum;
+                uint32_t            Max;
+            } CardLatency_s;
+
+            CardLatency_s           m_CardLatency[2];
+            uint32_t                m_CardDetectTime;       // millis() of the actual card, 0 if nothing is measured
+            bool                    m_CardFromCache;
+
+            const uint32_t          LATENCY_TIMEOUT = 10000;    // give up waiting for the first audio (ms)
+
+            // polling schedule of the card presence
+            uint32_t                m_CardInsertTime;
+
+            const uint32_t          CARD_CHECK_FAST     = 50;   // ms, after the insertion and while playing
+            const uint32_t          CARD_CHECK_SLOW     = 500;  // ms, otherwise
+            const uint32_t          CARD_SETTLE_TIME    = 5000; // ms after the insertion with fast checks
+
+            // card detection by the interrupt of the reader (MFRC522_IRQ)
+            bool                    m_CardIrq;
+            volatile bool           m_CardIrqPending;
+            bool                    m_CardDetectArmed;      // a REQA/WUPA is on its way
+            uint32_t                m_CardMisses;           // card did not answer in a row
+
+            uint32_t                m_CardChecks;           // statistics of the card detection
+            uint32_t                m_CardCheckTime;        // us on the SPI bus
+
+            const uint32_t          CARD_DETECT_PERIOD  = 100;  // ms between two detections
+            const uint32_t          CARD_IRQ_TIMEOUT    = 50;   // the reader times out after 25ms
+            const uint32_t          CARD_MISSES         = 3;    // card is gone after this many missing answers
+
+            // hot pause: a removed card only pauses the player, the same card continues right away
+            bool                    m_Paused;
+            uint32_t                m_PauseTime;            // millis() of the removal, 0 while the card is there
+            CardSerialNumber        m_PausedSerial;
+
+            const uint32_t          PAUSE_GRACE_TIME    = 15000;    // ms until a removed card really stops
+
+            // provisioning: every blank card gets the next job written
+            typedef struct {
+                bool                Active;
+                File                Jobs;               // CSV "<file name>[,resume][,<volume>]" per line
+                QueueHandle_t       Queue;              // CardData* added by command
+                CardData            *pJob;              // job for the next blank card
+                uint32_t            Written;
+                uint32_t            Failed;
+                uint32_t            Skipped;            // cards that have been written already
+                uint32_t            StartTime;
+            } Provision_s;
+
+            Provision_s             m_Provision;
+
+            const uint32_t          PROVISION_QUEUE_SIZE = 32;
+
+            EventGroupHandle_t      m_SystemFlagGroup;
 
             // our connection to the MP3 task
             QueueHandle_t           *m_pPlayerQueue;
@@ -69,9 +142,36 @@
             Button                  m_BtnVolumeDown;
             Button                  m_BtnPauseResume;
 
+            // a long press of the volume buttons skips the track instead
+            bool                    m_BtnVolumeUpLong;
+            bool                    m_BtnVolumeDownLong;
+
+            const uint32_t          LONG_PRESS_TIME     = 800;  // ms
+
             //internal functions
             void run( void );
             void cleanUp( void );
+
+            bool sendPlayCommand( void );
+            void sendVolumeCommand( uint32_t volume );     // 1..100
+            bool sendPlayerCommand( Mp3player::PlayerCommand_e command );
+            void pausePlayback( void );
+            void continuePlayback( void );
+            void checkPauseGrace( void );
+            void skipTrack( bool forward );
+            void handleNewCard( void );
+            void pollCard( void );
+            uint32_t cardCheckInterval( void );
+            void handleCardDetect( void );
+            void cardRemoved( void );
+            void checkCardLatency( void );
+            void printStatistics( bool reset );
+
+            void handleProvisionCard( void );
+            CardData *nextProvisionJob( void );
+            void startProvisioning( void );
+            void stopProvisioning( void );
+            void printProvisionStatus( void );
             
             static void TaskFunctionAdapter(void *pvParameters);
 
@@ -0,0 +1,234 @@
+#include "cardCache.h"
+
+#include "Preferences.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+    #include "esp32-hal-log.h"
+#else
+    static const char *TAG = "CardCache";
+#endif
+
+CardCache::CardCache()
+{
+    memset(m_entries, 0, sizeof(m_entries));
+
+    m_stamp     = 1;
+
+    resetStatistics();
+}
+
+CardCache::~CardCache()
+{
+
+}
+
+
+void CardCache::begin( void )
+{
+    Preferences prefs;
+    char        key[4];
+    uint32_t    used = 0;
+
+    prefs.begin(NVS_NAMESPACE, true);
+
+    for (uint32_t slot = 0; slot < CACHE_ENTRIES; slot++)
+    {
+        CacheEntry_s    *pEntry = &m_entries[slot];
+        size_t          length;
+
+        slotKey(slot, key);
+
+        memset(pEntry, 0, sizeof(CacheEntry_s));
+
+        if (!prefs.isKey(key))
+        {
+            continue;
+        }
+
+        length = prefs.getBytes(key, pEntry, sizeof(CacheEntry_s));
+
+        // drop everything that does not fit together
+        if ((length < offsetof(CacheEntry_s, FileName)) ||
+            (pEntry->UidLength > sizeof(pEntry->Uid)) ||
+            (pEntry->FileNameLength > MAX_FILE_NAME) ||
+            (length != (offsetof(CacheEntry_s, FileName) + pEntry->FileNameLength)))
+        {
+            ESP_LOGW(TAG, "Dropping invalid cache entry %u", slot);
+            memset(pEntry, 0, sizeof(CacheEntry_s));
+            continue;
+        }
+
+        pEntry->FileName[pEntry->FileNameLength] = 0;
+
+        if (pEntry->Stamp >= m_stamp)
+        {
+            m_stamp = pEntry->Stamp + 1;
+        }
+
+        if (pEntry->UidLength)
+        {
+            used++;
+        }
+    }
+
+    prefs.end();
+
+    ESP_LOGI(TAG, "%u cards known", used);
+}
+
+
+bool CardCache::lookup(CardSerialNumber *pSerial, CardData *pTarget)
+{
+    int32_t slot = find(pSerial);
+
+    if (slot < 0)
+    {
+        m_misses++;
+        return false;
+    }
+
+    m_hits++;
+
+    // only the RAM copy knows about this use, that's good enough for the eviction
+    m_entries[slot].Stamp   = m_stamp++;
+
+    pTarget->m_fileName     = String(m_entries[slot].FileName);
+    pTarget->m_Volume       = m_entries[slot].Volume;
+    pTarget->m_Resumeable   = m_entries[slot].Resumeable ? true : false;
+    pTarget->m_StartOffset  = m_entries[slot].StartOffset;
+    pTarget->m_valid        = true;
+
+    return true;
+}
+
+
+void CardCache::store(CardSerialNumber *pSerial, CardData *pSource)
+{
+    int32_t         slot = find(pSerial);
+    CacheEntry_s    *pEntry;
+
+    if (pSource->m_fileName.length() > MAX_FILE_NAME)
+    {
+        return;
+    }
+
+    if (slot < 0)
+    {
+        // take a free slot or the one that was not used for the longest time
+        slot = 0;
+        for (uint32_t counter = 1; counter < CACHE_ENTRIES; counter++)
+        {
+            if ((m_entries[slot].UidLength != 0) &&
+                ((m_entries[counter].UidLength == 0) || (m_entries[counter].Stamp < m_entries[slot].Stamp)))
+            {
+                slot = counter;
+            }
+        }
+
+        ESP_LOGD(TAG, "New card in slot %u", slot);
+    }
+    else if ((m_entries[slot].Volume == pSource->m_Volume) &&
+             ((m_entries[slot].Resumeable ? true : false) == pSource->m_Resumeable) &&
+             (m_entries[slot].StartOffset == pSource->m_StartOffset) &&
+             pSource->m_fileName.equals(m_entries[slot].FileName))
+    {
+        // nothing changed, spare the flash
+        return;
+    }
+
+    pEntry = &m_entries[slot];
+
+    memset(pEntry, 0, sizeof(CacheEntry_s));
+
+    pEntry->Stamp           = m_stamp++;
+    pEntry->UidLength       = pSerial->SerialNumberLength;
+    memcpy(pEntry->Uid, pSerial->SerialNumber, pEntry->UidLength);
+    pEntry->Volume          = pSource->m_Volume;
+    pEntry->Resumeable      = pSource->m_Resumeable ? 1 : 0;
+    pEntry->StartOffset     = pSource->m_StartOffset;
+    pEntry->FileNameLength  = pSource->m_fileName.length();
+    memcpy(pEntry->FileName, pSource->m_fileName.c_str(), pEntry->FileNameLength);
+
+    save(slot);
+}
+
+
+void CardCache::remove(CardSerialNumber *pSerial)
+{
+    int32_t slot = find(pSerial);
+
+    if (slot >= 0)
+    {
+        memset(&m_entries[slot], 0, sizeof(CacheEntry_s));
+        save(slot);
+    }
+}
+
+
+uint32_t CardCache::getHits( void )
+{
+    return m_hits;
+}
+
+
+uint32_t CardCache::getMisses( void )
+{
+    return m_misses;
+}
+
+
+void CardCache::resetStatistics( void )
+{
+    m_hits      = 0;
+    m_misses    = 0;
+}
+
+
+int32_t CardCache::find(CardSerialNumber *pSerial)
+{
+    if ((pSerial->SerialNumberLength == 0) || (pSerial->SerialNumberLength > sizeof(m_entries[0].Uid)))
+    {
+        return -1;
+    }
+
+    for (uint32_t slot = 0; slot < CACHE_ENTRIES; slot++)
+    {
+        if ((m_entries[slot].UidLength == pSerial->SerialNumberLength) &&
+            (memcmp(m_entries[slot].Uid, pSerial->SerialNumber, pSerial->SerialNumberLength) == 0))
+        {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+
+void CardCache::save(uint32_t slot)
+{
+    Preferences prefs;
+    char        key[4];
+
+    slotKey(slot, key);
+
+    prefs.begin(NVS_NAMESPACE, false);
+
+    if (m_entries[slot].UidLength == 0)
+    {
+        prefs.remove(key);
+    }
+    else if (prefs.putBytes(key, &m_entries[slot], offsetof(CacheEntry_s, FileName) + m_entries[slot].FileNameLength) == 0)
+    {
+        ESP_LOGW(TAG, "Could not save cache entry %u", slot);
+    }
+
+    prefs.end();
+}
+
+
+void CardCache::slotKey(uint32_t slot, char *pKey)
+{
+    pKey[0] = 'c';
+    pKey[1] = '0' + slot;
+    pKey[2] = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef _CARD_CACHE_H
+    #define _CARD_CACHE_H
+
+    #include "Arduino.h"
+
+    #include "cardHandler.h"
+
+
+    // Remembers the content of the last seen cards, keyed by their UID.
+    //
+    // Reading a card costs several authentications and one RF read per 16 (or 4) bytes of the
+    // file name. With a cache hit the playback could start right after the UID is known, the
+    // card itself is read afterwards and fixes the entry if it was rewritten in between.
+    //
+    // The entries live in RAM and in the NVS (one blob per slot), so they survive a restart.
+    // The NVS is only written when an entry changes, not on every hit.
+    class CardCache
+    {
+        public:
+            CardCache();
+            ~CardCache();
+
+            void        begin( void );                                          // load the entries from the NVS
+
+            bool        lookup(CardSerialNumber *pSerial, CardData *pTarget);   // true if the card is known
+            void        store(CardSerialNumber *pSerial, CardData *pSource);    // add or update (evicts the oldest)
+            void        remove(CardSerialNumber *pSerial);
+
+            uint32_t    getHits( void );
+            uint32_t    getMisses( void );
+            void        resetStatistics( void );
+
+        private:
+            static const uint32_t   CACHE_ENTRIES   = 8;
+            static const uint32_t   MAX_FILE_NAME   = 256;
+
+            typedef struct {
+                uint32_t    Stamp;                                  // higher is more recently used
+                uint8_t     UidLength;                              // 0 = slot is free
+                uint8_t     Uid[10];
+                uint8_t     Volume;
+                uint8_t     Resumeable;
+                uint8_t     Reserved;
+                uint32_t    StartOffset;
+                uint16_t    FileNameLength;
+                char        FileName[MAX_FILE_NAME + 1];            // only FileNameLength bytes are stored
+            } CacheEntry_s;
+
+            const char              *NVS_NAMESPACE  = "cards";
+
+            CacheEntry_s            m_entries[CACHE_ENTRIES];
+            uint32_t                m_stamp;                        // next value for CacheEntry_s.Stamp
+
+            uint32_t                m_hits;
+            uint32_t                m_misses;
+
+            int32_t     find(CardSerialNumber *pSerial);
+            void        save(uint32_t slot);
+            static void slotKey(uint32_t slot, char *pKey);
+    };
+
+#endif
@@ -1,5 +1,8 @@
 #include "cardHandler.h"
 #include "pinout.h"
+#include "spiBus.h"
+
+#include "rom/crc.h"
 
 CardHandler::CardHandler() 
 {    
@@ -8,11 +11,25 @@ CardHandler::CardHandler()
     #else
         m_pRfReader = NULL;
     #endif
+
+    m_rfTransactions        = 0;
+    m_authenticatedSector   = NO_SECTOR;
+    m_pageCacheCount        = 0;
+    m_fastRead              = true;
+    m_detectTask            = NULL;
+    m_probeAtqaValid        = false;
 }
 
 CardHandler::CardHandler(MFRC522 *pCardReader) 
 {        
     m_pRfReader = pCardReader;
+
+    m_rfTransactions        = 0;
+    m_authenticatedSector   = NO_SECTOR;
+    m_pageCacheCount        = 0;
+    m_fastRead              = true;
+    m_detectTask            = NULL;
+    m_probeAtqaValid        = false;
 }
 
 CardHandler::~CardHandler()
@@ -23,6 +40,7 @@ CardHandler::~CardHandler()
 void CardHandler::connectCardReader(void)
 {
     String myVersion;
+    SpiBusLock busLock(SpiBus::DEVICE_RFID);
 
     ESP_LOGD(TAG, "Connecting RFID reader...");
 
@@ -59,6 +77,7 @@ bool CardHandler::IsNewCardPresent( void )
     //make sure we are attached to a RFID reader
     if (m_pRfReader)
     {
+        SpiBusLock busLock(SpiBus::DEVICE_RFID);
 
         // Look for new card
         if ( m_pRfReader->PICC_IsNewCardPresent() == true) 
@@ -87,38 +106,22 @@ bool CardHandler::IsCardPresent( CardSerialNumber *pActualCardSerial )
         // Since wireless communication is voodoo we'll give it a few retrys before killing the music
         for (uint32_t counter = 0; counter < 3; counter++) 
         {
-            // Detect Tag without looking for collisions
-            byte bufferATQA[2];
-            byte bufferSize = sizeof(bufferATQA);
+            Probe_e probe = ProbeCard();
 
-            MFRC522::StatusCode status = m_pRfReader->PICC_WakeupA(bufferATQA, &bufferSize);
+            if (probe == PROBE_PRESENT)
+            {
+                result = true;
+                break;
+            }
 
-            if (status == MFRC522::STATUS_OK)
+            // something answered, but it might not be our card
+            if ((probe == PROBE_UNSURE) && SerialMatches(pActualCardSerial))
             {
-                if (m_pRfReader->PICC_ReadCardSerial()) 
-                {
-                    bool uidEqual = true;
-
-                    //compare if the Uids have the same size
-                    if (pActualCardSerial->SerialNumberLength == m_pRfReader->uid.size)
-                    {
-                        //check the diffferent bytes
-                        for (uint32_t counter=0; counter < pActualCardSerial->SerialNumberLength; counter++)
-                        {
-                            if (m_pRfReader->uid.uidByte[counter] != pActualCardSerial->SerialNumber[counter])
-                            {
-                                uidEqual = false;
-                                break;
-                            }
-                        }
-
-                        if (uidEqual == true) 
-                        {
-                            result = true;
-                            break;
-                        }
-                    }
-                }
+                m_probeAtqa         = m_lastAtqa;
+                m_probeAtqaValid    = true;
+
+                result = true;
+                break;
             }
         } // "magic loop"
     }
@@ -127,6 +130,171 @@ bool CardHandler::IsCardPresent( CardSerialNumber *pActualCardSerial )
 }
 
 
+CardHandler::Probe_e CardHandler::ProbeCard( void )
+{
+    MFRC522::StatusCode status;
+    byte                bufferATQA[2];
+    byte                bufferSize = sizeof(bufferATQA);
+
+    SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
+    // the ATQA comes within 100us, no need to wait the 25ms the reader is set up for
+    m_pRfReader->PCD_WriteRegister(MFRC522::TReloadRegH, PROBE_TIMEOUT >> 8);
+    m_pRfReader->PCD_WriteRegister(MFRC522::TReloadRegL, PROBE_TIMEOUT & 0xFF);
+
+    // Detect Tag without looking for collisions
+    status = m_pRfReader->PICC_WakeupA(bufferATQA, &bufferSize);
+
+    m_pRfReader->PCD_WriteRegister(MFRC522::TReloadRegH, DEFAULT_TIMEOUT >> 8);
+    m_pRfReader->PCD_WriteRegister(MFRC522::TReloadRegL, DEFAULT_TIMEOUT & 0xFF);
+
+    if (status == MFRC522::STATUS_TIMEOUT)
+    {
+        return PROBE_ABSENT;
+    }
+
+    if ((status != MFRC522::STATUS_OK) || (bufferSize != sizeof(bufferATQA)))
+    {
+        return PROBE_UNSURE;
+    }
+
+    m_lastAtqa = (bufferATQA[1] << 8) | bufferATQA[0];
+
+    // the same answer as the last time our card was checked completely
+    return (m_probeAtqaValid && (m_lastAtqa == m_probeAtqa)) ? PROBE_PRESENT : PROBE_UNSURE;
+}
+
+
+void CardHandler::HaltCard( void )
+{
+    // HLTA with its CRC, the card never answers it, so don't wait the timeout of PICC_HaltA()
+    byte command[] = { MFRC522::PICC_CMD_HLTA, 0x00, 0x57, 0xCD };
+
+    SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
+    m_pRfReader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    m_pRfReader->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+    m_pRfReader->PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);
+    m_pRfReader->PCD_WriteRegister(MFRC522::FIFODataReg, sizeof(command), command);
+    m_pRfReader->PCD_WriteRegister(MFRC522::BitFramingReg, 0x00);
+    m_pRfReader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transmit);
+
+    // the frame must be out before the crypto unit is switched off (~0.4ms)
+    for (uint32_t counter = 0; counter < 100; counter++)
+    {
+        if (m_pRfReader->PCD_ReadRegister(MFRC522::ComIrqReg) & 0x40)
+        {
+            break;
+        }
+    }
+
+    m_pRfReader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+}
+
+
+bool CardHandler::SerialMatches(CardSerialNumber *pActualCardSerial)
+{
+    SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
+    // select the card and compare its Uid with the given one
+    if ((!m_pRfReader->PICC_ReadCardSerial()) ||
+        (pActualCardSerial->SerialNumberLength != m_pRfReader->uid.size))
+    {
+        return false;
+    }
+
+    //check the diffferent bytes
+    for (uint32_t counter=0; counter < pActualCardSerial->SerialNumberLength; counter++)
+    {
+        if (m_pRfReader->uid.uidByte[counter] != pActualCardSerial->SerialNumber[counter])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool CardHandler::beginCardDetect(uint8_t irqPin, TaskHandle_t task)
+{
+    if (m_pRfReader == NULL)
+    {
+        return false;
+    }
+
+    m_detectTask = task;
+
+    SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
+    // IRQ pin active low (push pull), raised by a received answer or the timer (25ms after sending)
+    m_pRfReader->PCD_WriteRegister(MFRC522::ComIEnReg, 0xA1);
+    m_pRfReader->PCD_WriteRegister(MFRC522::DivIEnReg, 0x80);
+    m_pRfReader->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+
+    pinMode(irqPin, INPUT_PULLUP);
+    attachInterruptArg(irqPin, CardDetectIsr, this, FALLING);
+
+    ESP_LOGI(TAG, "Card detection by interrupt on pin %u", irqPin);
+
+    return true;
+}
+
+
+void CardHandler::armCardDetect(bool wakeup)
+{
+    SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
+    // a halted card only answers to WUPA
+    m_pRfReader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    m_pRfReader->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);                  // releases the IRQ line
+    m_pRfReader->PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);               // flush the FIFO
+    m_pRfReader->PCD_WriteRegister(MFRC522::FIFODataReg, wakeup ? MFRC522::PICC_CMD_WUPA : MFRC522::PICC_CMD_REQA);
+    m_pRfReader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+    m_pRfReader->PCD_WriteRegister(MFRC522::BitFramingReg, 0x87);              // start sending, 7 bit short frame
+}
+
+
+bool CardHandler::cardDetected(CardSerialNumber *pActualCardSerial)
+{
+    SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
+    uint8_t irqs = m_pRfReader->PCD_ReadRegister(MFRC522::ComIrqReg);
+    bool    result;
+
+    m_pRfReader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    m_pRfReader->PCD_WriteRegister(MFRC522::BitFramingReg, 0x00);
+    m_pRfReader->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+
+    // any answer (even a collision) means a card is there, the card is ready for the select now
+    result = (irqs & 0x20) ? true : false;
+
+    if (result && (pActualCardSerial != NULL))
+    {
+        result = SerialMatches(pActualCardSerial);
+    }
+
+    return result;
+}
+
+
+void IRAM_ATTR CardHandler::CardDetectIsr(void *pArg)
+{
+    CardHandler *pHandler = static_cast<CardHandler *>(pArg);
+    BaseType_t  higherPriorityTaskWoken = pdFALSE;
+
+    if (pHandler->m_detectTask != NULL)
+    {
+        vTaskNotifyGiveFromISR(pHandler->m_detectTask, &higherPriorityTaskWoken);
+    }
+
+    if (higherPriorityTaskWoken)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+
+
 bool CardHandler::GetCardSerial(CardSerialNumber *pActualCardSerial)
 {
     bool result = false;
@@ -134,9 +302,14 @@ bool CardHandler::GetCardSerial(CardSerialNumber *pActualCardSerial)
     //make sure we are attached to a RFID reader
     if (m_pRfReader)
     {
+        SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
         // Read the serial of one card
         if ( m_pRfReader->PICC_ReadCardSerial()) 
         {
+            //a new card, the presence probe doesn't know its answer yet
+            m_probeAtqaValid = false;
+
             memset(pActualCardSerial->SerialNumber, 0, sizeof(pActualCardSerial->SerialNumber));
 
             pActualCardSerial->SerialNumberLength = m_pRfReader->uid.size;
@@ -164,28 +337,30 @@ bool CardHandler::GetCardSerial(CardSerialNumber *pActualCardSerial)
 }
 
 
-bool CardHandler::ReadCardInformation(CardData *pTarget)
+bool CardHandler::ReadCardInformation(CardData *pTarget, bool *pForeign)
 {
     bool result = false;
 
-    //we start with am invalid result
-    pTarget->m_valid = false;
+    //an RF error is no proof of anything
+    if (pForeign != NULL)
+    {
+        *pForeign = false;
+    }
+
+    //we start with am invalid result, nothing of a previous card must be left (e.g. the v2 fields for a v1 card)
+    *pTarget = CardData();
 
     if (m_pRfReader != NULL)
     {
-        MFRC522::StatusCode     status;
+        MFRC522::StatusCode     status = MFRC522::STATUS_OK;
         MFRC522::PICC_Type      piccType;
 
         CardDataBlock_s         cardDataBlock;
 
         uint8_t                 startBlockNumber;
-        uint32_t                cardBlockSize;          //the number of bytes we could read from every block
-
-        uint32_t                pagesNeeded;
-        uint8_t                 *pDataTarget;
 
-        uint8_t                 buffer[18];
-        uint8_t                 bufferSize = sizeof(buffer);
+        uint32_t                startTime = millis();
+        uint32_t                startTransactions = m_rfTransactions;
 
         char                    *pFileName = NULL;
 
@@ -209,6 +384,11 @@ bool CardHandler::ReadCardInformation(CardData *pTarget)
             m_MFRC522Key.keyByte[counter] = 0xFF;
         }
 
+        //nothing is authenticated or buffered for this card yet
+        m_authenticatedSector   = NO_SECTOR;
+        m_pageCacheCount        = 0;
+        m_fastRead              = true;
+
         //get the type for the card
         piccType = m_pRfReader->PICC_GetType(m_pRfReader->uid.sak);
         ESP_LOGD(TAG, "PICC type: %s", m_pRfReader->PICC_GetTypeName(piccType));
@@ -222,57 +402,34 @@ bool CardHandler::ReadCardInformation(CardData *pTarget)
             goto FinishReadInformation;
         }
 
-        //authentificate with the card
-        if ((piccType == MFRC522::PICC_TYPE_MIFARE_MINI ) ||
-            (piccType == MFRC522::PICC_TYPE_MIFARE_1K ) ||
-            (piccType == MFRC522::PICC_TYPE_MIFARE_4K ) )
-        {
-            //initiate the variables for this card type
-            startBlockNumber = INFORMATION_BLOCK_MIFARE_1K;
-
-            cardBlockSize   = 16;
-
-            // Authenticate using key A
-            ESP_LOGV(TAG, "Authenticating MIFARE Mini/1k/4k using key A...");
-            status = m_pRfReader->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, startBlockNumber, &m_MFRC522Key, &(m_pRfReader->uid));
-        } 
-        else if (piccType == MFRC522::PICC_TYPE_MIFARE_UL ) 
+        //classic cards are authenticated sector by sector while reading
+        if (piccType == MFRC522::PICC_TYPE_MIFARE_UL ) 
         {
             byte pACK[] = {0, 0}; //16 bit PassWord ACK returned by the NFCtag
-
-            startBlockNumber = INFORMATION_BLOCK_MIFARE_ULTRA;
-            
-            cardBlockSize     = 4; 
+            SpiBusLock busLock(SpiBus::DEVICE_RFID);
 
             // Authenticate using key A
             ESP_LOGV(TAG, "Authenticating MIFARE UL using key A...");
             status = m_pRfReader->PCD_NTAG216_AUTH(m_MFRC522Key.keyByte, pACK);
-        }
+            m_rfTransactions++;
 
-        //check the authentification result
-        if (status != MFRC522::STATUS_OK) {
-            ESP_LOGW(TAG, "Card Authentification failed: %s", m_pRfReader->GetStatusCodeName(status));
-            goto FinishReadInformation;
+            //check the authentification result
+            if (status != MFRC522::STATUS_OK) {
+                ESP_LOGW(TAG, "Card Authentification failed: %s", m_pRfReader->GetStatusCodeName(status));
+                goto FinishReadInformation;
+            }
+
+            startBlockNumber = INFORMATION_BLOCK_MIFARE_ULTRA;
+        }
+        else
+        {
+            startBlockNumber = INFORMATION_BLOCK_MIFARE_1K;
         }
 
         // read information block(s)
-        pagesNeeded  = INFORMATION_BLOCK_SIZE / cardBlockSize;
-        pDataTarget  = &(cardDataBlock.Raw[0]);
-
-        ESP_LOGV(TAG, "Reading data from %u block(s) starting at block %u", pagesNeeded, startBlockNumber);
-
-        for (uint32_t block = startBlockNumber; block < (startBlockNumber + pagesNeeded); block++ )
+        if (!ReadCardBytes(piccType, startBlockNumber, cardDataBlock.Raw, INFORMATION_BLOCK_SIZE))
         {
-            status = m_pRfReader->MIFARE_Read(block, buffer, &bufferSize);
-            if (status != MFRC522::STATUS_OK) 
-            {
-                ESP_LOGW(TAG, "MIFARE_Read() failed: %s", m_pRfReader->GetStatusCodeName(status));
-                goto FinishReadInformation;
-            }
-
-            //reading was successfull, we could copy the data into our own structure
-            memcpy(pDataTarget, buffer, cardBlockSize);
-            pDataTarget += cardBlockSize;        
+            goto FinishReadInformation;
         }
 
         //DumpByteArray("Data from card: ", cardDataBlock.Raw, sizeof(cardDataBlock.Raw));
@@ -280,6 +437,10 @@ bool CardHandler::ReadCardInformation(CardData *pTarget)
         if (cardDataBlock.Entry.Header.Cookie != INFORMATION_BLOCK__MAGIC_KEY) 
         {
             ESP_LOGI(TAG, "Wrong Magic Key (%08x), card is not for this box", cardDataBlock.Entry.Header.Cookie);
+            if (pForeign != NULL)
+            {
+                *pForeign = true;
+            }
             goto FinishReadInformation;
         }
 
@@ -289,16 +450,17 @@ bool CardHandler::ReadCardInformation(CardData *pTarget)
 
         if (cardDataBlock.Entry.Header.Version == 1)
         {
-            uint8_t     activeKeyBlock = 0;
-            uint8_t     newKeyBlock = TARGET_BLOCK_MIFARE_1K;
-
-            uint16_t    position = 0;
-
-
             // handle configuration
             pTarget->m_Resumeable           = cardDataBlock.Entry.MetaData.Configuration.Resumeable?true:false;
             pTarget->m_Volume               = cardDataBlock.Entry.MetaData.Volume;
 
+            //check how many bytes we need
+            if (cardDataBlock.Entry.MetaData.FileNameLength == 0)
+            {
+                ESP_LOGE(TAG, "String length of ZERO given!");
+                goto FinishReadInformation;
+            }
+
             //get the file string
             //reserve some memory for the string and fill it with '0'
             pFileName = (char *) malloc((cardDataBlock.Entry.MetaData.FileNameLength + 1) * sizeof(char));
@@ -311,88 +473,56 @@ bool CardHandler::ReadCardInformation(CardData *pTarget)
 
             memset(pFileName, 0, (cardDataBlock.Entry.MetaData.FileNameLength + 1) * sizeof(char));
 
-            if ((piccType == MFRC522::PICC_TYPE_MIFARE_MINI ) ||
-                (piccType == MFRC522::PICC_TYPE_MIFARE_1K ) ||
-                (piccType == MFRC522::PICC_TYPE_MIFARE_4K ) )
-            {
-                startBlockNumber = TARGET_BLOCK_MIFARE_1K;
-            } 
-            else if (piccType == MFRC522::PICC_TYPE_MIFARE_UL ) 
+            if (piccType == MFRC522::PICC_TYPE_MIFARE_UL ) 
             {
                 startBlockNumber = TARGET_BLOCK_MIFARE_ULTRA;
             }
-            
-            //check how many bytes we need
-            if (cardDataBlock.Entry.MetaData.FileNameLength == 0)
+            else
             {
-                ESP_LOGE(TAG, "String length of ZERO given!");
-                goto FinishReadInformation;
+                startBlockNumber = TARGET_BLOCK_MIFARE_1K;
             }
-            else if (cardDataBlock.Entry.MetaData.FileNameLength < cardBlockSize) 
-            {
-                cardBlockSize = cardDataBlock.Entry.MetaData.FileNameLength;
-            } 
 
-            while (position < cardDataBlock.Entry.MetaData.FileNameLength)
+            if (!ReadCardBytes(piccType, startBlockNumber, (uint8_t *) pFileName, cardDataBlock.Entry.MetaData.FileNameLength))
             {
-                // additional authentification is only neccessary on "classic" cards
-                if ((piccType == MFRC522::PICC_TYPE_MIFARE_MINI ) ||
-                    (piccType == MFRC522::PICC_TYPE_MIFARE_1K ) ||
-                    (piccType == MFRC522::PICC_TYPE_MIFARE_4K ) )
-                {
-                 
-                    newKeyBlock = (startBlockNumber / 4) * 4 + 3;
-
-                    //authentificate the block
-                    if (newKeyBlock != activeKeyBlock) 
-                    {
-                        ESP_LOGV(TAG, "Authenticating using key A...");
-                        status = m_pRfReader->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, newKeyBlock, &m_MFRC522Key, &(m_pRfReader->uid));
-                        if (status != MFRC522::STATUS_OK) {
-                            ESP_LOGW(TAG, "Authentication failed for block %u: %s", newKeyBlock, m_pRfReader->GetStatusCodeName(status));
-                            goto FinishReadInformation;
-                        }
-
-                        activeKeyBlock = newKeyBlock;
-                    }
-                }
+                goto FinishReadInformation;
+            }
 
-                memset(buffer, 0, sizeof(buffer));
+            // coyp the string into the result structure
+            pTarget->m_fileName = String(pFileName);
 
-                // read block
-                status = m_pRfReader->MIFARE_Read(startBlockNumber, buffer, &bufferSize);
-                if (status != MFRC522::STATUS_OK) 
-                {
-                    ESP_LOGW(TAG, "MIFARE_Read() failed on block %u: %s", startBlockNumber, m_pRfReader->GetStatusCodeName(status));
-                    goto FinishReadInformation;
-                }
+            ESP_LOGV(TAG, "Read target String: \"%s\"", pTarget->m_fileName.c_str());
+
+            pTarget->m_valid = true;
+        }
+        else if (cardDataBlock.Entry.Header.Version == 2)
+        {
+            uint8_t payload[MAX_PAYLOAD_SIZE];
 
-                buffer[16] = 0;
-                ESP_LOGV(TAG, "Read block %u content \"%s\"", startBlockNumber, buffer);
+            if ((cardDataBlock.EntryV2.PayloadLength == 0) || (cardDataBlock.EntryV2.PayloadLength > sizeof(payload)))
+            {
+                ESP_LOGE(TAG, "Invalid record length %u", cardDataBlock.EntryV2.PayloadLength);
+                goto FinishReadInformation;
+            }
 
-                //reading was successfull, we could copy the data into our own structure
-                strncat(pFileName, (const char*)buffer, cardBlockSize);
+            // the record follows the information block directly (and was mostly read with it)
+            startBlockNumber += (piccType == MFRC522::PICC_TYPE_MIFARE_UL) ? (INFORMATION_BLOCK_SIZE / 4) : 1;
 
-                //remember the number of byte read
-                position += cardBlockSize;
+            if (!ReadCardBytes(piccType, startBlockNumber, payload, cardDataBlock.EntryV2.PayloadLength))
+            {
+                goto FinishReadInformation;
+            }
 
-                startBlockNumber++;
+            // a bad read must never start the wrong file
+            if (crc16_le(0, payload, cardDataBlock.EntryV2.PayloadLength) != cardDataBlock.EntryV2.PayloadCrc)
+            {
+                ESP_LOGW(TAG, "Record CRC mismatch");
+                goto FinishReadInformation;
+            }
 
-                // additional authentification is only neccessary on "classic" cards
-                if ((piccType == MFRC522::PICC_TYPE_MIFARE_MINI ) ||
-                    (piccType == MFRC522::PICC_TYPE_MIFARE_1K ) ||
-                    (piccType == MFRC522::PICC_TYPE_MIFARE_4K ) )
-                {
-                    // make sure the next block is not a key block
-                    if ((startBlockNumber > 2) && (((startBlockNumber - 3) % 4) == 0 ))
-                    {
-                        startBlockNumber++;
-                    }
-                }
-            } // read out loop
-            
-            // coyp the string into the result structure
-            pTarget->m_fileName = String(pFileName);
+            if (!ParseRecordV2(payload, cardDataBlock.EntryV2.PayloadLength, pTarget))
+            {
+                goto FinishReadInformation;
+            }
 
             ESP_LOGV(TAG, "Read target String: \"%s\"", pTarget->m_fileName.c_str());
 
@@ -401,6 +531,10 @@ bool CardHandler::ReadCardInformation(CardData *pTarget)
         else 
         {
             ESP_LOGW(TAG, "Unknown information version");
+            if (pForeign != NULL)
+            {
+                *pForeign = true;
+            }
             result = false;
             goto FinishReadInformation;
         }
@@ -410,6 +544,8 @@ bool CardHandler::ReadCardInformation(CardData *pTarget)
 
         FinishReadInformation:
 
+            ESP_LOGD(TAG, "Card read %s: %u RF transactions in %u ms", result ? "done" : "failed", m_rfTransactions - startTransactions, millis() - startTime);
+
             //make sure we clear the file name buffer
             if (pFileName != NULL)
             {
@@ -429,6 +565,189 @@ bool CardHandler::ReadCardInformation(CardData *pTarget)
     return result;
 }
 
+
+uint32_t CardHandler::getRfTransactions( void )
+{
+    return m_rfTransactions;
+}
+
+
+void CardHandler::resetStatistics( void )
+{
+    m_rfTransactions = 0;
+}
+
+
+bool CardHandler::ReadCardBytes(MFRC522::PICC_Type piccType, uint8_t block, uint8_t *pTarget, uint32_t length)
+{
+    MFRC522::StatusCode     status;
+    uint8_t                 buffer[18];
+    uint8_t                 bufferSize;
+    uint32_t                chunk;
+
+    // classic cards: 16 byte blocks, one authentication per sector
+    if (piccType != MFRC522::PICC_TYPE_MIFARE_UL)
+    {
+        while (length)
+        {
+            uint8_t sector = block / 4;
+
+            // the last block of every sector holds the keys
+            if ((block % 4) == 3)
+            {
+                block++;
+                continue;
+            }
+
+            // one block per step, the audio could take the bus in between
+            SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
+            if (sector != m_authenticatedSector)
+            {
+                ESP_LOGV(TAG, "Authenticating sector %u using key A...", sector);
+                status = m_pRfReader->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, (sector * 4) + 3, &m_MFRC522Key, &(m_pRfReader->uid));
+                m_rfTransactions++;
+
+                if (status != MFRC522::STATUS_OK) {
+                    ESP_LOGW(TAG, "Authentication failed for sector %u: %s", sector, m_pRfReader->GetStatusCodeName(status));
+                    m_authenticatedSector = NO_SECTOR;
+                    return false;
+                }
+
+                m_authenticatedSector = sector;
+            }
+
+            bufferSize = sizeof(buffer);
+            status = m_pRfReader->MIFARE_Read(block, buffer, &bufferSize);
+            m_rfTransactions++;
+
+            if (status != MFRC522::STATUS_OK) 
+            {
+                ESP_LOGW(TAG, "MIFARE_Read() failed on block %u: %s", block, m_pRfReader->GetStatusCodeName(status));
+                return false;
+            }
+
+            chunk = (length < 16) ? length : 16;
+            memcpy(pTarget, buffer, chunk);
+
+            pTarget += chunk;
+            length  -= chunk;
+            block++;
+        }
+
+        return true;
+    }
+
+    // ultralight / NTAG: 4 byte pages, read in bursts through the page cache
+    while (length)
+    {
+        uint32_t offset;
+
+        if ((m_pageCacheCount == 0) || (block < m_pageCacheStart) || (block >= (m_pageCacheStart + m_pageCacheCount)))
+        {
+            uint32_t pages = (length + 3) / 4;
+
+            // the header read takes the start of the file name with it
+            if (block == INFORMATION_BLOCK_MIFARE_ULTRA)
+            {
+                pages = FAST_READ_PAGES;
+            }
+
+            if (!ReadPages(block, pages))
+            {
+                return false;
+            }
+        }
+
+        offset  = (block - m_pageCacheStart) * 4;
+        chunk   = (m_pageCacheCount * 4) - offset;
+
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+
+        memcpy(pTarget, &m_pageCache[offset], chunk);
+
+        pTarget += chunk;
+        length  -= chunk;
+        block   += chunk / 4;
+    }
+
+    return true;
+}
+
+
+bool CardHandler::ReadPages(uint8_t page, uint32_t pages)
+{
+    MFRC522::StatusCode     status;
+    uint8_t                 buffer[(FAST_READ_PAGES * 4) + 2];
+    uint8_t                 bufferSize;
+
+    SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
+    if (pages > FAST_READ_PAGES)
+    {
+        pages = FAST_READ_PAGES;
+    }
+
+    m_pageCacheCount = 0;
+
+    if (m_fastRead)
+    {
+        uint8_t command[5];
+
+        // FAST_READ start page, end page (NTAG21x), the answer must fit into the FIFO of the reader
+        command[0] = NTAG_FAST_READ;
+        command[1] = page;
+        command[2] = page + pages - 1;
+
+        status = m_pRfReader->PCD_CalculateCRC(command, 3, &command[3]);
+
+        if (status == MFRC522::STATUS_OK)
+        {
+            bufferSize = (pages * 4) + 2;
+            status = m_pRfReader->PCD_TransceiveData(command, sizeof(command), buffer, &bufferSize, NULL, 0, true);
+            m_rfTransactions++;
+        }
+
+        if ((status == MFRC522::STATUS_OK) && (bufferSize == ((pages * 4) + 2)))
+        {
+            memcpy(m_pageCache, buffer, pages * 4);
+            m_pageCacheStart = page;
+            m_pageCacheCount = pages;
+
+            return true;
+        }
+
+        ESP_LOGD(TAG, "FAST_READ of %u pages failed (%s), reading 4 pages at once", pages, m_pRfReader->GetStatusCodeName(status));
+        m_fastRead = false;
+
+        // the NAK sent the card back to idle, select it again
+        bufferSize = 2;
+        m_pRfReader->PICC_WakeupA(buffer, &bufferSize);
+        m_pRfReader->PICC_Select(&(m_pRfReader->uid));
+        m_rfTransactions += 2;
+    }
+
+    // READ always returns 4 pages
+    bufferSize = sizeof(buffer);
+    status = m_pRfReader->MIFARE_Read(page, buffer, &bufferSize);
+    m_rfTransactions++;
+
+    if (status != MFRC522::STATUS_OK) 
+    {
+        ESP_LOGW(TAG, "MIFARE_Read() failed on page %u: %s", page, m_pRfReader->GetStatusCodeName(status));
+        return false;
+    }
+
+    memcpy(m_pageCache, buffer, 16);
+    m_pageCacheStart = page;
+    m_pageCacheCount = 4;
+
+    return true;
+}
+
 bool CardHandler::WriteCardInformation(CardData *pSource, CardSerialNumber *pActualCardSerial) 
 {
     bool result = false;
@@ -440,25 +759,16 @@ bool CardHandler::WriteCardInformation(CardData *pSource, CardSerialNumber *pAct
         MFRC522::StatusCode     status;
         MFRC522::PICC_Type      piccType;
 
-        uint32_t                actualAuthentificatedSector;
-
-        uint8_t                 operatingBlock;     //the block we are actual working with
-        uint8_t                 operatingSector;    //the sector we are actual working with
-
-        uint32_t                blockSize;          //the number of bytes we could read from every block
-        uint32_t                sectorSize;         //
-
-        uint32_t                neededBlocks;        // the number of blocks we must write before all data is stored
-        uint8_t                 *pDataSource;
-        uint8_t                 *pBuffer;
+        uint8_t                 record[sizeof(cardDataBlock.Raw) + MAX_PAYLOAD_SIZE];
+        uint32_t                payloadLength;
+        uint32_t                recordLength;
 
-        uint32_t                position = 0;
-
-        uint8_t                 buffer[18];
-        uint32_t                useableBufferSize = 16;
+        uint32_t                startTime = millis();
+        uint32_t                startTransactions = m_rfTransactions;
 
         //check if the union has the correct size (compare uint8_t array and structure)
-        if (sizeof(cardDataBlock.Entry) != sizeof(cardDataBlock.Raw))
+        if ((sizeof(cardDataBlock.Entry) != sizeof(cardDataBlock.Raw)) ||
+            (sizeof(cardDataBlock.EntryV2) != sizeof(cardDataBlock.Raw)))
         {
             ESP_LOGE(TAG, "Information structure size is not equal to the readout array! (%u instead of %u)", sizeof(cardDataBlock.Entry), sizeof(cardDataBlock.Raw));
             goto FinishWriteInformation;
@@ -477,31 +787,33 @@ bool CardHandler::WriteCardInformation(CardData *pSource, CardSerialNumber *pAct
             m_MFRC522Key.keyByte[counter] = 0xFF;
         }
 
+        //limit file name length to 255 characters
+        if (pSource->m_fileName.length() > 255)
+        {
+            ESP_LOGE(TAG, "Maximum supported File Name legth is 255 (%u)", pSource->m_fileName.length());
+            goto FinishWriteInformation;
+        }
+
         //check if the "known" card is still there (this will also wake up the card)
-        if (!IsCardPresent(pActualCardSerial)) 
+        if (!SelectCard(pActualCardSerial)) 
         {
             goto FinishWriteInformation;
         }
 
-        //prepare the internal strucure
-        cardDataBlock.Entry.Header.Cookie                       = INFORMATION_BLOCK__MAGIC_KEY;
-        cardDataBlock.Entry.Header.Version                      = 1;
+        m_authenticatedSector = NO_SECTOR;
 
-        cardDataBlock.Entry.MetaData.Volume                     = pSource->m_Volume;
-        cardDataBlock.Entry.MetaData.Configuration.Full         = 0;
-        cardDataBlock.Entry.MetaData.Configuration.Resumeable   = pSource->m_Resumeable?1:0;        
+        //the TLV record follows the information block directly, both are written in one go
+        payloadLength = BuildRecordV2(pSource, &record[sizeof(cardDataBlock.Raw)]);
 
-        cardDataBlock.Entry.MetaData.FileNameLength             = pSource->m_fileName.length();
+        memset(&cardDataBlock, 0, sizeof(cardDataBlock));
 
-        //limit file name length to 255 characters
-        if (cardDataBlock.Entry.MetaData.FileNameLength > 256)
-        {
-            ESP_LOGE(TAG, "Maximum supported File Name legth is 256 (%u)", cardDataBlock.Entry.MetaData.FileNameLength);
-            goto FinishWriteInformation;
-        }
+        cardDataBlock.EntryV2.Cookie            = INFORMATION_BLOCK__MAGIC_KEY;
+        cardDataBlock.EntryV2.Version           = 2;
+        cardDataBlock.EntryV2.PayloadLength     = payloadLength;
+        cardDataBlock.EntryV2.PayloadCrc        = crc16_le(0, &record[sizeof(cardDataBlock.Raw)], payloadLength);
 
-        //clear the data buffer
-        memset(buffer, 0, sizeof(buffer));
+        memcpy(record, cardDataBlock.Raw, sizeof(cardDataBlock.Raw));
+        recordLength = sizeof(cardDataBlock.Raw) + payloadLength;
 
         //get the type for the card
         piccType = m_pRfReader->PICC_GetType(m_pRfReader->uid.sak);
@@ -516,199 +828,324 @@ bool CardHandler::WriteCardInformation(CardData *pSource, CardSerialNumber *pAct
             goto FinishWriteInformation;
         }
 
-        //authentificate with the card and set card specific parameters
-        if ((piccType == MFRC522::PICC_TYPE_MIFARE_MINI ) ||
-            (piccType == MFRC522::PICC_TYPE_MIFARE_1K ) ||
-            (piccType == MFRC522::PICC_TYPE_MIFARE_4K ) )
-        {
-            //initiate the variables for this card type
-            blockSize           = 16;
-            sectorSize          = 4;
-
-            operatingBlock      = INFORMATION_BLOCK_MIFARE_1K % sectorSize;
-            operatingSector     = INFORMATION_BLOCK_MIFARE_1K / sectorSize;            
-
-            pBuffer = &(buffer[0]);
-
-            // Authenticate using key A
-            ESP_LOGV(TAG, "Authenticating MIFARE Mini/1k/4k using key A...");
-            status = m_pRfReader->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, (operatingSector * sectorSize) + 3, &m_MFRC522Key, &(m_pRfReader->uid));
-        } 
-        else if (piccType == MFRC522::PICC_TYPE_MIFARE_UL ) 
+        //classic cards are authenticated sector by sector while writing
+        if (piccType == MFRC522::PICC_TYPE_MIFARE_UL ) 
         {
             byte pACK[] = {0, 0}; //16 bit PassWord ACK returned by the NFCtag
-
-            blockSize           = 4;
-            sectorSize          = 0x86;
-
-            operatingBlock      = INFORMATION_BLOCK_MIFARE_ULTRA;
-            operatingSector     = 0;
-            
-            pBuffer = &(buffer[0]);
+            SpiBusLock busLock(SpiBus::DEVICE_RFID);
 
             // Authenticate using key A
             ESP_LOGV(TAG, "Authenticating MIFARE UL using key A...");
             status = m_pRfReader->PCD_NTAG216_AUTH(m_MFRC522Key.keyByte, pACK);
+            m_rfTransactions++;
+
+            if (status != MFRC522::STATUS_OK) 
+            {
+                ESP_LOGW(TAG, "Authenticating failed: %s", m_pRfReader->GetStatusCodeName(status));
+                goto FinishWriteInformation;
+            }
         }
 
-        if (status != MFRC522::STATUS_OK) 
+        if (!WriteCardBytes(piccType, (piccType == MFRC522::PICC_TYPE_MIFARE_UL) ? INFORMATION_BLOCK_MIFARE_ULTRA : INFORMATION_BLOCK_MIFARE_1K,
+                            record, recordLength))
         {
-            ESP_LOGW(TAG, "Authenticating failed: %s", m_pRfReader->GetStatusCodeName(status));
             goto FinishWriteInformation;
         }
 
-        
-        neededBlocks  = INFORMATION_BLOCK_SIZE / blockSize;
-        if (INFORMATION_BLOCK_SIZE % blockSize)
-        {
-            neededBlocks++;
-        }
+        ESP_LOGI(TAG, "writing information ok (%u byte record, %u RF transactions in %u ms)", recordLength, m_rfTransactions - startTransactions, millis() - startTime);
 
-        pDataSource  = &(cardDataBlock.Raw[0]);
+        result = true;
+    }
 
-        ESP_LOGV(TAG, "Writing information to %u blocks starting at block %u", neededBlocks, operatingSector * operatingBlock);
+    FinishWriteInformation:
 
-        do 
-        {            
-            //copy the next data portion into the output buffer
-            memcpy(pBuffer, pDataSource, blockSize);
+    StopCommunication();
 
-            status = m_pRfReader->MIFARE_Write((operatingSector * sectorSize) + operatingBlock, buffer, useableBufferSize);
-            if (status != MFRC522::STATUS_OK) 
-            {
-                ESP_LOGW(TAG, "MIFARE_Write() failed: %s", m_pRfReader->GetStatusCodeName(status));
-                goto FinishWriteInformation;
-            }
+    return result;
+}
 
-            //writing was successfull, advance the source pointer 
-            pDataSource += blockSize;
 
-            //look for the next block were we could store our data
-            operatingBlock++;
-            if (operatingBlock > (sectorSize-1))
-            {
-                operatingBlock = 0;
-                operatingSector++;
-            }
+uint32_t CardHandler::BuildRecordV2(CardData *pSource, uint8_t *pPayload)
+{
+    uint32_t length     = 0;
+    uint32_t contentId  = ContentIdOf(pSource);
+    uint32_t value;
 
-            neededBlocks--;
+    // a media library id is much shorter than its path
+    if (contentId != 0)
+    {
+        value = contentId;
 
-        } while ( neededBlocks > 0);
-        
-        ESP_LOGD(TAG, "Wrote information block to card");
+        pPayload[length++] = TLV_CONTENT_ID;
+        pPayload[length++] = sizeof(value);
+        memcpy(&pPayload[length], &value, sizeof(value));
+        length += sizeof(value);
+    }
+    else
+    {
+        pPayload[length++] = TLV_PATH;
+        pPayload[length++] = pSource->m_fileName.length();
+        memcpy(&pPayload[length], pSource->m_fileName.c_str(), pSource->m_fileName.length());
+        length += pSource->m_fileName.length();
+    }
 
+    if (pSource->m_Resumeable)
+    {
+        pPayload[length++] = TLV_FLAGS;
+        pPayload[length++] = 1;
+        pPayload[length++] = 0x01;
+    }
 
-        //write the file name
-        //----------------------------------------------------
-        if ((piccType == MFRC522::PICC_TYPE_MIFARE_MINI ) ||
-            (piccType == MFRC522::PICC_TYPE_MIFARE_1K ) ||
-            (piccType == MFRC522::PICC_TYPE_MIFARE_4K ) )
-        {
-            //initiate the variables for this card type
-            blockSize           = 16;
-            sectorSize          =  4;
+    if (pSource->m_Volume != 0)
+    {
+        pPayload[length++] = TLV_VOLUME;
+        pPayload[length++] = 1;
+        pPayload[length++] = pSource->m_Volume;
+    }
 
-            operatingBlock      = TARGET_BLOCK_MIFARE_1K % sectorSize;
-            operatingSector     = TARGET_BLOCK_MIFARE_1K / sectorSize;  
+    if (pSource->m_StartOffset != 0)
+    {
+        value = pSource->m_StartOffset;
+
+        pPayload[length++] = TLV_START_OFFSET;
+        pPayload[length++] = sizeof(value);
+        memcpy(&pPayload[length], &value, sizeof(value));
+        length += sizeof(value);
+    }
+
+    return length;
+}
 
-            pBuffer = &(buffer[0]);
 
-        } 
-        else if (piccType == MFRC522::PICC_TYPE_MIFARE_UL ) 
+bool CardHandler::ParseRecordV2(const uint8_t *pPayload, uint32_t length, CardData *pTarget)
+{
+    uint32_t position = 0;
+
+    pTarget->m_fileName     = String();
+    pTarget->m_Resumeable   = false;
+    pTarget->m_Volume       = 0;
+    pTarget->m_ContentId    = 0;
+    pTarget->m_StartOffset  = 0;
+
+    while ((position + 2) <= length)
+    {
+        uint8_t         tag         = pPayload[position];
+        uint8_t         tagLength   = pPayload[position + 1];
+        const uint8_t   *pValue     = &pPayload[position + 2];
+
+        if ((position + 2 + tagLength) > length)
+        {
+            ESP_LOGW(TAG, "Truncated record");
+            return false;
+        }
+
+        // unknown tags are skipped, so newer cards still play
+        if ((tag == TLV_PATH) && (tagLength > 0))
         {
-            blockSize           =  4;
-            sectorSize          =  0x86;
+            char path[256];
 
-            operatingBlock      = TARGET_BLOCK_MIFARE_ULTRA;
-            operatingSector     = 0;
-            
-            
+            memcpy(path, pValue, tagLength);
+            path[tagLength] = 0;
 
-            pBuffer = &(buffer[0]);
+            pTarget->m_fileName = String(path);
+        }
+        else if ((tag == TLV_CONTENT_ID) && (tagLength == sizeof(uint32_t)))
+        {
+            memcpy(&(pTarget->m_ContentId), pValue, sizeof(uint32_t));
         }
+        else if ((tag == TLV_VOLUME) && (tagLength == 1))
+        {
+            pTarget->m_Volume = pValue[0];
+        }
+        else if ((tag == TLV_START_OFFSET) && (tagLength == sizeof(uint32_t)))
+        {
+            memcpy(&(pTarget->m_StartOffset), pValue, sizeof(uint32_t));
+        }
+        else if ((tag == TLV_FLAGS) && (tagLength >= 1))
+        {
+            pTarget->m_Resumeable = (pValue[0] & 0x01) ? true : false;
+        }
+
+        position += 2 + tagLength;
+    }
+
+    // the player resolves the id with the media library
+    if ((pTarget->m_fileName.length() == 0) && (pTarget->m_ContentId != 0))
+    {
+        char id[10];
+
+        snprintf(id, sizeof(id), "#%08X", pTarget->m_ContentId);
+        pTarget->m_fileName = String(id);
+    }
+
+    if (pTarget->m_fileName.length() == 0)
+    {
+        ESP_LOGE(TAG, "Record without media");
+        return false;
+    }
+
+    return true;
+}
+
+
+uint32_t CardHandler::ContentIdOf(CardData *pData)
+{
+    if ((pData->m_ContentId == 0) && pData->m_fileName.startsWith("#"))
+    {
+        return strtoul(pData->m_fileName.c_str() + 1, NULL, 16);
+    }
+
+    return pData->m_ContentId;
+}
+
+
+bool CardHandler::VerifyCardInformation(CardData *pExpected, CardSerialNumber *pActualCardSerial)
+{
+    CardData    readBack;
+    uint32_t    contentId = ContentIdOf(pExpected);
+    bool        result;
+
+    // one burst read of everything that was written, a library id comes back as "#%08X" whatever was given
+    result = SelectCard(pActualCardSerial) &&
+             ReadCardInformation(&readBack) &&
+             readBack.GetValid() &&
+             ((contentId != 0) ? (readBack.m_ContentId == contentId) : (readBack.m_fileName == pExpected->m_fileName)) &&
+             (readBack.m_Resumeable == pExpected->m_Resumeable) &&
+             (readBack.m_Volume == pExpected->m_Volume) &&
+             (readBack.m_StartOffset == pExpected->m_StartOffset);
 
-        actualAuthentificatedSector  = 0;
+    StopCommunication();
+
+    return result;
+}
 
-        neededBlocks  = (pSource->m_fileName.length()+1) / blockSize;
 
-        if ((pSource->m_fileName.length()+1) % blockSize)
+bool CardHandler::SelectCard(CardSerialNumber *pActualCardSerial)
+{
+    byte bufferATQA[2];
+    byte bufferSize;
+
+    if (m_pRfReader == NULL)
+    {
+        return false;
+    }
+
+    SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
+    m_pRfReader->PCD_StopCrypto1();
+
+    // Since wireless communication is voodoo we'll give it a few retrys
+    for (uint32_t counter = 0; counter < 3; counter++)
+    {
+        bufferSize = sizeof(bufferATQA);
+
+        if ((m_pRfReader->PICC_WakeupA(bufferATQA, &bufferSize) == MFRC522::STATUS_OK) &&
+            SerialMatches(pActualCardSerial))
         {
-            neededBlocks++;
+            return true;
         }
+    }
 
-        ESP_LOGV(TAG, "Writing information to %u blocks(s) starting at block %u", neededBlocks, operatingSector * sectorSize + operatingBlock);
+    return false;
+}
 
-        //repeat until all block are written
-        do 
-        {   
-            // check if we need to authentificate the sector
-            if ((piccType == MFRC522::PICC_TYPE_MIFARE_MINI ) ||
-                (piccType == MFRC522::PICC_TYPE_MIFARE_1K ) ||
-                (piccType == MFRC522::PICC_TYPE_MIFARE_4K ) )
-            {
 
-                //authentificate the sector
-                if (actualAuthentificatedSector != operatingSector) 
-                {
-                    ESP_LOGV(TAG, "Authenticating sector %u using key A...", operatingSector);
-                    status = m_pRfReader->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, (operatingSector * sectorSize + (sectorSize-1)), &m_MFRC522Key, &(m_pRfReader->uid));
-                    if (status != MFRC522::STATUS_OK) {
-                        ESP_LOGW(TAG, "Authentication failed for sector %u: %s", operatingSector, m_pRfReader->GetStatusCodeName(status));
-                        goto FinishWriteInformation;
-                    }
-
-                    actualAuthentificatedSector = operatingSector;
-                }
-            }
+bool CardHandler::WriteCardBytes(MFRC522::PICC_Type piccType, uint8_t block, const uint8_t *pSource, uint32_t length)
+{
+    MFRC522::StatusCode     status;
+    uint8_t                 buffer[16];
+    uint32_t                chunk;
+
+    // ultralight / NTAG: one single frame WRITE per 4 byte page
+    if (piccType == MFRC522::PICC_TYPE_MIFARE_UL)
+    {
+        while (length)
+        {
+            // one page per step, the audio could take the bus in between
+            SpiBusLock busLock(SpiBus::DEVICE_RFID);
 
-            memset(buffer, 0, sizeof(buffer));
+            chunk = (length < 4) ? length : 4;
 
-            // get always one byte more since the result is '\0' terminated
-            pSource->m_fileName.getBytes(pBuffer, (blockSize + 1), position);
+            memset(buffer, 0, 4);
+            memcpy(buffer, pSource, chunk);
 
-            ESP_LOGV(TAG, "writing information to sector %u block %u -> \"%s\"", operatingSector, operatingBlock, pBuffer);
+            status = m_pRfReader->MIFARE_Ultralight_Write(block, buffer, 4);
+            m_rfTransactions++;
 
-            status = m_pRfReader->MIFARE_Write(operatingSector * sectorSize + operatingBlock, buffer, useableBufferSize);
             if (status != MFRC522::STATUS_OK) 
             {
-                ESP_LOGW(TAG, "MIFARE_Write(%u,%u) failed: %s", operatingSector, operatingBlock, m_pRfReader->GetStatusCodeName(status));
-                goto FinishWriteInformation;
+                ESP_LOGW(TAG, "MIFARE_Ultralight_Write() failed on page %u: %s", block, m_pRfReader->GetStatusCodeName(status));
+                return false;
             }
 
+            pSource += chunk;
+            length  -= chunk;
+            block++;
+        }
 
-            //look for the next block were we could store our data
-            position += blockSize;
+        return true;
+    }
 
-            operatingBlock++;
-            if (operatingBlock > (sectorSize-1))
-            {
-                operatingBlock = 0;
-                operatingSector++;
+    // classic cards: 16 byte blocks, one authentication per sector
+    while (length)
+    {
+        uint8_t sector = block / 4;
+
+        // never touch the keys in the last block of every sector
+        if ((block % 4) == 3)
+        {
+            block++;
+            continue;
+        }
+
+        // one block per step, the audio could take the bus in between
+        SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
+        if (sector != m_authenticatedSector)
+        {
+            ESP_LOGV(TAG, "Authenticating sector %u using key A...", sector);
+            status = m_pRfReader->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, (sector * 4) + 3, &m_MFRC522Key, &(m_pRfReader->uid));
+            m_rfTransactions++;
+
+            if (status != MFRC522::STATUS_OK) {
+                ESP_LOGW(TAG, "Authentication failed for sector %u: %s", sector, m_pRfReader->GetStatusCodeName(status));
+                m_authenticatedSector = NO_SECTOR;
+                return false;
             }
 
-            neededBlocks--;
+            m_authenticatedSector = sector;
+        }
 
-        } while (neededBlocks > 0);
+        chunk = (length < 16) ? length : 16;
 
-        ESP_LOGI(TAG, "writing information ok");
+        memset(buffer, 0, sizeof(buffer));
+        memcpy(buffer, pSource, chunk);
 
-        result = true;
-        
-    }
+        status = m_pRfReader->MIFARE_Write(block, buffer, sizeof(buffer));
+        m_rfTransactions++;
 
-    FinishWriteInformation:
-    
-    StopCommunication();
+        if (status != MFRC522::STATUS_OK) 
+        {
+            ESP_LOGW(TAG, "MIFARE_Write() failed on block %u: %s", block, m_pRfReader->GetStatusCodeName(status));
+            return false;
+        }
 
-    return result;
- }
+        pSource += chunk;
+        length  -= chunk;
+        block++;
+    }
+
+    return true;
+}
 
 
 
 void CardHandler::StopCommunication(void)
 {
+    SpiBusLock busLock(SpiBus::DEVICE_RFID);
+
     //end communication with the card
-    m_pRfReader->PICC_HaltA();
+    HaltCard();
     m_pRfReader->PCD_StopCrypto1();
 }
 
@@ -9,9 +9,13 @@
     class CardData 
     {
         public:
-            String      m_fileName;
+            CardData() : m_Resumeable(false), m_Volume(0), m_ContentId(0), m_StartOffset(0), m_valid(false) {}
+
+            String      m_fileName;                 // path or "#<content id>" of the media library
             bool        m_Resumeable;
-            uint8_t     m_Volume;
+            uint8_t     m_Volume;                   // 1..100, 0 keeps the actual volume
+            uint32_t    m_ContentId;                // media library id (v2 cards only, 0 = none)
+            uint32_t    m_StartOffset;              // seconds to skip at the start (v2 cards only)
 
             bool        m_valid;
 
@@ -52,11 +56,21 @@
 
             bool        GetCardSerial(CardSerialNumber *pActualCardSerial);
             
-            bool        ReadCardInformation(CardData *pTarget);
+            bool        ReadCardInformation(CardData *pTarget, bool *pForeign = NULL);     // foreign: readable, but no EnRav card
             bool        WriteCardInformation(CardData *pSource, CardSerialNumber *pActualCardSerial);
+            bool        VerifyCardInformation(CardData *pExpected, CardSerialNumber *pActualCardSerial);     // read back after a write
             
             void        StopCommunication(void);
 
+            // card detection by interrupt: arm sends a REQA (WUPA), the reader raises its IRQ on
+            // the answer or on its timeout and the given task gets a notification
+            bool        beginCardDetect(uint8_t irqPin, TaskHandle_t task);
+            void        armCardDetect(bool wakeup);
+            bool        cardDetected(CardSerialNumber *pActualCardSerial);   // after the notification, checks the UID if given
+
+            uint32_t    getRfTransactions( void );                  // RF commands sent while reading cards
+            void        resetStatistics( void );
+
 
         private:
 
@@ -81,9 +95,28 @@
                     } MetaData;
                 }Entry;                                 // complete 16 byte
 
+                struct {
+                    uint32_t        Cookie;             // 4 byte
+                    uint32_t        Version;            // 4 byte, 2
+                    uint16_t        PayloadLength;      // 2 byte, TLV record right behind this block
+                    uint16_t        PayloadCrc;         // 2 byte, CRC16 over the TLV record
+                    uint32_t        Reserved;           // 4 byte
+                } EntryV2;                              // complete 16 byte
+
                 uint8_t             Raw[16];
             } CardDataBlock_s;
 
+            // v2 record: tag, length, value
+            typedef enum {
+                TLV_PATH            = 0x01,             // file name on the SD card
+                TLV_CONTENT_ID      = 0x02,             // uint32_t id of the media library (instead of the path)
+                TLV_VOLUME          = 0x03,             // uint8_t 1..100
+                TLV_START_OFFSET    = 0x04,             // uint32_t seconds
+                TLV_FLAGS           = 0x05,             // uint8_t, bit 0: resumeable
+            } CardTlvTag_e;
+
+            const uint32_t          MAX_PAYLOAD_SIZE                = 2 + 255 + 6 + 3 + 6 + 3;
+
             //some internal configuration
             const uint32_t          INFORMATION_BLOCK_MIFARE_1K     =  4;
             const uint32_t          INFORMATION_BLOCK_MIFARE_ULTRA  =  8;
@@ -94,9 +127,51 @@
 
             const uint32_t          INFORMATION_BLOCK__MAGIC_KEY    = 0x13374258;
 
+            static const uint8_t    NTAG_FAST_READ                  = 0x3A;
+            static const uint32_t   FAST_READ_PAGES                 = 15;       // 60 bytes + CRC still fit into the 64 byte FIFO
+            static const uint8_t    NO_SECTOR                       = 0xFF;
+
+            static const uint16_t   DEFAULT_TIMEOUT                 = 1000;     // reader timer in 25us steps, as set by PCD_Init()
+            static const uint16_t   PROBE_TIMEOUT                   = 80;       // 2ms for the presence probe
+
+            typedef enum {
+                PROBE_ABSENT,                                       // no answer at all
+                PROBE_PRESENT,                                      // the ATQA of our card
+                PROBE_UNSURE,                                       // some answer, the Uid must be checked
+            } Probe_e;
+
             MFRC522                 *m_pRfReader;
             MFRC522::MIFARE_Key     m_MFRC522Key;
 
+            uint32_t                m_rfTransactions;
+            uint8_t                 m_authenticatedSector;      // classic cards: sector the reader is authenticated for
+            bool                    m_fastRead;                 // ultralight: card understands FAST_READ
+
+            uint8_t                 m_pageCache[FAST_READ_PAGES * 4];   // ultralight: last burst read from the card
+            uint8_t                 m_pageCacheStart;
+            uint8_t                 m_pageCacheCount;
+
+            TaskHandle_t            m_detectTask;               // notified by the IRQ of the reader
+
+            uint16_t                m_probeAtqa;                // ATQA of the present card, verified by its Uid
+            bool                    m_probeAtqaValid;
+            uint16_t                m_lastAtqa;
+
+            Probe_e     ProbeCard( void );
+            void        HaltCard( void );
+
+            bool        SerialMatches(CardSerialNumber *pActualCardSerial);
+            bool        ReadCardBytes(MFRC522::PICC_Type piccType, uint8_t block, uint8_t *pTarget, uint32_t length);
+            bool        ReadPages(uint8_t page, uint32_t pages);
+            bool        WriteCardBytes(MFRC522::PICC_Type piccType, uint8_t block, const uint8_t *pSource, uint32_t length);
+            bool        SelectCard(CardSerialNumber *pActualCardSerial);
+
+            uint32_t    BuildRecordV2(CardData *pSource, uint8_t *pPayload);
+            uint32_t    ContentIdOf(CardData *pData);                  // set or given as "#<id>", 0 for a path
+            bool        ParseRecordV2(const uint8_t *pPayload, uint32_t length, CardData *pTarget);
+
+            static void IRAM_ATTR CardDetectIsr(void *pArg);
+
     };
 
 #endif
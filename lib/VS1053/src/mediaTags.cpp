@@ -0,0 +1,352 @@
+#include "mediaTags.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+    #include "esp32-hal-log.h"
+#else
+    static const char *TAG = "MediaTags";
+#endif
+
+MediaTags::MediaTags()
+{
+    clear();
+}
+
+MediaTags::~MediaTags()
+{
+
+}
+
+
+bool MediaTags::read(File &file)
+{
+    clear();
+
+    m_audioEnd = file.size();
+
+    // leading tags: one ID3v2 tag, sometimes more than one is appended
+    do
+    {
+        uint32_t start = m_audioStart;
+
+        readId3v2(file);
+
+        if (m_audioStart == start)
+        {
+            break;
+        }
+    } while (m_audioStart < m_audioEnd);
+
+    // trailing tags: ID3v1 is always the last one, an APE tag may be in front of it
+    readId3v1(file);
+    readApe(file);
+
+    if (m_audioStart >= m_audioEnd)
+    {
+        ESP_LOGW(TAG, "Broken tags in %s", file.name());
+
+        m_audioStart    = 0;                            // play everything
+        m_audioEnd      = file.size();
+        return false;
+    }
+
+    ESP_LOGD(TAG, "Audio data %u..%u, \"%s\" - \"%s\" (%s)", m_audioStart, m_audioEnd, m_artist.c_str(), m_title.c_str(), m_album.c_str());
+
+    return true;
+}
+
+
+void MediaTags::clear( void )
+{
+    m_audioStart    = 0;
+    m_audioEnd      = 0;
+
+    m_title         = "";
+    m_artist        = "";
+    m_album         = "";
+}
+
+
+uint32_t MediaTags::audioStart( void )
+{
+    return m_audioStart;
+}
+
+
+uint32_t MediaTags::audioEnd( void )
+{
+    return m_audioEnd;
+}
+
+
+String MediaTags::title( void )
+{
+    return m_title;
+}
+
+
+String MediaTags::artist( void )
+{
+    return m_artist;
+}
+
+
+String MediaTags::album( void )
+{
+    return m_album;
+}
+
+
+void MediaTags::readId3v2(File &file)
+{
+    uint8_t     header[10];
+    uint32_t    tagSize;
+    uint32_t    tagEnd;
+    uint32_t    framesStart;
+
+    // "ID3", version (2), flags, tag size (syncsafe, without the header)
+    if (!file.seek(m_audioStart) ||
+        (file.read(header, sizeof(header)) != sizeof(header)) ||
+        (header[0] != 'I') || (header[1] != 'D') || (header[2] != '3') ||
+        (header[3] < 2) || (header[3] > 4))
+    {
+        return;
+    }
+
+    tagSize     = ((header[6] & 0x7F) << 21) | ((header[7] & 0x7F) << 14) | ((header[8] & 0x7F) << 7) | (header[9] & 0x7F);
+    tagEnd      = m_audioStart + sizeof(header) + tagSize;
+    framesStart = m_audioStart + sizeof(header);
+
+    // skip the extended header
+    if ((header[3] > 2) && (header[5] & 0x40))
+    {
+        uint8_t size[4];
+
+        if (file.read(size, sizeof(size)) == sizeof(size))
+        {
+            if (header[3] == 4)
+            {
+                framesStart += ((size[0] & 0x7F) << 21) | ((size[1] & 0x7F) << 14) | ((size[2] & 0x7F) << 7) | (size[3] & 0x7F);
+            }
+            else
+            {
+                framesStart += 4 + ((size[0] << 24) | (size[1] << 16) | (size[2] << 8) | size[3]);
+            }
+        }
+    }
+
+    // unsynchronised frames would need to be decoded first, we only skip them
+    if (!(header[5] & 0x80) && file.seek(framesStart))
+    {
+        readId3v2Frames(file, header[3], tagEnd);
+    }
+
+    m_audioStart = tagEnd;
+    if (header[5] & 0x10)
+    {
+        m_audioStart += 10;                             // footer present
+    }
+}
+
+
+bool MediaTags::readId3v2Frames(File &file, uint8_t version, uint32_t tagEnd)
+{
+    uint8_t     frameHeader[10];
+    uint8_t     headerSize  = (version == 2) ? 6 : 10;  // ID3v2.2 has three character IDs
+    uint32_t    position    = file.position();
+
+    while ((position + headerSize) <= tagEnd)
+    {
+        uint32_t    frameSize;
+        String      *pText = NULL;
+
+        if (file.read(frameHeader, headerSize) != headerSize)
+        {
+            return false;
+        }
+
+        if (frameHeader[0] == 0)
+        {
+            break;                                      // padding reached
+        }
+
+        if (version == 2)
+        {
+            frameSize = (frameHeader[3] << 16) | (frameHeader[4] << 8) | frameHeader[5];
+
+            if      (!memcmp(frameHeader, "TT2", 3))    pText = &m_title;
+            else if (!memcmp(frameHeader, "TP1", 3))    pText = &m_artist;
+            else if (!memcmp(frameHeader, "TAL", 3))    pText = &m_album;
+        }
+        else
+        {
+            if (version == 4)
+            {
+                frameSize = ((frameHeader[4] & 0x7F) << 21) | ((frameHeader[5] & 0x7F) << 14) | ((frameHeader[6] & 0x7F) << 7) | (frameHeader[7] & 0x7F);
+            }
+            else
+            {
+                frameSize = (frameHeader[4] << 24) | (frameHeader[5] << 16) | (frameHeader[6] << 8) | frameHeader[7];
+            }
+
+            if      (!memcmp(frameHeader, "TIT2", 4))   pText = &m_title;
+            else if (!memcmp(frameHeader, "TPE1", 4))   pText = &m_artist;
+            else if (!memcmp(frameHeader, "TALB", 4))   pText = &m_album;
+        }
+
+        position += headerSize;
+
+        if ((position + frameSize) > tagEnd)
+        {
+            return false;                               // broken frame size
+        }
+
+        // only text frames are read, everything else (APIC, ...) is skipped
+        if ((pText != NULL) && (frameSize > 1))
+        {
+            *pText = readText(file, frameSize);
+        }
+
+        position += frameSize;
+
+        if (!file.seek(position))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void MediaTags::readId3v1(File &file)
+{
+    uint8_t tag[ID3V1_SIZE];
+
+    // "TAG", title (30), artist (30), album (30), year, comment, genre
+    if ((m_audioEnd < (m_audioStart + ID3V1_SIZE)) ||
+        !file.seek(m_audioEnd - ID3V1_SIZE) ||
+        (file.read(tag, sizeof(tag)) != sizeof(tag)) ||
+        (tag[0] != 'T') || (tag[1] != 'A') || (tag[2] != 'G'))
+    {
+        return;
+    }
+
+    m_audioEnd -= ID3V1_SIZE;
+
+    // ID3v2 texts are more complete, only use these as fallback
+    if (m_title.length() == 0)
+    {
+        m_title = id3v1Text(&tag[3]);
+    }
+    if (m_artist.length() == 0)
+    {
+        m_artist = id3v1Text(&tag[33]);
+    }
+    if (m_album.length() == 0)
+    {
+        m_album = id3v1Text(&tag[63]);
+    }
+}
+
+
+String MediaTags::id3v1Text(const uint8_t *pField)
+{
+    char    text[ID3V1_TEXT_LENGTH + 1];
+    String  result;
+
+    // the fields are padded with spaces or zeros, a full one has no terminator
+    memcpy(text, pField, ID3V1_TEXT_LENGTH);
+    text[ID3V1_TEXT_LENGTH] = 0;
+
+    result = String(text);
+    result.trim();
+
+    return result;
+}
+
+
+void MediaTags::readApe(File &file)
+{
+    uint8_t     footer[APE_FOOTER_SIZE];
+    uint32_t    tagSize;
+
+    // "APETAGEX", version, tag size (items and footer), item count, flags, reserved (little endian)
+    if ((m_audioEnd < (m_audioStart + APE_FOOTER_SIZE)) ||
+        !file.seek(m_audioEnd - APE_FOOTER_SIZE) ||
+        (file.read(footer, sizeof(footer)) != sizeof(footer)) ||
+        memcmp(footer, "APETAGEX", 8))
+    {
+        return;
+    }
+
+    tagSize = footer[12] | (footer[13] << 8) | (footer[14] << 16) | (footer[15] << 24);
+
+    if (footer[23] & 0x80)
+    {
+        tagSize += APE_FOOTER_SIZE;                     // header present
+    }
+
+    if (tagSize <= (m_audioEnd - m_audioStart))
+    {
+        m_audioEnd -= tagSize;
+    }
+}
+
+
+String MediaTags::readText(File &file, uint32_t length)
+{
+    uint8_t     encoding;
+    char        text[MAX_TEXT_LENGTH + 1];
+    uint32_t    textLength  = 0;
+    bool        bigEndian   = true;
+
+    if (file.read(&encoding, 1) != 1)
+    {
+        return String();
+    }
+    length--;
+
+    // 0 = ISO-8859-1, 1 = UTF-16 with BOM, 2 = UTF-16BE, 3 = UTF-8 (characters > 127 are kept as they are)
+    if ((encoding == 1) || (encoding == 2))
+    {
+        uint8_t character[2];
+
+        while ((length >= 2) && (textLength < MAX_TEXT_LENGTH) && (file.read(character, 2) == 2))
+        {
+            length -= 2;
+
+            if ((character[0] == 0xFF) && (character[1] == 0xFE))
+            {
+                bigEndian = false;                      // BOM
+                continue;
+            }
+            if ((character[0] == 0xFE) && (character[1] == 0xFF))
+            {
+                bigEndian = true;
+                continue;
+            }
+
+            uint16_t value = bigEndian ? ((character[0] << 8) | character[1]) : ((character[1] << 8) | character[0]);
+
+            if (value == 0)
+            {
+                break;
+            }
+
+            text[textLength++] = (value < 0x100) ? (char) value : '?';
+        }
+    }
+    else
+    {
+        if (length > MAX_TEXT_LENGTH)
+        {
+            length = MAX_TEXT_LENGTH;
+        }
+
+        textLength = file.read((uint8_t *) text, length);
+    }
+
+    text[textLength] = 0;
+
+    return String(text);
+}
@@ -0,0 +1,51 @@
+#ifndef _MEDIA_TAGS_H
+    #define _MEDIA_TAGS_H
+
+    #include "Arduino.h"
+    #include "SD.h"
+    #include "FS.h"
+
+
+    // Finds the audio data of a MP3 file between its tags and keeps the tag texts.
+    //
+    // Leading ID3v2 tags (often with hundreds of KB of cover art) and trailing APE and ID3v1
+    // tags must not go to the decoder. Only the header of every ID3v2 frame is read, the
+    // payload of frames we don't need (APIC, ...) is skipped with a seek.
+    class MediaTags
+    {
+        public:
+            MediaTags();
+            ~MediaTags();
+
+            bool        read(File &file);                               // parse the tags, the file position is changed
+            void        clear( void );
+
+            uint32_t    audioStart( void );                             // first byte after the leading tags
+            uint32_t    audioEnd( void );                               // first byte of the trailing tags
+
+            String      title( void );
+            String      artist( void );
+            String      album( void );
+
+        private:
+            static const uint32_t MAX_TEXT_LENGTH   = 64;
+            static const uint32_t ID3V1_SIZE        = 128;
+            static const uint32_t ID3V1_TEXT_LENGTH = 30;
+            static const uint32_t APE_FOOTER_SIZE   = 32;
+
+            uint32_t    m_audioStart;
+            uint32_t    m_audioEnd;
+
+            String      m_title;
+            String      m_artist;
+            String      m_album;
+
+            void        readId3v2(File &file);
+            bool        readId3v2Frames(File &file, uint8_t version, uint32_t tagEnd);
+            void        readId3v1(File &file);
+            void        readApe(File &file);
+            static String  readText(File &file, uint32_t length);
+            static String  id3v1Text(const uint8_t *pField);
+    };
+
+#endif
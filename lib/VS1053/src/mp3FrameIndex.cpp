@@ -0,0 +1,436 @@
+#include "mp3FrameIndex.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+    #include "esp32-hal-log.h"
+#else
+    static const char *TAG = "Mp3FrameIndex";
+#endif
+
+Mp3FrameIndex::Mp3FrameIndex()
+{
+    m_valid = false;
+}
+
+Mp3FrameIndex::~Mp3FrameIndex()
+{
+
+}
+
+
+bool Mp3FrameIndex::open(File &file, String path, uint32_t audioStart, uint32_t audioEnd)
+{
+    String      cachePath   = path.substring(0, path.lastIndexOf('.')) + ".fdx";
+    uint32_t    startTime   = millis();
+
+    close();
+
+    if (loadCache(cachePath, file.size(), audioStart, audioEnd))
+    {
+        ESP_LOGD(TAG, "Using cached frame index of %s", path.c_str());
+        m_valid = true;
+        return true;
+    }
+
+    m_index.Magic       = INDEX_MAGIC;
+    m_index.Version     = INDEX_VERSION;
+    m_index.FileSize    = file.size();
+    m_index.AudioStart  = audioStart;
+    m_index.AudioEnd    = audioEnd;
+
+    // the headers of VBR files have a table of contents, only scan if there is none
+    if (readXing(file))
+    {
+        m_index.Source = TOC_XING;
+    }
+    else if (readVbri(file))
+    {
+        m_index.Source = TOC_VBRI;
+    }
+    else if (scan(file))
+    {
+        m_index.Source = TOC_SCAN;
+        saveCache(cachePath);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "No frames found in %s", path.c_str());
+        return false;
+    }
+
+    ESP_LOGD(TAG, "Frame index of %s (source %u): %u ms play time, built in %u ms", path.c_str(), m_index.Source, m_index.Duration, millis() - startTime);
+
+    m_valid = true;
+    return true;
+}
+
+
+void Mp3FrameIndex::close( void )
+{
+    m_valid = false;
+}
+
+
+uint32_t Mp3FrameIndex::duration( void )
+{
+    return m_valid ? m_index.Duration : 0;
+}
+
+
+uint32_t Mp3FrameIndex::positionOf(File &file, uint32_t milliSeconds)
+{
+    uint32_t    point;
+    uint32_t    fraction;                               // 0..999 between two points
+    uint32_t    position;
+
+    if (!m_valid || (m_index.Duration == 0))
+    {
+        return 0;
+    }
+
+    if (milliSeconds >= m_index.Duration)
+    {
+        milliSeconds = m_index.Duration - 1;
+    }
+
+    // interpolate between the two neighbouring percent points
+    point       = ((uint64_t) milliSeconds * 100) / m_index.Duration;
+    fraction    = ((((uint64_t) milliSeconds * 100) % m_index.Duration) * 1000) / m_index.Duration;
+    position    = m_index.Toc[point] + (((uint64_t)(m_index.Toc[point + 1] - m_index.Toc[point]) * fraction) / 1000);
+
+    return frameSync(file, position, m_index.AudioEnd);
+}
+
+
+uint32_t Mp3FrameIndex::frameSync(File &file, uint32_t position, uint32_t audioEnd)
+{
+    uint8_t         buffer[SYNC_CHUNK];
+    uint8_t         next[4];
+    int32_t         bytesRead;
+    uint32_t        windowEnd   = position + SYNC_WINDOW;
+    uint32_t        candidate;
+    FrameHeader_s   first;
+    FrameHeader_s   second;
+
+    if (windowEnd > file.size())
+    {
+        windowEnd = file.size();
+    }
+
+    // the window is read in chunks, they overlap by 3 bytes so no header is cut
+    for (uint32_t start = position; (start + 4) <= windowEnd; start += (SYNC_CHUNK - 3))
+    {
+        uint32_t length = ((windowEnd - start) < SYNC_CHUNK) ? (windowEnd - start) : SYNC_CHUNK;
+
+        if (!file.seek(start) ||
+            ((bytesRead = file.read(buffer, length)) < 4))
+        {
+            break;
+        }
+
+        // a header is only trusted if the next frame starts with a matching one
+        for (int32_t counter = 0; (counter + 4) <= bytesRead; counter++)
+        {
+            if (!parseHeader(&buffer[counter], &first))
+            {
+                continue;
+            }
+
+            candidate = start + counter;
+
+            if ((candidate + first.FrameLength + 4) > windowEnd)
+            {
+                // the next header is outside of our window, accept the one we have at the end of the audio
+                if ((candidate + first.FrameLength) >= audioEnd)
+                {
+                    return candidate;
+                }
+
+                ESP_LOGD(TAG, "No frame sync found after %u", position);
+                return position;
+            }
+
+            if (file.seek(candidate + first.FrameLength) &&
+                (file.read(next, sizeof(next)) == sizeof(next)) &&
+                parseHeader(next, &second) &&
+                (second.Version == first.Version) &&
+                (second.SampleRate == first.SampleRate))
+            {
+                return candidate;
+            }
+        }
+    }
+
+    ESP_LOGD(TAG, "No frame sync found after %u", position);
+
+    return position;
+}
+
+
+uint32_t Mp3FrameIndex::estimateDuration(File &file, uint32_t audioStart, uint32_t audioEnd, uint16_t *pBitrate)
+{
+    Mp3FrameIndex   index;
+    FrameHeader_s   header;
+    uint8_t         buffer[4];
+    uint32_t        sync = frameSync(file, audioStart, audioEnd);
+
+    *pBitrate = 0;
+
+    if (!file.seek(sync) || (file.read(buffer, sizeof(buffer)) != sizeof(buffer)) || !parseHeader(buffer, &header))
+    {
+        return 0;
+    }
+
+    index.m_index.AudioStart    = audioStart;
+    index.m_index.AudioEnd      = audioEnd;
+
+    // VBR files tell us their frame count, for all others the first frame has to do
+    if ((index.readXing(file) || index.readVbri(file)) && index.m_index.Duration)
+    {
+        *pBitrate = ((uint64_t)(audioEnd - audioStart) * 8) / index.m_index.Duration;
+        return index.m_index.Duration;
+    }
+
+    *pBitrate = header.Bitrate;
+
+    return ((uint64_t)(audioEnd - audioStart) * 8) / header.Bitrate;       // bits / (kbit/s) = ms
+}
+
+
+bool Mp3FrameIndex::parseHeader(const uint8_t *pData, FrameHeader_s *pHeader)
+{
+    // MPEG layer III bitrates in kbit/s and sample rates of MPEG1
+    const uint16_t bitrateV1[16]    = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 };
+    const uint16_t bitrateV2[16]    = { 0,  8, 16, 24, 32, 40, 48, 56,  64,  80,  96, 112, 128, 144, 160, 0 };
+    const uint32_t sampleRates[3]   = { 44100, 48000, 32000 };
+
+    uint8_t version;
+    uint8_t layer;
+    uint8_t bitrateIndex;
+    uint8_t sampleRateIndex;
+
+    // frame sync (11 bits)
+    if ((pData[0] != 0xFF) || ((pData[1] & 0xE0) != 0xE0))
+    {
+        return false;
+    }
+
+    version         = (pData[1] >> 3) & 0x03;               // 3 = MPEG1, 2 = MPEG2, 0 = MPEG2.5
+    layer           = (pData[1] >> 1) & 0x03;               // 1 = layer III
+    bitrateIndex    = (pData[2] >> 4) & 0x0F;
+    sampleRateIndex = (pData[2] >> 2) & 0x03;
+
+    if ((version == 1) || (layer != 1) || (bitrateIndex == 0) || (bitrateIndex == 15) || (sampleRateIndex == 3))
+    {
+        return false;
+    }
+
+    pHeader->Version            = version;
+    pHeader->Bitrate            = (version == 3) ? bitrateV1[bitrateIndex] : bitrateV2[bitrateIndex];
+    pHeader->SampleRate         = sampleRates[sampleRateIndex] >> ((version == 3) ? 0 : ((version == 2) ? 1 : 2));
+    pHeader->Channels           = (((pData[3] >> 6) & 0x03) == 3) ? 1 : 2;
+    pHeader->SamplesPerFrame    = (version == 3) ? 1152 : 576;
+    pHeader->FrameLength        = ((pHeader->SamplesPerFrame / 8) * pHeader->Bitrate * 1000) / pHeader->SampleRate + ((pData[2] >> 1) & 0x01);
+
+    return true;
+}
+
+
+bool Mp3FrameIndex::readXing(File &file)
+{
+    uint8_t         buffer[4 + 32 + 120];                   // header, side info, Xing tag
+    FrameHeader_s   header;
+    uint8_t         *pTag;
+    uint32_t        flags;
+    uint32_t        frames  = 0;
+    uint32_t        bytes   = m_index.AudioEnd - m_index.AudioStart;
+    uint32_t        sync    = frameSync(file, m_index.AudioStart, m_index.AudioEnd);
+
+    if (!file.seek(sync) || (file.read(buffer, sizeof(buffer)) != sizeof(buffer)) || !parseHeader(buffer, &header))
+    {
+        return false;
+    }
+
+    // the tag follows the side information of the first frame
+    pTag = &buffer[4 + ((header.Version == 3) ? ((header.Channels == 1) ? 17 : 32) : ((header.Channels == 1) ? 9 : 17))];
+
+    if (memcmp(pTag, "Xing", 4) && memcmp(pTag, "Info", 4))
+    {
+        return false;
+    }
+
+    flags = (pTag[4] << 24) | (pTag[5] << 16) | (pTag[6] << 8) | pTag[7];
+    pTag += 8;
+
+    if (flags & 0x01)
+    {
+        frames = (pTag[0] << 24) | (pTag[1] << 16) | (pTag[2] << 8) | pTag[3];
+        pTag += 4;
+    }
+    if (flags & 0x02)
+    {
+        bytes = (pTag[0] << 24) | (pTag[1] << 16) | (pTag[2] << 8) | pTag[3];
+        pTag += 4;
+    }
+
+    // without frame count and TOC the scan does a better job
+    if (((flags & 0x05) != 0x05) || (frames == 0))
+    {
+        return false;
+    }
+
+    m_index.Duration = ((uint64_t) frames * header.SamplesPerFrame * 1000) / header.SampleRate;
+
+    // TOC entries are 1/256 of the stream size at every percent of the play time
+    for (uint32_t point = 0; point < 100; point++)
+    {
+        m_index.Toc[point] = sync + (((uint64_t) pTag[point] * bytes) / 256);
+    }
+    m_index.Toc[100] = m_index.AudioEnd;
+
+    return true;
+}
+
+
+bool Mp3FrameIndex::readVbri(File &file)
+{
+    uint8_t         buffer[4 + 32 + 26];                    // header, fixed offset, VBRI header
+    FrameHeader_s   header;
+    uint8_t         *pTag       = &buffer[4 + 32];
+    uint32_t        sync        = frameSync(file, m_index.AudioStart, m_index.AudioEnd);
+    uint32_t        frames;
+    uint16_t        entries;
+    uint16_t        scale;
+    uint16_t        entrySize;
+    uint32_t        position;
+    uint32_t        point       = 0;
+
+    if (!file.seek(sync) || (file.read(buffer, sizeof(buffer)) != sizeof(buffer)) ||
+        !parseHeader(buffer, &header) || memcmp(pTag, "VBRI", 4))
+    {
+        return false;
+    }
+
+    frames      = (pTag[14] << 24) | (pTag[15] << 16) | (pTag[16] << 8) | pTag[17];
+    entries     = (pTag[18] << 8) | pTag[19];
+    scale       = (pTag[20] << 8) | pTag[21];
+    entrySize   = (pTag[22] << 8) | pTag[23];
+
+    if ((frames == 0) || (entries == 0) || (entrySize == 0) || (entrySize > 4))
+    {
+        return false;
+    }
+
+    m_index.Duration = ((uint64_t) frames * header.SamplesPerFrame * 1000) / header.SampleRate;
+
+    // every entry is the size of the next 1/entries of the play time, convert to percent points
+    position = sync;
+    for (uint32_t entry = 0; entry < entries; entry++)
+    {
+        uint8_t     data[4];
+        uint32_t    size = 0;
+
+        if (file.read(data, entrySize) != entrySize)
+        {
+            return false;
+        }
+
+        for (uint16_t counter = 0; counter < entrySize; counter++)
+        {
+            size = (size << 8) | data[counter];
+        }
+
+        while ((point < 100) && ((point * entries) <= (entry * 100)))
+        {
+            m_index.Toc[point++] = position;
+        }
+
+        position += size * scale;
+    }
+
+    while (point < 100)
+    {
+        m_index.Toc[point++] = position;
+    }
+    m_index.Toc[100] = m_index.AudioEnd;
+
+    return true;
+}
+
+
+bool Mp3FrameIndex::scan(File &file)
+{
+    uint8_t         buffer[4];
+    FrameHeader_s   header;
+    uint32_t        audioSize   = m_index.AudioEnd - m_index.AudioStart;
+    uint32_t        bitrateSum  = 0;
+    uint32_t        headers     = 0;
+
+    // look for the next frame at every percent of the audio data
+    for (uint32_t point = 0; point < 100; point++)
+    {
+        uint32_t position   = m_index.AudioStart + (uint32_t)(((uint64_t) audioSize * point) / 100);
+        uint32_t sync       = frameSync(file, position, m_index.AudioEnd);
+
+        m_index.Toc[point] = sync;
+
+        if (file.seek(sync) && (file.read(buffer, sizeof(buffer)) == sizeof(buffer)) && parseHeader(buffer, &header))
+        {
+            bitrateSum += header.Bitrate;
+            headers++;
+        }
+    }
+    m_index.Toc[100] = m_index.AudioEnd;
+
+    if (headers == 0)
+    {
+        return false;
+    }
+
+    // the average bitrate of the samples gives the play time (exact for CBR)
+    m_index.Duration = ((uint64_t) audioSize * 8 * headers) / bitrateSum;
+
+    return true;
+}
+
+
+bool Mp3FrameIndex::loadCache(String &cachePath, uint32_t fileSize, uint32_t audioStart, uint32_t audioEnd)
+{
+    fs::FS  &fs = SD;
+    File    cache;
+    bool    result = false;
+
+    cache = fs.open(cachePath);
+
+    if (cache)
+    {
+        result = (cache.read((uint8_t *) &m_index, sizeof(m_index)) == sizeof(m_index)) &&
+                 (m_index.Magic == INDEX_MAGIC) &&
+                 (m_index.Version == INDEX_VERSION) &&
+                 (m_index.FileSize == fileSize) &&
+                 (m_index.AudioStart == audioStart) &&
+                 (m_index.AudioEnd == audioEnd);
+
+        cache.close();
+    }
+
+    return result;
+}
+
+
+void Mp3FrameIndex::saveCache(String &cachePath)
+{
+    fs::FS  &fs = SD;
+    File    cache;
+
+    cache = fs.open(cachePath, FILE_WRITE);
+
+    if (!cache || (cache.write((uint8_t *) &m_index, sizeof(m_index)) != sizeof(m_index)))
+    {
+        ESP_LOGW(TAG, "Could not write %s", cachePath.c_str());
+    }
+
+    if (cache)
+    {
+        cache.close();
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef _MP3_FRAME_INDEX_H
+    #define _MP3_FRAME_INDEX_H
+
+    #include "Arduino.h"
+    #include "SD.h"
+    #include "FS.h"
+
+
+    // Maps play time to byte positions of a MP3 file that are on a frame boundary.
+    //
+    // The index has 101 positions (0%, 1%, ... 100% of the play time). They come from the
+    // Xing/Info or VBRI header if the file has a table of contents, otherwise from a sparse scan
+    // that looks for a frame header at every percent of the audio data. The scan is cached in a
+    // sidecar file ("track.mp3" -> "track.fdx"), so it only runs once per file.
+    class Mp3FrameIndex
+    {
+        public:
+            typedef struct {
+                uint8_t     Version;                                    // 3 = MPEG1, 2 = MPEG2, 0 = MPEG2.5
+                uint16_t    Bitrate;                                    // kbit/s
+                uint32_t    SampleRate;
+                uint8_t     Channels;
+                uint32_t    FrameLength;                                // bytes including the header
+                uint32_t    SamplesPerFrame;
+            } FrameHeader_s;
+
+            Mp3FrameIndex();
+            ~Mp3FrameIndex();
+
+            // read or build the index of the (opened) file, the file position is changed
+            // (the full path is given, the cache is kept next to the file)
+            bool        open(File &file, String path, uint32_t audioStart, uint32_t audioEnd);
+            void        close( void );
+
+            uint32_t    duration( void );                               // ms, 0 if unknown
+            uint32_t    positionOf(File &file, uint32_t milliSeconds);  // frame aligned byte position
+
+            static uint32_t frameSync(File &file, uint32_t position, uint32_t audioEnd);    // next frame boundary
+            static uint32_t estimateDuration(File &file, uint32_t audioStart, uint32_t audioEnd, uint16_t *pBitrate);   // ms, without a scan
+            static bool     parseHeader(const uint8_t *pData, FrameHeader_s *pHeader);
+
+        private:
+            static const uint32_t INDEX_MAGIC       = 0x58444646;       // "FFDX"
+            static const uint16_t INDEX_VERSION     = 1;
+            static const uint32_t TOC_POINTS        = 101;
+            static const uint32_t SYNC_WINDOW       = 3072;             // max. bytes searched (two of the longest frames)
+            static const uint32_t SYNC_CHUNK        = 256;              // read at once, the tasks have small stacks
+
+            typedef struct {
+                uint32_t    Magic;
+                uint16_t    Version;
+                uint16_t    Source;                                     // where the table comes from (TocSource_e)
+                uint32_t    FileSize;
+                uint32_t    AudioStart;
+                uint32_t    AudioEnd;
+                uint32_t    Duration;                                   // ms
+                uint32_t    Toc[TOC_POINTS];                            // byte position at 0..100% of the duration
+            } FrameIndex_s;
+
+            typedef enum {
+                TOC_NONE,
+                TOC_XING,
+                TOC_VBRI,
+                TOC_SCAN,
+            } TocSource_e;
+
+            FrameIndex_s    m_index;
+            bool            m_valid;
+
+            bool        readXing(File &file);
+            bool        readVbri(File &file);
+            bool        scan(File &file);
+            bool        loadCache(String &cachePath, uint32_t fileSize, uint32_t audioStart, uint32_t audioEnd);
+            void        saveCache(String &cachePath);
+    };
+
+#endif
@@ -0,0 +1,300 @@
+#include "playlistIndex.h"
+
+#include "rom/crc.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+    #include "esp32-hal-log.h"
+#else
+    static const char *TAG = "PlaylistIndex";
+#endif
+
+PlaylistIndex::PlaylistIndex()
+{
+    m_count         = 0;
+    m_playlistSize  = 0;
+    m_valid         = false;
+}
+
+PlaylistIndex::~PlaylistIndex()
+{
+
+}
+
+
+bool PlaylistIndex::open(String playlistPath)
+{
+    fs::FS          &fs = SD;
+    File            playlist;
+    IndexHeader_s   header;
+    uint32_t        crc;
+    uint32_t        startTime = millis();
+
+    close();
+
+    m_playlistPath  = playlistPath;
+    m_indexPath     = playlistPath.substring(0, playlistPath.lastIndexOf('.')) + ".idx";
+
+    playlist = fs.open(m_playlistPath);
+    if (!playlist)
+    {
+        ESP_LOGE(TAG, "Could not open playlist %s", m_playlistPath.c_str());
+        return false;
+    }
+
+    if (!playlistCrc(playlist, &crc))
+    {
+        ESP_LOGE(TAG, "Could not read playlist %s", m_playlistPath.c_str());
+        playlist.close();
+        return false;
+    }
+
+    m_playlistSize = playlist.size();
+
+    // use the existing index if it still belongs to this playlist
+    if (readHeader(&header) &&
+        (header.PlaylistCrc == crc) &&
+        (header.PlaylistSize == playlist.size()))
+    {
+        m_count = header.EntryCount;
+        m_valid = true;
+
+        ESP_LOGD(TAG, "Using index of %s, %u entries (%u ms)", m_playlistPath.c_str(), m_count, millis() - startTime);
+    }
+    else
+    {
+        m_valid = build(playlist, crc);
+
+        ESP_LOGD(TAG, "Built index of %s, %u entries (%u ms)", m_playlistPath.c_str(), m_count, millis() - startTime);
+    }
+
+    playlist.close();
+
+    return m_valid;
+}
+
+
+void PlaylistIndex::close( void )
+{
+    m_playlistPath  = "";
+    m_indexPath     = "";
+    m_count         = 0;
+    m_playlistSize  = 0;
+    m_valid         = false;
+}
+
+
+uint32_t PlaylistIndex::count( void )
+{
+    return m_count;
+}
+
+
+String PlaylistIndex::entry(uint32_t number)
+{
+    fs::FS          &fs = SD;
+    File            file;
+    IndexEntry_s    indexEntry;
+    char            text[MAX_ENTRY_LENGTH + 1];
+    bool            result = false;
+
+    if (!m_valid || (number >= m_count))
+    {
+        return String();
+    }
+
+    // one read of the index ...
+    file = fs.open(m_indexPath);
+    if (file)
+    {
+        result = file.seek(sizeof(IndexHeader_s) + (number * sizeof(IndexEntry_s))) &&
+                 (file.read((uint8_t *) &indexEntry, sizeof(indexEntry)) == sizeof(indexEntry));
+        file.close();
+    }
+
+    // the index could be damaged, it must not point outside the buffer or the playlist
+    if (result &&
+        ((indexEntry.Length > MAX_ENTRY_LENGTH) ||
+         (indexEntry.Offset > m_playlistSize) ||
+         (indexEntry.Length > (m_playlistSize - indexEntry.Offset))))
+    {
+        ESP_LOGE(TAG, "Invalid entry %u in %s (offset %u, length %u)", number, m_indexPath.c_str(), indexEntry.Offset, indexEntry.Length);
+        result = false;
+    }
+
+    // ... and one of the playlist
+    if (result)
+    {
+        file = fs.open(m_playlistPath);
+        result = false;
+
+        if (file)
+        {
+            result = file.seek(indexEntry.Offset) &&
+                     (file.read((uint8_t *) text, indexEntry.Length) == indexEntry.Length);
+            file.close();
+        }
+    }
+
+    if (!result)
+    {
+        ESP_LOGE(TAG, "Could not read entry %u of %s", number, m_playlistPath.c_str());
+        return String();
+    }
+
+    text[indexEntry.Length] = 0;
+
+    ESP_LOGV(TAG, "Read playlist entry %u: \"%s\"", number, text);
+
+    return String(text);
+}
+
+
+bool PlaylistIndex::playlistCrc(File &playlist, uint32_t *pCrc)
+{
+    uint8_t     buffer[READ_CHUNK_SIZE];
+    int32_t     bytesRead;
+
+    *pCrc = 0;
+
+    playlist.seek(0);
+
+    while ((bytesRead = playlist.read(buffer, sizeof(buffer))) > 0)
+    {
+        *pCrc = crc32_le(*pCrc, buffer, bytesRead);
+    }
+
+    return (bytesRead == 0);
+}
+
+
+bool PlaylistIndex::readHeader(IndexHeader_s *pHeader)
+{
+    fs::FS  &fs = SD;
+    File    indexFile;
+    bool    result = false;
+
+    indexFile = fs.open(m_indexPath);
+
+    if (indexFile)
+    {
+        result = (indexFile.read((uint8_t *) pHeader, sizeof(IndexHeader_s)) == sizeof(IndexHeader_s)) &&
+                 (pHeader->Magic == INDEX_MAGIC) &&
+                 (pHeader->Version == INDEX_VERSION) &&
+                 (pHeader->EntrySize == sizeof(IndexEntry_s)) &&
+                 (indexFile.size() == (sizeof(IndexHeader_s) + (pHeader->EntryCount * sizeof(IndexEntry_s))));
+
+        indexFile.close();
+    }
+
+    return result;
+}
+
+
+bool PlaylistIndex::build(File &playlist, uint32_t crc)
+{
+    fs::FS          &fs = SD;
+    File            indexFile;
+    IndexHeader_s   header;
+    uint8_t         buffer[READ_CHUNK_SIZE];
+    int32_t         bytesRead;
+    uint32_t        offset          = 0;
+    uint32_t        first           = 0;            // first / last non white space character of the line
+    uint32_t        last            = 0;
+    uint8_t         firstCharacter  = 0;
+    bool            inLine          = false;
+    bool            result          = true;
+
+    indexFile = fs.open(m_indexPath, FILE_WRITE);
+    if (!indexFile)
+    {
+        ESP_LOGE(TAG, "Could not create index %s", m_indexPath.c_str());
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    m_count = 0;
+
+    // placeholder, the header is written when all entries are known
+    result = (indexFile.write((uint8_t *) &header, sizeof(header)) == sizeof(header));
+
+    playlist.seek(0);
+
+    do
+    {
+        bytesRead = playlist.read(buffer, sizeof(buffer));
+
+        for (int32_t counter = 0; counter < bytesRead; counter++, offset++)
+        {
+            if ((buffer[counter] != '\r') && (buffer[counter] != '\n'))
+            {
+                if (!isspace(buffer[counter]))
+                {
+                    if (!inLine)
+                    {
+                        first           = offset;
+                        firstCharacter  = buffer[counter];
+                        inLine          = true;
+                    }
+                    last = offset;
+                }
+            }
+            else if (inLine)
+            {
+                result = result && addEntry(indexFile, first, last, firstCharacter);
+                inLine = false;
+            }
+        }
+    } while (bytesRead > 0);
+
+    // the last line may have no line end
+    if (inLine)
+    {
+        result = result && addEntry(indexFile, first, last, firstCharacter);
+    }
+
+    header.Magic        = INDEX_MAGIC;
+    header.Version      = INDEX_VERSION;
+    header.EntrySize    = sizeof(IndexEntry_s);
+    header.PlaylistCrc  = crc;
+    header.PlaylistSize = playlist.size();
+    header.EntryCount   = m_count;
+
+    result = result && indexFile.seek(0) && (indexFile.write((uint8_t *) &header, sizeof(header)) == sizeof(header));
+
+    indexFile.close();
+
+    if (!result)
+    {
+        ESP_LOGE(TAG, "Writing index %s failed", m_indexPath.c_str());
+        fs.remove(m_indexPath);
+        m_count = 0;
+    }
+
+    return result;
+}
+
+
+bool PlaylistIndex::addEntry(File &indexFile, uint32_t first, uint32_t last, uint8_t firstCharacter)
+{
+    IndexEntry_s    indexEntry;
+
+    // comments and extended M3U tags (#EXTM3U, #EXTINF, ...) are no entries
+    if (firstCharacter == '#')
+    {
+        return true;
+    }
+
+    if ((last - first + 1) > MAX_ENTRY_LENGTH)
+    {
+        ESP_LOGW(TAG, "Entry at offset %u is too long, ignored", first);
+        return true;
+    }
+
+    indexEntry.Offset   = first;
+    indexEntry.Length   = last - first + 1;
+    indexEntry.Reserved = 0;
+
+    m_count++;
+
+    return (indexFile.write((uint8_t *) &indexEntry, sizeof(indexEntry)) == sizeof(indexEntry));
+}
@@ -0,0 +1,60 @@
+#ifndef _PLAYLIST_INDEX_H
+    #define _PLAYLIST_INDEX_H
+
+    #include "Arduino.h"
+    #include "SD.h"
+    #include "FS.h"
+
+
+    // Binary sidecar index of a M3U playlist ("list.m3u" -> "list.idx").
+    //
+    // The index holds the byte offset and length of every entry (non empty lines that are no
+    // comment), so entry n costs one seek and one read instead of scanning the list up to it.
+    // It is built the first time a playlist is opened and rebuilt if the CRC or the size of
+    // the playlist does not match anymore.
+    class PlaylistIndex
+    {
+        public:
+            PlaylistIndex();
+            ~PlaylistIndex();
+
+            bool        open(String playlistPath);                      // use (or build) the index of this playlist
+            void        close( void );
+
+            uint32_t    count( void );                                  // number of entries
+            String      entry(uint32_t number);                         // entry 0..count-1, empty if it does not exist
+
+        private:
+            static const uint32_t INDEX_MAGIC       = 0x58444950;       // "PIDX"
+            static const uint16_t INDEX_VERSION     = 1;
+            static const uint32_t READ_CHUNK_SIZE   = 512;
+            static const uint32_t MAX_ENTRY_LENGTH  = 255;
+
+            typedef struct {
+                uint32_t    Magic;
+                uint16_t    Version;
+                uint16_t    EntrySize;                                  // sizeof(IndexEntry_s)
+                uint32_t    PlaylistCrc;                                // CRC32 of the complete playlist
+                uint32_t    PlaylistSize;
+                uint32_t    EntryCount;
+            } IndexHeader_s;
+
+            typedef struct {
+                uint32_t    Offset;                                     // first character of the entry in the playlist
+                uint16_t    Length;                                     // without line end and white space
+                uint16_t    Reserved;
+            } IndexEntry_s;
+
+            String      m_playlistPath;
+            String      m_indexPath;
+            uint32_t    m_count;
+            uint32_t    m_playlistSize;                                 // bounds of the entries read from the index
+            bool        m_valid;
+
+            bool        playlistCrc(File &playlist, uint32_t *pCrc);
+            bool        readHeader(IndexHeader_s *pHeader);
+            bool        build(File &playlist, uint32_t crc);
+            bool        addEntry(File &indexFile, uint32_t first, uint32_t last, uint8_t firstCharacter);
+    };
+
+#endif
@@ -0,0 +1,299 @@
+#include "resumeStore.h"
+
+#include "rom/crc.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+    #include "esp32-hal-log.h"
+#else
+    static const char *TAG = "ResumeStore";
+#endif
+
+ResumeStore::ResumeStore()
+{
+    m_lock          = NULL;
+    m_entryCount    = 0;
+    m_recordCount   = 0;
+    m_useCounter    = 0;
+    m_loaded        = false;
+}
+
+ResumeStore::~ResumeStore()
+{
+
+}
+
+
+bool ResumeStore::begin( void )
+{
+    fs::FS          &fs = SD;
+    File            journal;
+    ResumeRecord_s  record;
+    uint32_t        invalidRecords = 0;
+    uint32_t        startTime = millis();
+
+    if (m_lock == NULL)
+    {
+        m_lock = xSemaphoreCreateMutex();
+    }
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    m_entryCount    = 0;
+    m_recordCount   = 0;
+
+    // a compaction was interrupted: before the rename the old journal is still there
+    if (fs.exists(COMPACT_PATH))
+    {
+        if (fs.exists(JOURNAL_PATH))
+        {
+            fs.remove(COMPACT_PATH);
+        }
+        else
+        {
+            fs.rename(COMPACT_PATH, JOURNAL_PATH);
+        }
+    }
+
+    journal = fs.open(JOURNAL_PATH);
+
+    if (journal)
+    {
+        while (journal.read((uint8_t *) &record, sizeof(record)) == sizeof(record))
+        {
+            ResumeEntry_s *pEntry;
+
+            m_recordCount++;
+
+            // a power cut while writing leaves a broken record, just skip it
+            if ((record.Magic != RECORD_MAGIC) || (record.Crc != recordCrc(&record)))
+            {
+                invalidRecords++;
+                continue;
+            }
+
+            pEntry = findEntry(record.Key, true);
+            pEntry->Position    = record.Position;
+            pEntry->Entry       = record.Entry;
+        }
+
+        journal.close();
+    }
+
+    m_loaded = true;
+
+    ESP_LOGD(TAG, "Loaded %u positions from %u records (%u invalid) in %u ms", m_entryCount, m_recordCount, invalidRecords, millis() - startTime);
+
+    xSemaphoreGive(m_lock);
+
+    return true;
+}
+
+
+bool ResumeStore::load(String mediaPath, uint32_t *pPosition, uint16_t *pEntry)
+{
+    ResumeEntry_s   *pResumeEntry;
+    bool            result = false;
+
+    if (!m_loaded)
+    {
+        return false;
+    }
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    pResumeEntry = findEntry(mediaKey(mediaPath), false);
+
+    if (pResumeEntry != NULL)
+    {
+        *pPosition  = pResumeEntry->Position;
+        *pEntry     = pResumeEntry->Entry;
+        result      = true;
+    }
+
+    xSemaphoreGive(m_lock);
+
+    return result;
+}
+
+
+bool ResumeStore::save(String mediaPath, uint32_t position, uint16_t entry)
+{
+    ResumeEntry_s   *pResumeEntry;
+    bool            result = true;
+
+    if (!m_loaded)
+    {
+        return false;
+    }
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    pResumeEntry = findEntry(mediaKey(mediaPath), true);
+
+    // don't wear the card with records that change nothing
+    if ((pResumeEntry->Position != position) || (pResumeEntry->Entry != entry) || (pResumeEntry->LastUse == 0))
+    {
+        pResumeEntry->Position  = position;
+        pResumeEntry->Entry     = entry;
+
+        if (m_recordCount >= MAX_RECORDS)
+        {
+            result = compact();
+        }
+        else
+        {
+            result = appendRecord(pResumeEntry);
+        }
+    }
+
+    pResumeEntry->LastUse = ++m_useCounter;
+
+    xSemaphoreGive(m_lock);
+
+    return result;
+}
+
+
+uint32_t ResumeStore::mediaKey(String &mediaPath)
+{
+    return crc32_le(0, (const uint8_t *) mediaPath.c_str(), mediaPath.length());
+}
+
+
+uint32_t ResumeStore::recordCrc(ResumeRecord_s *pRecord)
+{
+    return crc32_le(0, (const uint8_t *) pRecord, sizeof(ResumeRecord_s) - sizeof(pRecord->Crc));
+}
+
+
+ResumeStore::ResumeEntry_s *ResumeStore::findEntry(uint32_t key, bool create)
+{
+    ResumeEntry_s   *pOldest = NULL;
+
+    for (uint32_t counter = 0; counter < m_entryCount; counter++)
+    {
+        if (m_entries[counter].Key == key)
+        {
+            return &m_entries[counter];
+        }
+
+        if ((pOldest == NULL) || (m_entries[counter].LastUse < pOldest->LastUse))
+        {
+            pOldest = &m_entries[counter];
+        }
+    }
+
+    if (!create)
+    {
+        return NULL;
+    }
+
+    // take a free entry or forget the one that was not used for the longest time
+    if (m_entryCount < MAX_MEDIA)
+    {
+        pOldest = &m_entries[m_entryCount++];
+    }
+    else
+    {
+        ESP_LOGD(TAG, "Forgetting position of media 0x%08X", pOldest->Key);
+    }
+
+    pOldest->Key        = key;
+    pOldest->Position   = 0;
+    pOldest->Entry      = 0;
+    pOldest->LastUse    = 0;
+
+    return pOldest;
+}
+
+
+bool ResumeStore::appendRecord(ResumeEntry_s *pEntry)
+{
+    fs::FS          &fs = SD;
+    File            journal;
+    ResumeRecord_s  record;
+    bool            result = false;
+
+    record.Key      = pEntry->Key;
+    record.Position = pEntry->Position;
+    record.Entry    = pEntry->Entry;
+    record.Magic    = RECORD_MAGIC;
+    record.Crc      = recordCrc(&record);
+
+    journal = fs.open(JOURNAL_PATH, FILE_APPEND);
+
+    if (journal)
+    {
+        // keep the records aligned, even if the last write was cut off
+        if (journal.size() % sizeof(record))
+        {
+            journal.close();
+            return compact();
+        }
+
+        result = (journal.write((uint8_t *) &record, sizeof(record)) == sizeof(record));
+        journal.close();
+
+        m_recordCount++;
+    }
+
+    if (!result)
+    {
+        ESP_LOGE(TAG, "Writing resume record failed");
+    }
+
+    return result;
+}
+
+
+bool ResumeStore::compact( void )
+{
+    fs::FS          &fs = SD;
+    File            journal;
+    ResumeRecord_s  record;
+    bool            result;
+    uint32_t        startTime = millis();
+
+    journal = fs.open(COMPACT_PATH, FILE_WRITE);
+
+    if (!journal)
+    {
+        ESP_LOGE(TAG, "Could not create %s", COMPACT_PATH);
+        return false;
+    }
+
+    result = true;
+
+    for (uint32_t counter = 0; (counter < m_entryCount) && result; counter++)
+    {
+        record.Key      = m_entries[counter].Key;
+        record.Position = m_entries[counter].Position;
+        record.Entry    = m_entries[counter].Entry;
+        record.Magic    = RECORD_MAGIC;
+        record.Crc      = recordCrc(&record);
+
+        result = (journal.write((uint8_t *) &record, sizeof(record)) == sizeof(record));
+    }
+
+    journal.close();
+
+    // the old journal stays valid until the new one is complete (see begin())
+    if (result)
+    {
+        fs.remove(JOURNAL_PATH);
+        result = fs.rename(COMPACT_PATH, JOURNAL_PATH);
+    }
+    else
+    {
+        fs.remove(COMPACT_PATH);
+    }
+
+    if (result)
+    {
+        m_recordCount = m_entryCount;
+    }
+
+    ESP_LOGD(TAG, "Compacted journal to %u records %s (%u ms)", m_entryCount, result ? "" : "FAILED", millis() - startTime);
+
+    return result;
+}
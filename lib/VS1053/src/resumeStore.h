@@ -0,0 +1,64 @@
+#ifndef _RESUME_STORE_H
+    #define _RESUME_STORE_H
+
+    #include "Arduino.h"
+    #include "SD.h"
+    #include "FS.h"
+
+
+    // Keeps the resume positions of all media in one binary journal on the SD card.
+    //
+    // Every save() appends a small record with its own CRC, so a power cut can only destroy
+    // the record that was just written. The last valid record of a media wins. A RAM copy of
+    // the latest positions answers every lookup, the journal is only read at startup. When the
+    // journal gets too long, the RAM copy is written to a new file that replaces the old one.
+    class ResumeStore
+    {
+        public:
+            ResumeStore();
+            ~ResumeStore();
+
+            bool        begin( void );                                          // read the journal
+
+            bool        load(String mediaPath, uint32_t *pPosition, uint16_t *pEntry);
+            bool        save(String mediaPath, uint32_t position, uint16_t entry);
+
+        private:
+            static const uint16_t RECORD_MAGIC      = 0x5253;                   // "RS"
+            static const uint32_t MAX_MEDIA         = 128;                      // entries of the RAM copy
+            static const uint32_t MAX_RECORDS       = 1024;                     // compact the journal above this
+
+            const char  *JOURNAL_PATH               = "/enrav.jrn";
+            const char  *COMPACT_PATH               = "/enrav.tmp";
+
+            typedef struct {
+                uint32_t    Key;                                                // CRC32 of the media path
+                uint32_t    Position;                                           // byte position in the (actual) file
+                uint16_t    Entry;                                              // playlist entry
+                uint16_t    Magic;
+                uint32_t    Crc;                                                // CRC32 of the fields above
+            } ResumeRecord_s;
+
+            typedef struct {
+                uint32_t    Key;
+                uint32_t    Position;
+                uint16_t    Entry;
+                uint32_t    LastUse;                                            // for replacing the oldest entry
+            } ResumeEntry_s;
+
+            SemaphoreHandle_t   m_lock;
+            ResumeEntry_s       m_entries[MAX_MEDIA];
+            uint32_t            m_entryCount;
+            uint32_t            m_recordCount;                                  // records in the journal
+            uint32_t            m_useCounter;
+            bool                m_loaded;
+
+            static uint32_t     mediaKey(String &mediaPath);
+            static uint32_t     recordCrc(ResumeRecord_s *pRecord);
+
+            ResumeEntry_s       *findEntry(uint32_t key, bool create);
+            bool                appendRecord(ResumeEntry_s *pEntry);
+            bool                compact( void );
+    };
+
+#endif
@@ -0,0 +1,550 @@
+#include "sdReadAhead.h"
+
+#include "mp3FrameIndex.h"
+#include "spiBus.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+    #include "esp32-hal-log.h"
+#else
+    static const char *TAG = "SdReadAhead";
+#endif
+
+SdReadAhead::SdReadAhead()
+{
+    m_handle        = NULL;
+    m_lock          = NULL;
+    m_wakeup        = NULL;
+
+    m_pFile         = NULL;
+    m_pNextFile     = NULL;
+    m_endPosition   = 0;
+    m_nextEndPosition = 0;
+
+    m_consumed      = 0;
+    m_produced      = 0;
+    m_boundary      = 0;
+    m_trackBase     = 0;
+    m_nextStartPosition = 0;
+    m_switchPending = false;
+    m_active        = false;
+    m_eof           = false;
+    m_starved       = false;
+
+    m_checkpointLock        = NULL;
+    m_pCheckpointStore      = NULL;
+    m_checkpointPosition    = 0;
+    m_checkpointEntry       = 0;
+    m_checkpointPending     = false;
+
+    m_startPosition = 0;
+    m_targetTime    = 500;
+    m_bitrate       = 0;
+
+    resetStatistics();
+}
+
+SdReadAhead::~SdReadAhead()
+{
+
+}
+
+
+bool SdReadAhead::begin( void )
+{
+    bool result = true;
+
+    if (m_lock == NULL)
+    {
+        m_lock = xSemaphoreCreateMutex();
+        m_checkpointLock = xSemaphoreCreateMutex();
+
+        //create the task that will read from the SD card
+        if (xTaskCreate(
+                        TaskFunctionAdapter,        /* Task function. */
+                        "SD Read Ahead",            /* String with name of task. */
+                        6 * 1024,                   /* Stack size in bytes (ESP-IDF), FatFs, the log and the checkpoints need it */
+                        this,                       /* Parameter passed as input of the task */
+                        2,                          /* Priority of the task (above the player). */
+                        &m_handle) != pdPASS)       /* Task handle. */
+        {
+            ESP_LOGE(TAG, "Could not create read ahead task");
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+
+void SdReadAhead::start(File *pFile, uint8_t *pBuffer, uint32_t bufferSize, uint32_t endPosition)
+{
+    stop();
+
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    m_pFile         = pFile;
+    m_endPosition   = endPosition;
+    m_buffer.attach(pBuffer, bufferSize);
+
+    m_consumed      = 0;
+    m_produced      = 0;
+    m_trackBase     = 0;
+    m_eof           = false;
+    m_starved       = false;
+    m_bitrate       = 0;
+
+    m_startPosition = m_pFile->position();
+    m_active        = true;
+
+    xSemaphoreGive(m_lock);
+
+    // fill the buffer right now
+    xTaskNotifyGive(m_handle);
+}
+
+
+void SdReadAhead::stop( void )
+{
+    if (m_lock == NULL)
+    {
+        return;
+    }
+
+    m_active = false;
+
+    // wait until the producer is done with the file
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+
+    m_pFile         = NULL;
+    m_pNextFile     = NULL;
+    m_switchPending = false;
+    m_buffer.reset();
+
+    // the caller saves the final position, an older checkpoint must not follow it
+    xSemaphoreTake(m_checkpointLock, portMAX_DELAY);
+    m_checkpointPending = false;
+    xSemaphoreGive(m_checkpointLock);
+
+    xSemaphoreGive(m_lock);
+}
+
+
+bool SdReadAhead::readyForNext( void )
+{
+    return (m_active && m_eof && (m_pNextFile == NULL) && !m_switchPending);
+}
+
+
+bool SdReadAhead::queueNext(File *pFile, uint32_t endPosition)
+{
+    if (!readyForNext())
+    {
+        return false;
+    }
+
+    m_nextEndPosition   = endPosition;
+    m_pNextFile         = pFile;                    // the producer takes it from here
+
+    xTaskNotifyGive(m_handle);
+
+    return true;
+}
+
+
+uint32_t SdReadAhead::peek(uint8_t **ppData, uint32_t maxLength)
+{
+    uint32_t length = m_active ? m_buffer.peek(ppData) : 0;
+
+    if (length == 0)
+    {
+        // count every gap only once (but not the initial fill)
+        if (m_active && !m_eof && !m_starved && (m_consumed != 0))
+        {
+            m_starved = true;
+            m_underruns++;
+            ESP_LOGW(TAG, "Read ahead buffer underrun (%u)", m_underruns);
+        }
+        return 0;
+    }
+
+    m_starved = false;
+
+    // stop at the file boundary, so the consumer sees the track change
+    if (m_switchPending && (m_consumed < m_boundary) && (length > (m_boundary - m_consumed)))
+    {
+        length = m_boundary - m_consumed;
+    }
+
+    if (length > maxLength)
+    {
+        length = maxLength;
+    }
+
+    return length;
+}
+
+
+void SdReadAhead::consume(uint32_t length)
+{
+    m_buffer.commitRead(length);
+    m_consumed += length;
+
+    // wake up the producer as soon as we drop below the target
+    if (fillLevel() < targetLevel())
+    {
+        xTaskNotifyGive(m_handle);
+    }
+}
+
+
+uint32_t SdReadAhead::available( void )
+{
+    return fillLevel();
+}
+
+
+bool SdReadAhead::endOfFile( void )
+{
+    return (m_eof && (m_pNextFile == NULL) && !m_switchPending && (fillLevel() == 0));
+}
+
+
+bool SdReadAhead::trackChanged( void )
+{
+    if (m_switchPending && (m_consumed >= m_boundary))
+    {
+        m_trackBase     = m_boundary;
+        m_startPosition = m_nextStartPosition;
+        m_switchPending = false;
+
+        return true;
+    }
+
+    return false;
+}
+
+
+uint32_t SdReadAhead::position( void )
+{
+    return m_startPosition + (m_consumed - m_trackBase);
+}
+
+
+void SdReadAhead::setBufferTarget(uint32_t milliSeconds)
+{
+    m_targetTime = milliSeconds;
+}
+
+
+void SdReadAhead::setWakeup(SemaphoreHandle_t wakeup)
+{
+    m_wakeup = wakeup;
+}
+
+
+void SdReadAhead::checkpoint(ResumeStore *pStore, String &mediaPath, uint32_t position, uint16_t entry)
+{
+    //without the producer there is nobody to hand it to
+    if (m_checkpointLock == NULL)
+    {
+        pStore->save(mediaPath, position, entry);
+        return;
+    }
+
+    xSemaphoreTake(m_checkpointLock, portMAX_DELAY);
+    m_pCheckpointStore      = pStore;
+    m_checkpointPath        = mediaPath;
+    m_checkpointPosition    = position;
+    m_checkpointEntry       = entry;
+    m_checkpointPending     = true;
+    xSemaphoreGive(m_checkpointLock);
+
+    xTaskNotifyGive(m_handle);
+}
+
+
+void SdReadAhead::saveCheckpoint( void )
+{
+    ResumeStore *pStore;
+    String      path;
+    uint32_t    position;
+    uint16_t    entry;
+
+    if (!m_checkpointPending)
+    {
+        return;
+    }
+
+    xSemaphoreTake(m_checkpointLock, portMAX_DELAY);
+    pStore              = m_pCheckpointStore;
+    path                = m_checkpointPath;
+    position            = m_checkpointPosition;
+    entry               = m_checkpointEntry;
+    m_checkpointPending = false;
+    xSemaphoreGive(m_checkpointLock);
+
+    pStore->save(path, position, entry);
+}
+
+
+uint32_t SdReadAhead::getBitrate( void )
+{
+    return m_bitrate;
+}
+
+
+uint32_t SdReadAhead::getUnderruns( void )
+{
+    return m_underruns;
+}
+
+
+uint32_t SdReadAhead::getStackLeft( void )
+{
+    return (m_handle != NULL) ? uxTaskGetStackHighWaterMark(m_handle) : 0;
+}
+
+
+uint32_t SdReadAhead::getMaxReadTime( void )
+{
+    return m_maxReadTime;
+}
+
+
+uint32_t SdReadAhead::getReadTimePercentile(uint32_t percent)
+{
+    uint32_t total = 0;
+    uint32_t sum   = 0;
+
+    for (uint32_t bucket = 0; bucket < READ_TIME_BUCKETS; bucket++)
+    {
+        total += m_readTimeHistogram[bucket];
+    }
+
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    // find the bucket that contains the requested percentile and return its upper limit
+    for (uint32_t bucket = 0; bucket < READ_TIME_BUCKETS; bucket++)
+    {
+        sum += m_readTimeHistogram[bucket];
+
+        if ((sum * 100) >= (total * percent))
+        {
+            return (bucket < (READ_TIME_BUCKETS - 1)) ? (1 << bucket) : m_maxReadTime;
+        }
+    }
+
+    return m_maxReadTime;
+}
+
+
+void SdReadAhead::resetStatistics( void )
+{
+    m_underruns     = 0;
+    m_maxReadTime   = 0;
+
+    memset(m_readTimeHistogram, 0, sizeof(m_readTimeHistogram));
+}
+
+
+uint32_t SdReadAhead::fillLevel( void )
+{
+    return m_buffer.available();
+}
+
+
+uint32_t SdReadAhead::targetLevel( void )
+{
+    uint32_t bitrate    = (m_bitrate != 0) ? m_bitrate : DEFAULT_BITRATE;
+    uint32_t target     = (m_targetTime * bitrate) / 8;         // kbit/s * ms / 8 = bytes
+
+    // we need at least room for one block to refill
+    if (target > (m_buffer.capacity() - READ_BLOCK_SIZE))
+    {
+        target = m_buffer.capacity() - READ_BLOCK_SIZE;
+    }
+
+    return target;
+}
+
+
+bool SdReadAhead::readBlock( void )
+{
+    uint8_t  *pTarget;
+    uint32_t length     = m_buffer.writeSpan(&pTarget);     // only the contiguous part
+    uint32_t startTime;
+    uint32_t readTime;
+    uint32_t position;
+    uint32_t bucket;
+    uint32_t fillBefore;
+    int32_t  bytesRead;
+
+    if (length > READ_BLOCK_SIZE)
+    {
+        length = READ_BLOCK_SIZE;
+    }
+
+    // don't feed the trailing tag to the decoder
+    position = m_pFile->position();
+    if (position >= m_endPosition)
+    {
+        ESP_LOGD(TAG, "End of file reached");
+        m_eof = true;
+
+        // the consumer has to see the end (and queue the next file)
+        if (m_wakeup != NULL)
+        {
+            xSemaphoreGive(m_wakeup);
+        }
+        return false;
+    }
+
+    if (length > (m_endPosition - position))
+    {
+        length = m_endPosition - position;
+    }
+
+    // after a (resume) seek the file is not sector aligned, realign with the first read
+    if ((position % SECTOR_SIZE) && (length > (SECTOR_SIZE - (position % SECTOR_SIZE))))
+    {
+        length = SECTOR_SIZE - (position % SECTOR_SIZE);
+    }
+
+    if (length == 0)
+    {
+        return false;
+    }
+
+    // the decoder still gets the bus in between two reads
+    SpiBus::acquire(SpiBus::DEVICE_SDCARD);
+
+    startTime = millis();
+    bytesRead = m_pFile->read(pTarget, length);
+    readTime  = millis() - startTime;
+
+    SpiBus::release(SpiBus::DEVICE_SDCARD);
+
+    // log2 histogram of the read time
+    bucket = 0;
+    while ((bucket < (READ_TIME_BUCKETS - 1)) && (readTime >= (uint32_t)(1 << bucket)))
+    {
+        bucket++;
+    }
+    m_readTimeHistogram[bucket]++;
+
+    if (readTime > m_maxReadTime)
+    {
+        m_maxReadTime = readTime;
+        ESP_LOGD(TAG, "Slowest SD read so far: %u ms", readTime);
+    }
+
+    if (bytesRead <= 0)
+    {
+        ESP_LOGD(TAG, "End of file reached");
+        m_eof = true;
+
+        if (m_wakeup != NULL)
+        {
+            xSemaphoreGive(m_wakeup);
+        }
+        return false;
+    }
+
+    if (m_bitrate == 0)
+    {
+        m_bitrate = frameBitrate(pTarget, bytesRead);
+    }
+
+    fillBefore = fillLevel();
+
+    m_buffer.commitWrite(bytesRead);
+    m_produced += bytesRead;
+
+    // a consumer that ran dry sleeps until it gets enough to feed the decoder again
+    if ((m_wakeup != NULL) && (fillBefore < WAKE_LEVEL) && ((fillBefore + bytesRead) >= WAKE_LEVEL))
+    {
+        xSemaphoreGive(m_wakeup);
+    }
+
+    return true;
+}
+
+
+void SdReadAhead::switchFile( void )
+{
+    ESP_LOGD(TAG, "Continue with the next file after %u bytes", m_produced);
+
+    // the boundary must be known before the first byte of the next file is visible
+    m_nextStartPosition = m_pNextFile->position();
+    m_boundary          = m_produced;
+    m_switchPending     = true;
+
+    m_pFile             = m_pNextFile;
+    m_endPosition       = m_nextEndPosition;
+    m_pNextFile         = NULL;
+    m_eof               = false;
+}
+
+
+uint32_t SdReadAhead::frameBitrate(const uint8_t *pData, uint32_t length)
+{
+    Mp3FrameIndex::FrameHeader_s header;
+
+    for (uint32_t counter = 0; (counter + 3) < length; counter++)
+    {
+        if (Mp3FrameIndex::parseHeader(&pData[counter], &header))
+        {
+            return header.Bitrate;
+        }
+    }
+
+    return 0;
+}
+
+
+void SdReadAhead::TaskFunctionAdapter(void *pvParameters)
+{
+    SdReadAhead *readAhead = static_cast<SdReadAhead *>(pvParameters);
+
+    readAhead->Run();
+
+    vTaskDelete(readAhead->m_handle);
+}
+
+
+void SdReadAhead::Run( void )
+{
+    while (true)
+    {
+        // sleep until the consumer needs more data (or the period is over)
+        ulTaskNotifyTake(pdTRUE, PRODUCER_PERIOD);
+
+        xSemaphoreTake(m_lock, portMAX_DELAY);
+
+        // continue with the queued file (gapless playlists)
+        if (m_active && m_eof && (m_pNextFile != NULL) && !m_switchPending)
+        {
+            switchFile();
+        }
+
+        // refill completely once we have dropped below the target
+        if (m_active && !m_eof && (fillLevel() < targetLevel()))
+        {
+            while (m_active && !m_eof && (m_buffer.space() >= SECTOR_SIZE))
+            {
+                if (!readBlock())
+                {
+                    break;
+                }
+            }
+        }
+
+        // after the refill, the decoder has the most data then (stop() waits for it)
+        saveCheckpoint();
+
+        xSemaphoreGive(m_lock);
+    }
+}
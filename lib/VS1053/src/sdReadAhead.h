@@ -0,0 +1,114 @@
+#ifndef _SD_READ_AHEAD_H
+    #define _SD_READ_AHEAD_H
+
+    #include "Arduino.h"
+    #include "SD.h"
+    #include "FS.h"
+
+    #include "spscRingBuffer.h"
+    #include "resumeStore.h"
+
+
+    // Keeps a buffer in front of the decoder filled from the SD card.
+    //
+    // A separate (producer) task reads the file in multiples of the SD sector size, the player
+    // (consumer) only takes the data out of the buffer. A slow SD access (FAT cluster walk,
+    // card internal garbage collection, ...) is absorbed by the buffer instead of the audio path.
+    //
+    // For gapless playlists the next file could be queued as soon as the actual one is read
+    // completely. The producer continues with it in the same buffer and remembers the boundary,
+    // trackChanged() tells the consumer when it has crossed it.
+    //
+    // The resume checkpoints of the player are written by the producer as well, an SD write
+    // stall must not hold up the task that feeds the decoder.
+    class SdReadAhead
+    {
+        public:
+            SdReadAhead();
+            ~SdReadAhead();
+
+            bool        begin( void );                                          // create the producer task
+
+            void        start(File *pFile, uint8_t *pBuffer, uint32_t bufferSize, uint32_t endPosition);  // read ahead the given (opened) file
+            void        stop( void );                                           // stop reading, the file is not touched anymore
+
+            bool        readyForNext( void );                                   // actual file read completely, nothing queued
+            bool        queueNext(File *pFile, uint32_t endPosition);           // continue with this (opened) file without a gap
+
+            // consumer interface (never blocks)
+            uint32_t    peek(uint8_t **ppData, uint32_t maxLength);             // contiguous data ready to be sent
+            void        consume(uint32_t length);                               // remove data returned by peek()
+            uint32_t    available( void );
+            bool        endOfFile( void );                                      // file completely read and buffer empty
+            bool        trackChanged( void );                                   // true once the consumer reached the queued file
+            uint32_t    position( void );                                       // file position of the next byte for the consumer
+
+            void        setBufferTarget(uint32_t milliSeconds);                 // refill as soon as less audio is buffered
+            void        setWakeup(SemaphoreHandle_t wakeup);                    // given when data (or the end) is there for the consumer
+            void        checkpoint(ResumeStore *pStore, String &mediaPath, uint32_t position, uint16_t entry);     // saved by the producer
+            uint32_t    getBitrate( void );                                     // kbit/s of the actual file (0 if unknown)
+            uint32_t    getUnderruns( void );
+            uint32_t    getMaxReadTime( void );                                 // longest single SD read in ms
+            uint32_t    getStackLeft( void );                                   // bytes the producer task never used
+            uint32_t    getReadTimePercentile(uint32_t percent);                // upper bound of the SD read time in ms
+            void        resetStatistics( void );
+
+        private:
+            const uint32_t      READ_BLOCK_SIZE     = 4096;                     // bytes per SD read (8 sectors)
+            const uint32_t      SECTOR_SIZE         = 512;
+            const uint32_t      DEFAULT_BITRATE     = 128;                      // kbit/s until the first frame header is seen
+            const TickType_t    PRODUCER_PERIOD     = pdMS_TO_TICKS(20);        // max. sleep time of the producer
+            const uint32_t      WAKE_LEVEL          = 2048;                     // wake the consumer above this (one decoder FIFO)
+
+            TaskHandle_t        m_handle;
+            SemaphoreHandle_t   m_lock;                                         // held by the producer while using the file
+            SemaphoreHandle_t   m_wakeup;                                       // consumer waits for it (optional)
+
+            File                *m_pFile;
+            File                *m_pNextFile;                                   // queued by the consumer, taken at the end of m_pFile
+            uint32_t            m_endPosition;                                  // audio data of m_pFile ends here (ID3v1 tag)
+            uint32_t            m_nextEndPosition;
+            SpscRingBuffer<uint8_t> m_buffer;                                   // filled by the producer, drained by the player
+
+            uint32_t            m_consumed;                                     // bytes consumed by the player since start()
+            uint32_t            m_produced;                                     // bytes put into the buffer since start()
+            uint32_t            m_boundary;                                     // m_produced when the producer switched files
+            uint32_t            m_trackBase;                                    // m_consumed at the start of the actual file
+            uint32_t            m_nextStartPosition;                            // file position of the queued file at the boundary
+            volatile bool       m_switchPending;                                // producer switched, consumer is not there yet
+            volatile bool       m_active;
+            volatile bool       m_eof;
+            volatile bool       m_starved;                                      // consumer found the buffer empty
+
+            SemaphoreHandle_t   m_checkpointLock;                               // hand over of the checkpoint below
+            ResumeStore         *m_pCheckpointStore;
+            String              m_checkpointPath;
+            uint32_t            m_checkpointPosition;
+            uint16_t            m_checkpointEntry;
+            volatile bool       m_checkpointPending;
+
+            uint32_t            m_startPosition;                                // file position at start()
+            uint32_t            m_targetTime;                                   // refill threshold in ms
+            uint32_t            m_bitrate;
+
+            static const uint32_t READ_TIME_BUCKETS = 12;                       // <1ms, <2ms, <4ms, ... <1024ms, more
+
+            uint32_t            m_underruns;
+            uint32_t            m_maxReadTime;
+            uint32_t            m_readTimeHistogram[READ_TIME_BUCKETS];
+
+            uint32_t    fillLevel( void );
+            uint32_t    targetLevel( void );
+            bool        readBlock( void );
+            void        switchFile( void );
+            void        saveCheckpoint( void );
+
+            static uint32_t frameBitrate(const uint8_t *pData, uint32_t length);
+
+            //
+            void Run( void );
+
+            static void TaskFunctionAdapter(void *pvParameters);
+    };
+
+#endif
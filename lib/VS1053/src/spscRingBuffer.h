@@ -0,0 +1,190 @@
+#ifndef _SPSC_RING_BUFFER_H
+    #define _SPSC_RING_BUFFER_H
+
+    #include <stdint.h>
+    #include <atomic>
+
+
+    // Lock free ring buffer for exactly one producer and one consumer task.
+    //
+    // The storage is handed in with attach(), so the buffer itself could live wherever the
+    // caller wants it. Both sides work on contiguous spans: the producer asks for free space
+    // with writeSpan(), fills it and publishes it with commitWrite(). The consumer gets the
+    // data with peek() and releases it with commitRead(). Each index is only written by its
+    // owner, the release/acquire pairs make sure the data is visible before the index.
+    //
+    // The indices run from 0 to 2 * capacity, so "full" and "empty" can be told apart and
+    // every capacity (not only powers of two) could be used.
+    template <typename T>
+    class SpscRingBuffer
+    {
+        public:
+            SpscRingBuffer() : m_pStorage(nullptr), m_capacity(0), m_writeIndex(0), m_readIndex(0)
+            {
+            }
+
+            // use the given memory, must only be called while both sides are idle
+            void attach(T *pStorage, uint32_t capacity)
+            {
+                m_pStorage  = pStorage;
+                m_capacity  = capacity;
+                reset();
+            }
+
+            // drop all content, must only be called while both sides are idle
+            void reset( void )
+            {
+                m_writeIndex.store(0, std::memory_order_relaxed);
+                m_readIndex.store(0, std::memory_order_relaxed);
+            }
+
+            uint32_t capacity( void ) const
+            {
+                return m_capacity;
+            }
+
+            uint32_t available( void ) const
+            {
+                return used(m_writeIndex.load(std::memory_order_acquire), m_readIndex.load(std::memory_order_acquire));
+            }
+
+            uint32_t space( void ) const
+            {
+                return m_capacity - available();
+            }
+
+            //-------------------------------------------------------------------------------
+            // producer side
+
+            // contiguous free space (may be less than space() at the end of the storage)
+            uint32_t writeSpan(T **ppData) const
+            {
+                uint32_t writeIndex = m_writeIndex.load(std::memory_order_relaxed);
+                uint32_t offset     = position(writeIndex);
+                uint32_t length     = m_capacity - used(writeIndex, m_readIndex.load(std::memory_order_acquire));
+
+                if (length > (m_capacity - offset))
+                {
+                    length = m_capacity - offset;
+                }
+
+                *ppData = m_pStorage + offset;
+
+                return length;
+            }
+
+            // publish data written into the span returned by writeSpan()
+            void commitWrite(uint32_t length)
+            {
+                m_writeIndex.store(advance(m_writeIndex.load(std::memory_order_relaxed), length), std::memory_order_release);
+            }
+
+            // copy as much as possible into the buffer
+            uint32_t write(const T *pData, uint32_t length)
+            {
+                uint32_t written = 0;
+                T        *pSpan;
+                uint32_t span;
+
+                while ((written < length) && ((span = writeSpan(&pSpan)) != 0))
+                {
+                    if (span > (length - written))
+                    {
+                        span = length - written;
+                    }
+
+                    for (uint32_t counter = 0; counter < span; counter++)
+                    {
+                        pSpan[counter] = pData[written + counter];
+                    }
+
+                    commitWrite(span);
+                    written += span;
+                }
+
+                return written;
+            }
+
+            //-------------------------------------------------------------------------------
+            // consumer side
+
+            // contiguous data (may be less than available() at the end of the storage)
+            uint32_t peek(T **ppData) const
+            {
+                uint32_t readIndex  = m_readIndex.load(std::memory_order_relaxed);
+                uint32_t offset     = position(readIndex);
+                uint32_t length     = used(m_writeIndex.load(std::memory_order_acquire), readIndex);
+
+                if (length > (m_capacity - offset))
+                {
+                    length = m_capacity - offset;
+                }
+
+                *ppData = m_pStorage + offset;
+
+                return length;
+            }
+
+            // release data returned by peek()
+            void commitRead(uint32_t length)
+            {
+                m_readIndex.store(advance(m_readIndex.load(std::memory_order_relaxed), length), std::memory_order_release);
+            }
+
+            // copy as much as possible out of the buffer
+            uint32_t read(T *pData, uint32_t length)
+            {
+                uint32_t done = 0;
+                T        *pSpan;
+                uint32_t span;
+
+                while ((done < length) && ((span = peek(&pSpan)) != 0))
+                {
+                    if (span > (length - done))
+                    {
+                        span = length - done;
+                    }
+
+                    for (uint32_t counter = 0; counter < span; counter++)
+                    {
+                        pData[done + counter] = pSpan[counter];
+                    }
+
+                    commitRead(span);
+                    done += span;
+                }
+
+                return done;
+            }
+
+        private:
+            T                       *m_pStorage;
+            uint32_t                m_capacity;
+
+            std::atomic<uint32_t>   m_writeIndex;           // 0 .. 2*capacity-1, written by the producer only
+            std::atomic<uint32_t>   m_readIndex;            // 0 .. 2*capacity-1, written by the consumer only
+
+            uint32_t used(uint32_t writeIndex, uint32_t readIndex) const
+            {
+                return (writeIndex >= readIndex) ? (writeIndex - readIndex) : (writeIndex + (2 * m_capacity) - readIndex);
+            }
+
+            uint32_t position(uint32_t index) const
+            {
+                return (index < m_capacity) ? index : (index - m_capacity);
+            }
+
+            uint32_t advance(uint32_t index, uint32_t length) const
+            {
+                index += length;
+
+                if (index >= (2 * m_capacity))
+                {
+                    index -= (2 * m_capacity);
+                }
+
+                return index;
+            }
+    };
+
+#endif
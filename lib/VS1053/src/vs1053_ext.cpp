@@ -1,6 +1,10 @@
 #include "vs1053_ext.h"
 
 #include "SystemEventFlags.h"
+#include "spiBus.h"
+#include "latencyTrace.h"
+
+#include "esp_heap_caps.h"
 
 #ifdef ARDUINO_ARCH_ESP32
     #include "esp32-hal-log.h"
@@ -15,26 +19,79 @@ VS1053::VS1053(uint8_t _cs_pin, uint8_t _dcs_pin, uint8_t _dreq_pin) :
     curvol=50;
     m_t0=0;
     m_LFcount=0;
+    m_dreqSemaphore=NULL;
+    m_clockf=0;
+    m_spiClock=0;
+    m_sciShadowValid=0;
+    resetStatistics();
 }
 VS1053::~VS1053()
 {
     // destructor
+    if(m_dreqSemaphore)
+    {
+        detachInterrupt(dreq_pin);
+        vSemaphoreDelete(m_dreqSemaphore);
+    }
+    releaseStreamBuffer();
+}
+//---------------------------------------------------------------------------------------
+void IRAM_ATTR VS1053::dreq_isr(void *arg)
+{
+    VS1053     *pPlayer = static_cast<VS1053 *>(arg);
+    BaseType_t  higherPriorityTaskWoken = pdFALSE;
+
+    // DREQ went HIGH, there is room for at least 32 bytes in the decoder FIFO again
+    // (only for wait_data_request(), waking the caller of loop() for every 32 bytes would cost more than it feeds)
+    xSemaphoreGiveFromISR(pPlayer->m_dreqSemaphore, &higherPriorityTaskWoken);
+
+    if(higherPriorityTaskWoken)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+//---------------------------------------------------------------------------------------
+void VS1053::wait_data_request()
+{
+    // Without the interrupt (begin() not called yet) we can only poll the pin
+    if(m_dreqSemaphore == NULL)
+    {
+        await_data_request();
+        return;
+    }
+
+    uint32_t waitStart = micros();
+
+    // The semaphore may still hold an old edge, so check the pin after every wake up.
+    // The timeout only protects us against a lost edge.
+    while(!data_request())
+    {
+        xSemaphoreTake(m_dreqSemaphore, m_dreqTimeout);
+    }
+
+    m_stats.DreqWaits++;
+    m_stats.DreqWaitTime+=micros() - waitStart;
 }
 //---------------------------------------------------------------------------------------
 void VS1053::control_mode_on()
 {
-    SPI.beginTransaction(VS1053_SPI);           // Prevent other SPI users
+    SpiBus::acquire(SpiBus::DEVICE_AUDIO);      // Audio goes first on the shared bus
+    SPI.beginTransaction(SpiBus::settings(SpiBus::DEVICE_AUDIO));
+    m_stats.SciTransactions++;
     DCS_HIGH();                                 // Bring slave in control mode
     CS_LOW();
 }
 void VS1053::control_mode_off()
 {
     CS_HIGH();                                  // End control mode
-    SPI.endTransaction();                       // Allow other SPI users
+    SPI.endTransaction();
+    SpiBus::release(SpiBus::DEVICE_AUDIO);      // Allow other SPI users
 }
 void VS1053::data_mode_on()
 {
-    SPI.beginTransaction(VS1053_SPI);           // Prevent other SPI users
+    SpiBus::acquire(SpiBus::DEVICE_AUDIO);      // Audio goes first on the shared bus
+    SPI.beginTransaction(SpiBus::settings(SpiBus::DEVICE_AUDIO));
+    m_stats.SdiTransactions++;
     CS_HIGH();                                  // Bring slave in data mode
     DCS_LOW();
 }
@@ -42,10 +99,20 @@ void VS1053::data_mode_off()
 {
     //digitalWrite(dcs_pin, HIGH);              // End data mode
     DCS_HIGH();
-    SPI.endTransaction();                       // Allow other SPI users
+    SPI.endTransaction();
+    SpiBus::release(SpiBus::DEVICE_AUDIO);      // Allow other SPI users
 }
 //---------------------------------------------------------------------------------------
 uint16_t VS1053::read_register(uint8_t _reg)
+{
+    if(sci_cacheable(_reg) && (m_sciShadowValid & (1 << _reg))){
+        m_stats.SciReadsCached++;
+        return m_sciShadow[_reg];                // No need to bother the bus
+    }
+    return read_register_raw(_reg);
+}
+//---------------------------------------------------------------------------------------
+uint16_t VS1053::read_register_raw(uint8_t _reg)
 {
     uint16_t result=0;
     control_mode_on();
@@ -55,6 +122,7 @@ uint16_t VS1053::read_register(uint8_t _reg)
     result=(SPI.transfer(0xFF) << 8) | (SPI.transfer(0xFF));  // Read 16 bits data
     await_data_request();                        // Wait for DREQ to be HIGH again
     control_mode_off();
+    sci_shadow_update(_reg, result);
     return result;
 }
 //---------------------------------------------------------------------------------------
@@ -66,6 +134,34 @@ void VS1053::write_register(uint8_t _reg, uint16_t _value)
     SPI.write16(_value);                         // Send 16 bits data
     await_data_request();
     control_mode_off();
+    sci_shadow_update(_reg, _value);
+}
+//---------------------------------------------------------------------------------------
+void VS1053::write_registers(const SciWrite_s *writes, uint8_t count)
+{
+    uint8_t i;
+
+    control_mode_on();                           // One bus transaction for all of them
+    for(i=0; i < count; i++){
+        if(i){
+            CS_HIGH();                           // Every SCI command needs its own xCS cycle
+            CS_LOW();
+        }
+        SPI.write(2);                            // Write operation
+        SPI.write(writes[i].Register);           // Register to write (0..0xF)
+        SPI.write16(writes[i].Value);            // Send 16 bits data
+        await_data_request();
+        sci_shadow_update(writes[i].Register, writes[i].Value);
+    }
+    control_mode_off();
+}
+//---------------------------------------------------------------------------------------
+void VS1053::sci_shadow_update(uint8_t _reg, uint16_t _value)
+{
+    if(sci_cacheable(_reg)){
+        m_sciShadow[_reg]=_value;
+        m_sciShadowValid|=(1 << _reg);
+    }
 }
 //---------------------------------------------------------------------------------------
 void VS1053::sdi_send_buffer(uint8_t* data, size_t len)
@@ -75,7 +171,34 @@ void VS1053::sdi_send_buffer(uint8_t* data, size_t len)
     data_mode_on();
     while(len){                                  // More to do?
 
-        await_data_request();                    // Wait for space available
+        if(!data_request()){                     // Decoder FIFO full?
+            data_mode_off();                     // Give the bus to other SPI users meanwhile
+            wait_data_request();                 // Sleep until there is space available
+            data_mode_on();
+        }
+        chunk_length=len;
+        if(len > vs1053_chunk_size){
+            chunk_length=vs1053_chunk_size;
+        }
+        len-=chunk_length;
+        SPI.writeBytes(data, chunk_length);
+        data+=chunk_length;
+        m_stats.BytesFed+=chunk_length;
+    }
+    data_mode_off();
+}
+//---------------------------------------------------------------------------------------
+size_t VS1053::sdi_send_available(uint8_t* data, size_t len)
+{
+    size_t chunk_length;                         // Length of chunk 32 byte or shorter
+    size_t sent=0;                               // Bytes accepted by the decoder
+
+    if(!data_request()){                         // Decoder FIFO full, nothing to do
+        return 0;
+    }
+
+    data_mode_on();
+    while(len && data_request()){                // More to do and space available?
         chunk_length=len;
         if(len > vs1053_chunk_size){
             chunk_length=vs1053_chunk_size;
@@ -83,8 +206,11 @@ void VS1053::sdi_send_buffer(uint8_t* data, size_t len)
         len-=chunk_length;
         SPI.writeBytes(data, chunk_length);
         data+=chunk_length;
+        sent+=chunk_length;
     }
     data_mode_off();
+    m_stats.BytesFed+=sent;
+    return sent;
 }
 //---------------------------------------------------------------------------------------
 void VS1053::sdi_send_fillers(size_t len)
@@ -94,7 +220,11 @@ void VS1053::sdi_send_fillers(size_t len)
     data_mode_on();
     while(len)                                   // More to do?
     {
-        await_data_request();                    // Wait for space available
+        if(!data_request()){                     // Decoder FIFO full?
+            data_mode_off();                     // Give the bus to other SPI users meanwhile
+            wait_data_request();                 // Sleep until there is space available
+            data_mode_on();
+        }
         chunk_length=len;
         if(len > vs1053_chunk_size){
             chunk_length=vs1053_chunk_size;
@@ -108,9 +238,9 @@ void VS1053::sdi_send_fillers(size_t len)
 }
 //---------------------------------------------------------------------------------------
 void VS1053::wram_write(uint16_t address, uint16_t data){
+    const SciWrite_s writes[]={{SCI_WRAMADDR, address}, {SCI_WRAM, data}};
 
-    write_register(SCI_WRAMADDR, address);
-    write_register(SCI_WRAM, data);
+    write_registers(writes, 2);
 }
 //---------------------------------------------------------------------------------------
 uint16_t VS1053::wram_read(uint16_t address){
@@ -122,6 +252,14 @@ uint16_t VS1053::wram_read(uint16_t address){
 void VS1053::begin()
 {
     pinMode(dreq_pin, INPUT);                          // DREQ is an input
+
+    // wait_data_request() sleeps until the next rising DREQ edge instead of polling the pin
+    // (the player loop is not woken by it, the timer refills the FIFO in batches)
+    if(m_dreqSemaphore == NULL)
+    {
+        m_dreqSemaphore = xSemaphoreCreateBinary();
+        attachInterruptArg(dreq_pin, dreq_isr, this, RISING);
+    }
     pinMode(cs_pin, OUTPUT);                           // The SCI and SDI signals
     pinMode(dcs_pin, OUTPUT);
     digitalWrite(dcs_pin, HIGH);                       // Start HIGH for SCI en SDI
@@ -129,7 +267,7 @@ void VS1053::begin()
     delay(100);
 
     // Init SPI in slow mode (0.2 MHz)
-    VS1053_SPI=SPISettings(200000, MSBFIRST, SPI_MODE0);
+    SpiBus::setProfile(SpiBus::DEVICE_AUDIO, m_spiSlow, SPI_MODE0);
     ESP_LOGV(TAG, "Right after reset/startup");
 
     delay(20);
@@ -141,19 +279,126 @@ void VS1053::begin()
     delay(100);
     //printDetails ("After test loop");
     softReset();                                       // Do a soft reset
+    // Raise the clock multiplier and the SPI clock as far as the module allows
+    calibrateClocks();
     // Switch on the analog parts
-    write_register(SCI_AUDATA, 44100 + 1);             // 44.1kHz + stereo
-    // The next clocksetting allows SPI clocking at 5 MHz, 4 MHz is safe then.
-    write_register(SCI_CLOCKF, 6 << 12);               // Normal clock settings multiplyer 3.0=12.2 MHz
-    //SPI Clock to 4 MHz. Now you can set high speed SPI clock.
-    VS1053_SPI=SPISettings(4000000, MSBFIRST, SPI_MODE0);
-    write_register(SCI_MODE, _BV (SM_SDINEW) | _BV(SM_LINE1));
+    const SciWrite_s writes[]={{SCI_AUDATA, 44100 + 1},                    // 44.1kHz + stereo
+                               {SCI_MODE, (uint16_t)(_BV (SM_SDINEW) | _BV(SM_LINE1))}};
+    write_registers(writes, 2);
     //testComm("Fast SPI, Testing VS1053 read/write registers again... \n");
     delay(10);
     await_data_request();
     m_endFillByte=wram_read(0x1E06) & 0xFF;
     ESP_LOGD(TAG, "endFillByte is 0x%X", m_endFillByte);
     delay(100);
+
+    m_readAhead.begin();                               // SD card reading task
+    m_resumeStore.begin();                             // Positions of all media
+}
+//---------------------------------------------------------------------------------------
+void VS1053::calibrateClocks()
+{
+    Preferences prefs;
+    uint16_t    clockf;
+    uint32_t    spiClock;
+
+    prefs.begin(m_nvsNamespace, false);
+    clockf=prefs.getUShort("clockf", 0);
+    spiClock=prefs.getUInt("spi", 0);
+
+    if(clockf && spiClock){
+        if(applyClocks(clockf, spiClock)){
+            ESP_LOGI(TAG, "Using stored clocks, CLOCKF 0x%04X, SPI %u Hz", m_clockf, m_spiClock);
+            prefs.end();
+            return;
+        }
+        ESP_LOGW(TAG, "Stored clocks (CLOCKF 0x%04X, SPI %u Hz) failed, probing again", clockf, spiClock);
+    }
+
+    probeClocks();
+
+    prefs.putUShort("clockf", m_clockf);
+    prefs.putUInt("spi", m_spiClock);
+    prefs.end();
+}
+//---------------------------------------------------------------------------------------
+void VS1053::probeClocks()
+{
+    // Clock multipliers from 4.5x down to the default 3.0x, SPI clocks in the steps the ESP32 can divide 80 MHz
+    const uint16_t clockfSteps[]={0xC000, 0xA000, 0x8000, 0x6000};
+    const uint32_t spiSteps[]={5000000, 5714285, 6666666, 8000000, 10000000};
+    uint32_t startTime=millis();
+    uint8_t  i, j;
+
+    for(i=0; i < sizeof(clockfSteps) / sizeof(clockfSteps[0]); i++){
+        uint32_t best=m_spiDefault;
+
+        if(!applyClocks(clockfSteps[i], m_spiDefault)){
+            ESP_LOGD(TAG, "CLOCKF 0x%04X failed", clockfSteps[i]);
+            continue;
+        }
+
+        // SCI reads are limited to CLKI/7, that is the tightest limit for the shared SPI clock
+        for(j=0; j < sizeof(spiSteps) / sizeof(spiSteps[0]); j++){
+            if(spiSteps[j] > (internalClock(clockfSteps[i]) / 7)) break;
+            if(!applyClocks(clockfSteps[i], spiSteps[j])) break;
+            best=spiSteps[j];
+        }
+
+        applyClocks(clockfSteps[i], best);
+        ESP_LOGI(TAG, "Calibrated clocks in %u ms, CLOCKF 0x%04X, SPI %u Hz", millis() - startTime, m_clockf, m_spiClock);
+        return;
+    }
+
+    // Nothing worked, stay with the settings that always worked before
+    ESP_LOGE(TAG, "Clock calibration failed, using defaults");
+    write_register(SCI_CLOCKF, m_clockfDefault);
+    SpiBus::setProfile(SpiBus::DEVICE_AUDIO, m_spiDefault, SPI_MODE0);
+    m_clockf=m_clockfDefault;
+    m_spiClock=m_spiDefault;
+}
+//---------------------------------------------------------------------------------------
+bool VS1053::applyClocks(uint16_t clockf, uint32_t spiClock)
+{
+    // Change the multiplier with a slow SPI clock, DREQ goes HIGH when the clock is stable again
+    SpiBus::setProfile(SpiBus::DEVICE_AUDIO, m_spiSlow, SPI_MODE0);
+    write_register(SCI_CLOCKF, clockf);
+    SpiBus::setProfile(SpiBus::DEVICE_AUDIO, spiClock, SPI_MODE0);
+
+    if(read_register_raw(SCI_CLOCKF) != clockf || !verifyRegisters()){
+        return false;
+    }
+    m_clockf=clockf;
+    m_spiClock=spiClock;
+    return true;
+}
+//---------------------------------------------------------------------------------------
+bool VS1053::verifyRegisters()
+{
+    // AICTRL1 is free as long as no application is loaded
+    const uint16_t patterns[]={0x0000, 0xFFFF, 0xAAAA, 0x5555, 0xA5C3, 0x3C5A, 0x0001, 0x8000};
+    bool     result=true;
+    uint8_t  round, i;
+
+    for(round=0; (round < m_verifyRounds) && result; round++){
+        for(i=0; i < sizeof(patterns) / sizeof(patterns[0]); i++){
+            write_register(SCI_AICTRL1, patterns[i]);
+            if(read_register(SCI_AICTRL1) != patterns[i]){
+                result=false;
+                break;
+            }
+        }
+    }
+    write_register(SCI_AICTRL1, 0);
+    return result;
+}
+//---------------------------------------------------------------------------------------
+uint32_t VS1053::internalClock(uint16_t clockf)
+{
+    // SC_MULT (bits 15..13): 0 = 1.0x, 1 = 2.0x, 2 = 2.5x ... 7 = 5.0x
+    uint8_t mult=clockf >> 13;
+
+    return (uint32_t)(((uint64_t)m_xtali * ((mult == 0) ? 10 : (15 + 5 * mult))) / 10);
 }
 //---------------------------------------------------------------------------------------
 void VS1053::setVolume(uint8_t vol)
@@ -225,9 +470,61 @@ void VS1053::stopSong()
     printDetails();
 }
 //---------------------------------------------------------------------------------------
+void VS1053::cancelSong()
+{
+    uint32_t startTime=micros();
+    uint32_t sent;                        // Bytes sent after SM_CANCEL was set
+    uint32_t fillers;                     // endFillBytes sent after the cancel
+
+    // Datasheet "Cancelling Playback": set SM_CANCEL and check it after every 32 bytes sent
+    write_register(SCI_MODE, _BV (SM_SDINEW) | _BV(SM_LINE1) | _BV(SM_CANCEL));
+    for(sent=0; sent < 2048; sent+=vs1053_chunk_size)
+    {
+        sdi_send_fillers(vs1053_chunk_size);
+        if((read_register(SCI_MODE) & _BV(SM_CANCEL)) == 0)
+        {
+            break;
+        }
+    }
+
+    if(sent >= 2048)
+    {
+        // Should be extremely rare, the reset takes the clock and the analog setup with it
+        uint16_t actualVolume=read_register(SCI_VOL);    // From the shadow copy
+
+        ESP_LOGW(TAG, "Cancel did not finish, resetting the decoder");
+        softReset();
+        applyClocks(m_clockf, m_spiClock);
+
+        const SciWrite_s writes[]={{SCI_AUDATA, 44100 + 1},
+                                   {SCI_MODE, (uint16_t)(_BV (SM_SDINEW) | _BV(SM_LINE1))},
+                                   {SCI_VOL, actualVolume}};
+        write_registers(writes, 3);
+    }
+    else
+    {
+        // Up to 2052 endFillBytes, but HDAT0/HDAT1 tell when the decoder is ready much earlier
+        for(fillers=0; fillers < 2052; fillers+=vs1053_chunk_size)
+        {
+            if((read_register(SCI_HDAT0) == 0) && (read_register(SCI_HDAT1) == 0))
+            {
+                break;
+            }
+            sdi_send_fillers(vs1053_chunk_size);
+        }
+        ESP_LOGD(TAG, "Song cancelled after %u bytes and %u fillers", sent + vs1053_chunk_size, fillers);
+    }
+
+    if((micros() - startTime) > m_stats.MaxCancelTime)
+    {
+        m_stats.MaxCancelTime=micros() - startTime;
+    }
+}
+//---------------------------------------------------------------------------------------
 void VS1053::softReset()
 {
     write_register(SCI_MODE, _BV (SM_SDINEW) | _BV(SM_RESET));
+    m_sciShadowValid=0;                          // Don't trust the shadow registers after a reset
     delay(10);
     await_data_request();
 }
@@ -250,10 +547,11 @@ void VS1053::printDetails()
         [12] = "AICTRL0    ", [13] = "AICTRL1    ", [14] = "AICTRL2    ", [15] = "AICTRL3    ",
     };
 
+    ESP_LOGD(TAG, "CLKI %u Hz (CLOCKF 0x%04X), SPI %u Hz", internalClock(m_clockf), m_clockf, m_spiClock);
     ESP_LOGD(TAG, "REG         Contents   bin   hex \n");
     ESP_LOGD(TAG, "----------- ---------------- ----\n");
     for(i=0; i <= SCI_AICTRL3; i++){
-        regbuf[i]=read_register(i);
+        regbuf[i]=read_register_raw(i);
     }
     for(i=0; i <= SCI_AICTRL3; i++){
         reg=regName[i]+ " ";
@@ -265,6 +563,48 @@ void VS1053::printDetails()
     }
 }
 //---------------------------------------------------------------------------------------
+void VS1053::printStatistics(bool reset)
+{
+    uint32_t elapsed=millis() - m_stats.StartTime;          // ms since the last reset
+    uint32_t samples=0;
+    uint8_t  i;
+
+    for(i=0; i < FILL_BUCKETS; i++){
+        samples+=m_stats.FillHistogram[i];
+    }
+
+    Serial.printf("Audio statistics of the last %u s\n", elapsed / 1000);
+    Serial.printf("- bytes fed          : %llu (%llu bytes/s)\n", m_stats.BytesFed, elapsed ? (m_stats.BytesFed * 1000) / elapsed : 0);
+    Serial.printf("- DREQ waits         : %u, %llu ms total\n", m_stats.DreqWaits, m_stats.DreqWaitTime / 1000);
+    Serial.printf("- underruns          : %u stream, %u SD\n", m_stats.Underruns, m_readAhead.getUnderruns());
+    Serial.printf("- longest feed gap   : %u ms\n", m_stats.MaxFeedGap / 1000);
+    Serial.printf("- SD read time       : p50 <%u ms, p90 <%u ms, p99 <%u ms, max %u ms\n",
+                  m_readAhead.getReadTimePercentile(50), m_readAhead.getReadTimePercentile(90),
+                  m_readAhead.getReadTimePercentile(99), m_readAhead.getMaxReadTime());
+    Serial.printf("- read ahead stack   : %u bytes left\n", m_readAhead.getStackLeft());
+    Serial.printf("- buffer fill level  :");
+    for(i=0; i < FILL_BUCKETS; i++){
+        Serial.printf(" %u%%", samples ? (m_stats.FillHistogram[i] * 100) / samples : 0);
+    }
+    Serial.printf(" (0..100%% in %u steps)\n", FILL_BUCKETS);
+    Serial.printf("- SPI transactions   : %u SCI, %u SDI, %u SCI reads cached\n", m_stats.SciTransactions, m_stats.SdiTransactions, m_stats.SciReadsCached);
+    Serial.printf("- track skips        : %u, avg %u ms, max %u ms (decoder cancel max %u us)\n", m_stats.Skips,
+                  m_stats.Skips ? m_stats.SkipTimeSum / m_stats.Skips : 0, m_stats.MaxSkipTime, m_stats.MaxCancelTime);
+    SpiBus::printStatistics(reset);
+    Serial.printf("- free internal RAM  : %u bytes\n", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+
+    if(reset){
+        resetStatistics();
+    }
+}
+//---------------------------------------------------------------------------------------
+void VS1053::resetStatistics()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_stats.StartTime=millis();
+    m_readAhead.resetStatistics();
+}
+//---------------------------------------------------------------------------------------
 bool VS1053::printVersion()
 {
     boolean flag=false;
@@ -724,92 +1064,139 @@ void VS1053::handlebyte(uint8_t b)
     }
 }
 //---------------------------------------------------------------------------------------
-uint16_t VS1053::ringused()
+uint32_t VS1053::ringused()
+{
+    return (m_ringbuffer.available());                      // Used space in the ringbuffer
+}
+//---------------------------------------------------------------------------------------
+void VS1053::setReadAheadTarget(uint32_t milliSeconds)
 {
-    return (m_rcount);                                      // Free space available
+    m_readAhead.setBufferTarget(milliSeconds);
 }
 //---------------------------------------------------------------------------------------
 void VS1053::loop()
 {
 
-    uint16_t part=0;                                        // part at the end of the ringbuffer
-    uint16_t bcs=0;                                         // bytes can current send
+    uint32_t part=0;                                        // part at the end of the ringbuffer
+    uint8_t  *pData=NULL;                                   // start of the part in the ringbuffer
+    uint32_t bcs=0;                                         // bytes can current send
     uint16_t maxchunk=0x1000;                               // max number of bytes to read, 4096d is enough
-    uint16_t btp=0;                                         // bytes to play
+    uint32_t btp=0;                                         // bytes to play
     int16_t  res=0;                                         // number of bytes getting from client
     uint32_t av=0;                                          // available in stream (uin16_t is to small by playing from SD)
-    static uint16_t rcount=0;                               // max bytes handover to the player
+    static uint32_t rcount=0;                               // max bytes handover to the player
     static uint16_t chunksize=0;                            // Chunkcount read from stream
     static uint16_t count=0;                                // Bytecounter between metadata
     static uint32_t i=0;                                    // Count loops if ringbuffer is empty
 
+    if(m_f_paused)                                          // Nothing to do until resume()
+    {
+        m_stats.LastFeedCall=0;                             // A pause is no gap
+        return;
+    }
+
+    if(m_f_localfile || m_f_webstream)                      // Collect the health counters
+    {
+        uint32_t now=micros();
+        uint32_t fill=(m_f_localfile) ? m_readAhead.available() : ringused();
+
+        if((m_stats.LastFeedCall != 0) && ((now - m_stats.LastFeedCall) > m_stats.MaxFeedGap))
+        {
+            m_stats.MaxFeedGap=now - m_stats.LastFeedCall;
+        }
+        m_stats.LastFeedCall=now;
+
+        if(m_ringbfsiz)
+        {
+            uint32_t bucket=(fill * FILL_BUCKETS) / m_ringbfsiz;
+            if(bucket >= FILL_BUCKETS) bucket=FILL_BUCKETS - 1;
+            m_stats.FillHistogram[bucket]++;
+        }
+    }
+    else
+    {
+        m_stats.LastFeedCall=0;                             // Pauses between songs are no gaps
+    }
+
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     if(m_f_localfile)                                       // Playing file from SD card?
     {
-        av=mp3file.available();                             // Bytes left in file
-        if(av < maxchunk) maxchunk=av;                      // Reduce byte count for this mp3loop()
-        if(maxchunk)                                        // Anything to read?
+        if(m_readAhead.trackChanged())                      // Decoder got the first byte of the next entry
         {
-            m_btp=mp3file.read(m_ringbuf, maxchunk);        // Read a block of data
-            sdi_send_buffer(m_ringbuf,m_btp);
+            m_mp3files[m_actualFile].close();
+            m_actualFile^=1;
+            m_playlist_num=m_nextPlaylistNum;
+            m_mp3title=m_nextTitle;
+
+            ESP_LOGI(TAG, "Playing next Entry from playlist \"%s\" (%s - %s)", m_mp3title.c_str(),
+                     m_tags[m_actualFile].artist().c_str(), m_tags[m_actualFile].title().c_str());
+            showstreamtitle(m_mp3title.c_str(), true);
         }
-        if(av == 0)
-        {                                                   // No more data from SD Card
-            ESP_LOGD(TAG, "End of mp3file %s",m_mp3title.c_str());
-            if(m_playlist.length()) 
+        if(m_playlist.length() && !m_playlistEnd && m_readAhead.readyForNext())
+        {
+            queueNextPlaylistEntry();                       // The buffer still plays the rest of the actual one
+        }
+
+        m_btp=m_readAhead.peek(&pData, maxchunk);           // Take a block of data
+        if(m_btp)                                           // Anything to send?
+        {
+            m_btp=sdi_send_available(pData, m_btp);         // As much as the decoder takes now
+            m_readAhead.consume(m_btp);
+
+            if(m_btp && m_skipTime)
             {
-                bool result = true;
+                uint32_t skipTime=millis() - m_skipTime;
 
-                //close the actual file
-                mp3file.close();
+                ESP_LOGI(TAG, "Skip took %u ms", skipTime);
+                m_stats.Skips++;
+                m_stats.SkipTimeSum+=skipTime;
+                if(skipTime > m_stats.MaxSkipTime) m_stats.MaxSkipTime=skipTime;
+                m_skipTime=0;
+            }
+            if(m_btp && m_openTime)
+            {
+                ESP_LOGI(TAG, "First audio after %u ms", millis() - m_openTime);
+                m_openTime=0;
 
-                //increment the entry and 
-                m_playlist_num++;
+                LatencyTrace::mark(LatencyTrace::STAGE_FIRST_DATA);
+                m_traceDecode=LatencyTrace::waiting(LatencyTrace::STAGE_DECODING);
 
-                //get next file from playlist (if it exists)
-                String nextTitle = findNextPlaylistEntry();
+                if(m_SystemFlagGroup) xEventGroupSetBits(m_SystemFlagGroup, SF_AUDIO_STARTED);
+            }
+        }
+        else if(m_readAhead.endOfFile())
+        {                                                   // No more data from SD Card
+            ESP_LOGD(TAG, "End of mp3file %s",m_mp3title.c_str());
 
-                if(nextTitle.substring(nextTitle.lastIndexOf('.') + 1, nextTitle.length()).equalsIgnoreCase("mp3"))
-                {
-                    ESP_LOGI(TAG, "Playing next Entry from playlist \"%s\"", nextTitle.c_str());
+            // a following playlist entry would have been queued already
+            stop_mp3client(true);
+        }
 
-                    m_mp3title=nextTitle.substring(nextTitle.lastIndexOf('/') + 1, nextTitle.length());
+        if(m_traceDecode && m_f_localfile && (read_register(SCI_HDAT1) != 0))
+        {                                                   // Format known, the decoder plays
+            LatencyTrace::mark(LatencyTrace::STAGE_DECODING);
+            m_traceDecode=false;
+        }
 
-                    result = openMp3File(nextTitle, 0);
-                } 
-                else 
-                {
-                    ESP_LOGW(TAG, "Invalid Entry from playlist \"%s\"", nextTitle.c_str());
-                }
-                
-                if ( result == false)
-                {
-                    stop_mp3client(true);
-                }
-            }
-            else
-            {
-                stop_mp3client(true);
-            }
+        if(m_f_localfile && ((millis() - m_lastCheckpoint) > m_checkpointInterval))
+        {
+            m_lastCheckpoint=millis();
+            m_readAhead.checkpoint(&m_resumeStore, m_resumePath, m_readAhead.position(), m_playlist_num);    // Survive a power cut, written by the read ahead task
         }
     }
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     if(m_f_webstream){                                      // Playing file from URL?
         if(m_ssl==false) av=client.available();// Available from stream
         if(m_ssl==true)  av=clientsecure.available();// Available from stream
-        if(av)
+        part=m_ringbuffer.writeSpan(&pData);                // Contiguous free space in the ringbuffer
+        if(av && part)
         {
-            m_ringspace=m_ringbfsiz - m_rcount;
-            part=m_ringbfsiz - m_rbwindex;                  // Part of length to xfer
-            if(part>m_ringspace)part=m_ringspace;
-            if(m_ssl==false) res=client.read(m_ringbuf+ m_rbwindex, part);   // Copy first part
-            if(m_ssl==true)  res=clientsecure.read(m_ringbuf+ m_rbwindex, part);   // Copy first part
+            if(m_ssl==false) res=client.read(pData, part);          // Copy first part
+            if(m_ssl==true)  res=clientsecure.read(pData, part);    // Copy first part
             if(res>0)
             {
-                m_rcount+=res;
-                m_rbwindex+=res;
+                m_ringbuffer.commitWrite(res);
             }
-            if(m_rbwindex==m_ringbfsiz) m_rbwindex=0;
         }
         if(m_datamode == VS1053_PLAYLISTDATA){
             if(m_t0+49<millis()) {
@@ -817,11 +1204,12 @@ void VS1053::loop()
                 handlebyte('\n');                           // send LF
             }
         }
-        if(m_chunked==false){rcount=m_rcount;}
+        if(m_chunked==false){rcount=m_ringbuffer.available();}
         else{
-            while(m_rcount){
+            while(m_ringbuffer.available()){
                 if((m_chunkcount+rcount) == 0|| m_firstchunk){             // Expecting a new chunkcount?
-                    uint8_t b =m_ringbuf[m_rbrindex];
+                    m_ringbuffer.peek(&pData);
+                    uint8_t b =*pData;
                     if(b=='\r'){}
                     else if(b=='\n'){
                         m_chunkcount=chunksize;
@@ -835,18 +1223,15 @@ void VS1053::loop()
                         if(b > 9) b = b - 7;                        // Translate A..F to 10..15
                         chunksize=(chunksize << 4) + b;
                     }
-                    if(++m_rbrindex == m_ringbfsiz){        // Increment pointer and
-                        m_rbrindex=0;                       // wrap at end
-                    }
-                    m_rcount--;
+                    m_ringbuffer.commitRead(1);
 
                 }
                 else break;
             }
             if(rcount==0){ //all bytes consumed?
-                if(m_chunkcount>m_rcount){
-                    m_chunkcount-=m_rcount;
-                    rcount=m_rcount;
+                if(m_chunkcount>m_ringbuffer.available()){
+                    m_chunkcount-=m_ringbuffer.available();
+                    rcount=m_ringbuffer.available();
                 }
                 else{
                     rcount=m_chunkcount;
@@ -858,42 +1243,28 @@ void VS1053::loop()
         //*******************************************************************************
 
         if(m_datamode==VS1053_OGG){
-            if(rcount>1024) btp=1024; else btp=rcount;  // reduce chunk thereby the ringbuffer can be proper fillied
+            btp=rcount;                                 // the decoder decides how much it takes
             if(btp){  //bytes to play
+                // We cannot read past the ringbuffer end, the rest is sent with the next call
+                part=m_ringbuffer.peek(&pData);
+                if(btp>part) btp=part;
+                btp=sdi_send_available(pData, btp);
                 rcount-=btp;
-                if((m_rbrindex + btp) >= m_ringbfsiz){
-                    part=m_ringbfsiz - m_rbrindex;
-                    sdi_send_buffer(m_ringbuf+ m_rbrindex, part);
-                    m_rbrindex=0;
-                    m_rcount-=part;
-                    btp-=part;
-                }
-                if(btp){                                         // Rest to do?
-                    sdi_send_buffer(m_ringbuf+ m_rbrindex, btp); // Copy full or last part
-                    m_rbrindex+=btp;                             // Point to next free byte
-                    m_rcount-=btp;                               // Adjust number of bytes
-                }
+                m_ringbuffer.commitRead(btp);
             } return;
         }
         if(m_datamode==VS1053_DATA){
-            if(rcount>1024)btp=1024;  else btp=rcount;  // reduce chunk thereby the ringbuffer can be proper fillied
-            if(count>btp){bcs=btp; count-=bcs;} else{bcs=count; count=0;}
+            bcs=rcount;                                 // the decoder decides how much it takes
+            if(bcs>count) bcs=count;                    // but not beyond the next metadata block
             if(bcs){ // bytes can send
-              rcount-=bcs;
-                // First see if we must split the transfer.  We cannot write past the ringbuffer end.
-                if((m_rbrindex + bcs) >= m_ringbfsiz){
-                    part=m_ringbfsiz - m_rbrindex;              // Part of length to xfer
-                    sdi_send_buffer(m_ringbuf+ m_rbrindex, part);  // Copy first part
-                    m_rbrindex=0;
-                    m_rcount-=part;                             // Adjust number of bytes
-                    bcs-=part;                                  // Adjust rest length
-                }
-                if(bcs){                                        // Rest to do?
-                    sdi_send_buffer(m_ringbuf+ m_rbrindex, bcs); // Copy full or last part
-                    m_rbrindex+=bcs;                            // Point to next free byte
-                    m_rcount-=bcs;                              // Adjust number of bytes
-                }
-                if(count==0){
+                // We cannot read past the ringbuffer end, the rest is sent with the next call
+                part=m_ringbuffer.peek(&pData);
+                if(bcs>part) bcs=part;
+                bcs=sdi_send_available(pData, bcs);
+                rcount-=bcs;
+                count-=bcs;
+                m_ringbuffer.commitRead(bcs);
+                if(bcs && (count==0)){
                     m_datamode=VS1053_METADATA;
                     m_firstmetabyte=true;
                 }
@@ -901,14 +1272,12 @@ void VS1053::loop()
         }
         else{ //!=DATA
             while(rcount){
-                handlebyte(m_ringbuf[m_rbrindex]);
-                if(++m_rbrindex == m_ringbfsiz){                // Increment pointer and
-                    m_rbrindex=0;                               // wrap at end
-                }
+                m_ringbuffer.peek(&pData);
+                handlebyte(*pData);
                 rcount--;
-                // call handlebyte>connecttohost can set m_rcount to zero (empty ringbuff)
-                if(m_rcount>0) m_rcount--;                   // no underrun
-                if(m_rcount==0)rcount=0; // exit this while()
+                // call handlebyte>connecttohost can empty the ringbuffer
+                if(m_ringbuffer.available()>0) m_ringbuffer.commitRead(1);  // no underrun
+                if(m_ringbuffer.available()==0)rcount=0; // exit this while()
                 if(m_datamode==VS1053_DATA){
                     count=m_metaint;
                     if(m_metaint==0) m_datamode=VS1053_OGG; // is likely no ogg but a stream without metadata, can be mms
@@ -921,95 +1290,143 @@ void VS1053::loop()
         }
         if(m_f_stream_ready==true){
             if(ringused()==0){  // empty buffer, broken stream or bad bitrate?
+                if(!m_stats.Starved){
+                    m_stats.Starved=true;
+                    m_stats.Underruns++;
+                }
                 i++;
                 if(i>150000){    // wait several seconds
                     i=0;
                     ESP_LOGD(TAG, "Stream lost -> try new connection");
                     connecttohost(m_lastHost);} // try a new connection
             }
-            else i=0;
+            else{
+                i=0;
+                m_stats.Starved=false;
+            }
         }
     } // end if(webstream)
 }
 //---------------------------------------------------------------------------------------
-void VS1053::stop_mp3client(bool resetPosition)
+bool VS1053::feedPending()
+{
+    if(m_f_paused || !data_request())                       // Paused or decoder FIFO is full
+    {
+        return false;
+    }
+    if(m_f_localfile)
+    {
+        return (m_readAhead.available() != 0) || m_readAhead.endOfFile();
+    }
+    if(m_f_webstream)
+    {
+        return (m_ringbuffer.available() != 0) || (streamavail() != 0);
+    }
+    return false;
+}
+//---------------------------------------------------------------------------------------
+bool VS1053::isRunning()
 {
-    uint16_t actualVolume = read_register(SCI_VOL);
-    write_register(SCI_VOL, 0xfefe);                             // Mute while stopping
+    return (m_f_localfile || m_f_webstream);
+}
+//---------------------------------------------------------------------------------------
+bool VS1053::pause()
+{
+    // a stream would overflow its buffer, only local files keep everything
+    if(!m_f_localfile)
+    {
+        return false;
+    }
 
-    stopSong();
+    // the decoder plays what it has in its FIFO and then waits for more
+    m_f_paused=true;
 
-    if (mp3file)
+    ESP_LOGD(TAG, "Paused at file position %u", m_readAhead.position());
+    return true;
+}
+//---------------------------------------------------------------------------------------
+bool VS1053::resume()
+{
+    if(!m_f_paused)
     {
-        fs::FS &fs=SD;
-        File myTempFile;
-        String positionFileName = mp3file.name();
+        return false;
+    }
 
-        ESP_LOGV(TAG, "Current File: %s", mp3file.name());
-        ESP_LOGD(TAG, "Current File position: %d", mp3file.position());
+    m_f_paused=false;
+    ESP_LOGD(TAG, "Resumed");
+    return true;
+}
+//---------------------------------------------------------------------------------------
+bool VS1053::isPaused()
+{
+    return m_f_paused;
+}
+//---------------------------------------------------------------------------------------
+void VS1053::stop_mp3client(bool resetPosition)
+{
+    uint16_t actualVolume = read_register(SCI_VOL);                // From the shadow copy
 
-        if(m_playlist.length()) 
+    if(m_f_localfile || m_f_webstream)                      // The decoder is idle otherwise
+    {
+        write_register(SCI_VOL, 0xfefe);                    // Mute while stopping
+
+        if(resetPosition)
         {
-            ESP_LOGV(TAG, "Current Playlist: %s", m_playlist.c_str());
-            ESP_LOGD(TAG, "Current Playlist position: %d", m_playlist_num);
-            positionFileName = m_playlist.substring(0,m_playlist.length() - 4) + ".pos";
+            stopSong();                                     // End of the file, play everything
         }
-        else 
+        else
         {
-            positionFileName = positionFileName.substring(0,positionFileName.length() - 4) + ".pos";
+            cancelSong();                                   // Nobody waits for the rest
         }
-        ESP_LOGV(TAG, "Position File Name: %s", positionFileName.c_str());
-
-        myTempFile = fs.open(positionFileName, FILE_WRITE);
-
-        if(myTempFile)
-        {
-            myTempFile.print("File Position:");
-
-            if(resetPosition)
-            {
-                myTempFile.println(0);
-            } 
-            else
-            {
-                myTempFile.println(mp3file.position());
-            }
+    }
 
-            ESP_LOGV(TAG, "Successfully saved file position");
+    if (m_mp3files[m_actualFile])
+    {
+        uint32_t position = m_readAhead.position();         // The file itself is already read ahead
 
-            myTempFile.print("Playlist:");
+        m_readAhead.stop();
 
-            if(resetPosition)
-            {
-                myTempFile.println(0);
-            } 
-            else
-            {
-                myTempFile.println(m_playlist_num);
-            }
+        ESP_LOGV(TAG, "Current File: %s", m_mp3files[m_actualFile].name());
+        ESP_LOGD(TAG, "Current File position: %u", position);
 
-            ESP_LOGV(TAG, "Successfully saved playlist position");
+        if(m_playlist.length()) 
+        {
+            ESP_LOGV(TAG, "Current Playlist: %s", m_playlist.c_str());
+            ESP_LOGD(TAG, "Current Playlist position: %d", m_playlist_num);
+        }
 
-            myTempFile.close();
-        } else {
-            ESP_LOGE(TAG, "Writing file position failed");
+        if(resetPosition)
+        {
+            m_resumeStore.save(m_resumePath, 0, 0);
+        }
+        else
+        {
+            m_resumeStore.save(m_resumePath, position, m_playlist_num);
         }
 
-        mp3file.close();
+        m_mp3files[m_actualFile].close();
+        m_mp3files[m_actualFile ^ 1].close();               // A queued next entry is not needed anymore
     }
 
     m_f_localfile=false;
     m_f_webstream=false;
-    
+    m_f_paused=false;
+    m_traceDecode=false;
+
+    // the stream buffer is kept, the next card or entry mostly needs the same size and
+    // allocating 16 KB again each time would fragment the internal RAM
+
     m_playlist_num = 0;
     m_playlist     = "";
+    m_playlistIndex.close();
+    m_resumePath   = "";
 
     client.flush();                                         // Flush stream client
     client.stop();                                          // Stop stream client
 
     if (m_SystemFlagGroup)
     {
-        xEventGroupClearBits(m_SystemFlagGroup, SF_PLAYING_FILE | SF_PLAYING_AUDIOBOOK);
+        xEventGroupClearBits(m_SystemFlagGroup, SF_PLAYING_FILE | SF_PLAYING_AUDIOBOOK | SF_AUDIO_STARTED);
     }
 
     write_register(SCI_VOL, actualVolume);                  // restore the volume
@@ -1023,9 +1440,11 @@ bool VS1053::connecttohost(String host)
     String extension="/";                                 // May be like "/mp3" in "skonto.ls.lv:8002/mp3"
     String hostwoext;                                     // Host without extension and portnumber
     String headerdata="";
-    stopSong();
     stop_mp3client();                                     // Disconnect if still connected
     m_f_localfile=false;
+    if(!allocateStreamBuffer(SOURCE_WEBSTREAM)){
+        return false;
+    }
     m_f_webstream=true;
     if(m_lastHost!=host){                                 // New host or reconnection?
         m_f_stream_ready=false;
@@ -1034,9 +1453,7 @@ bool VS1053::connecttohost(String host)
     ESP_LOGD(TAG, "Connect to new host: %s", host.c_str());
 
     // initializationsequence
-    m_rcount=0;                                             // Empty ringbuff
-    m_rbrindex=0;
-    m_rbwindex=0;
+    m_ringbuffer.reset();                                   // Empty ringbuff
     m_ctseen=false;                                         // Contents type not seen yet
     m_metaint=0;                                            // No metaint yet
     m_LFcount=0;                                            // For detection end of header
@@ -1126,7 +1543,7 @@ bool VS1053::connecttoSD(String sdfile, bool resume)
     char path[256];
     uint16_t i=0, s=0;
     uint32_t position = 0;
-    uint32_t playlist = 0;
+    uint16_t playlist = 0;
     String fileExtension;
     bool result = false;
     EventBits_t     bitFlags = 0;
@@ -1135,8 +1552,14 @@ bool VS1053::connecttoSD(String sdfile, bool resume)
     clientsecure.stop();                        // release memory if allocated
     clientsecure.flush(); 
 
+    if (!allocateStreamBuffer(SOURCE_SDCARD))
+    {
+        return false;
+    }
+
     m_f_localfile=true;
     m_f_webstream=false;
+    m_playlistEnd=false;
 
     while(sdfile[i] != 0){                      //convert UTF8 to ASCII
         path[i]=sdfile[i];
@@ -1153,43 +1576,19 @@ bool VS1053::connecttoSD(String sdfile, bool resume)
 
     ESP_LOGV(TAG, "Play File with Extension \"%s\"", fileExtension.c_str());
 
-    //
-    fs::FS &fs=SD;
+    // the position is saved for the file or playlist given here
+    m_resumePath=path;
+    m_openTime=millis();
+    m_lastCheckpoint=millis();
 
-    if ((resume) && (fs.exists(sdfile.substring(0,sdfile.length() - 4) + ".pos")) ) 
+    if (resume)
     {
-        File myTempFile;
-
         ESP_LOGV(TAG, "Resuming track...");
-        myTempFile = fs.open(sdfile.substring(0,sdfile.length() - 4) + ".pos");
 
-        if (myTempFile) 
+        if (m_resumeStore.load(m_resumePath, &position, &playlist) ||
+            loadLegacyPosition(sdfile, &position, &playlist))
         {
-            if (myTempFile.find("File Position:")) 
-            {
-                position = myTempFile.parseInt();
-
-                ESP_LOGD(TAG, "Resume playing at position %u", position);
-            } 
-            else
-            {
-                ESP_LOGD(TAG, "Position Identification not found");
-            }
-
-            myTempFile.seek(0);
-            
-            if (myTempFile.find("Playlist:")) 
-            {
-                playlist = myTempFile.parseInt();
-
-                ESP_LOGD(TAG, "Resume playlist at entry %u", playlist);
-            } 
-            else
-            {
-                ESP_LOGD(TAG, "Playlist Identification not found");
-            }
-
-            myTempFile.close();
+            ESP_LOGD(TAG, "Resume playing at position %u, playlist entry %u", position, playlist);
         }
     }
 
@@ -1208,6 +1607,8 @@ bool VS1053::connecttoSD(String sdfile, bool resume)
         m_playlist      = path;
         m_playlist_num  = playlist;
 
+        m_playlistIndex.open(m_playlist);                   // Built once, after that every entry is one read
+
         String actualEntry = findNextPlaylistEntry(true);
 
         //send the file to the player
@@ -1227,6 +1628,11 @@ bool VS1053::connecttoSD(String sdfile, bool resume)
         bitFlags = SF_PLAYING_FILE | SF_PLAYING_AUDIOBOOK;
     }
 
+    if (result)
+    {
+        LatencyTrace::mark(LatencyTrace::STAGE_FILE_OPEN);
+    }
+
     if ((result) && (m_SystemFlagGroup))
     {
         xEventGroupSetBits(m_SystemFlagGroup, bitFlags);
@@ -1240,58 +1646,22 @@ bool VS1053::connecttoSD(String sdfile, bool resume)
 
 String VS1053::findNextPlaylistEntry( bool restart )
 {
-    fs::FS  &fs=SD;
-    File     myPlaylistFile;
-    String   actualEntry = "";
-
-    ESP_LOGD(TAG, "Analysing playlist %s", m_playlist.c_str());
+    ESP_LOGD(TAG, "Looking for entry %u of playlist %s", m_playlist_num+1, m_playlist.c_str());
 
-    myPlaylistFile = fs.open(m_playlist);
-
-    if (myPlaylistFile)
+    //check if we have reached the end of the list
+    if (m_playlist_num >= m_playlistIndex.count())
     {
-        uint32_t actualEntryNumber = 0;
+        ESP_LOGV(TAG, "Entry %u does not exist, using entry 1", m_playlist_num+1);
 
-        ESP_LOGD(TAG, "looking for line %u", m_playlist_num+1);
+        m_playlist_num = 0;
 
-        //read lines untill the "counter" matches the line
-        while (actualEntryNumber <= m_playlist_num)
+        if (restart == false)
         {
-            //read the next line
-            actualEntry = myPlaylistFile.readStringUntil('\r');
-
-            //remove whitespaces
-            actualEntry.trim();
-
-            //
-            actualEntryNumber++;
-
-            //check if we have reached the end of the list without finding our number
-            if ((actualEntry.length() == 0) && (myPlaylistFile.available() == false))
-            {
-                ESP_LOGV(TAG, "Line %u does not exist, using line 1", m_playlist_num);
-
-                //rewind the file
-                myPlaylistFile.seek(0);
-                actualEntryNumber   = 0;
-                m_playlist_num      = 0;
-                actualEntry         = "";
-
-                if (restart == false)
-                {
-                    break;
-                }
-            }
-            else
-            {
-                ESP_LOGV(TAG, "Read playlist entry %u: \"%s\"", actualEntryNumber, actualEntry.c_str());
-            }
-        };
-
-        myPlaylistFile.close();
+            return "";
+        }
     }
 
-    return actualEntry;
+    return m_playlistIndex.entry(m_playlist_num);
 }
 
 
@@ -1301,29 +1671,316 @@ bool VS1053::openMp3File(String sdfile, uint32_t position)
     bool result = true;
 
     fs::FS &fs=SD;
+    File &mp3file=m_mp3files[m_actualFile];
     mp3file=fs.open(sdfile);
+    m_mp3paths[m_actualFile]=sdfile;
     if(!mp3file)
     {
-        ESP_LOGE(TAG, "Failed to open file %s for reading", sdfile);
+        ESP_LOGE(TAG, "Failed to open file %s for reading", sdfile.c_str());
         result = false;
     }
     else 
     {
+        MediaTags &tags=m_tags[m_actualFile];
+
+        // the tags (and their cover art) never go to the decoder
+        tags.read(mp3file);
+        if(position < tags.audioStart())
+        {
+            position=tags.audioStart();
+        }
+        position=Mp3FrameIndex::frameSync(mp3file, position, tags.audioEnd());   // Start on a frame boundary
         mp3file.seek(position);
+
+        // for SD playback the ringbuffer holds the read ahead data
+        m_readAhead.start(&mp3file, m_ringbuf, m_ringbfsiz, tags.audioEnd());
     }
     return result;
 }
 //---------------------------------------------------------------------------------------
+bool VS1053::loadLegacyPosition(String sdfile, uint32_t *pPosition, uint16_t *pEntry)
+{
+    fs::FS &fs=SD;
+    String positionFileName=sdfile.substring(0,sdfile.length() - 4) + ".pos";
+    File   myTempFile;
+
+    if(!fs.exists(positionFileName))
+    {
+        return false;
+    }
+
+    myTempFile=fs.open(positionFileName);
+    if(!myTempFile)
+    {
+        return false;
+    }
+
+    if(myTempFile.find("File Position:"))
+    {
+        *pPosition=myTempFile.parseInt();
+    }
+    myTempFile.seek(0);
+    if(myTempFile.find("Playlist:"))
+    {
+        *pEntry=myTempFile.parseInt();
+    }
+    myTempFile.close();
+
+    // from now on the journal knows the position
+    if(m_resumeStore.save(m_resumePath, *pPosition, *pEntry))
+    {
+        fs.remove(positionFileName);
+        ESP_LOGI(TAG, "Moved %s to the resume journal", positionFileName.c_str());
+    }
+    return true;
+}
+//---------------------------------------------------------------------------------------
+bool VS1053::seekTo(uint32_t seconds)
+{
+    File     &mp3file=m_mp3files[m_actualFile];
+    MediaTags &tags=m_tags[m_actualFile];
+    uint32_t startTime=millis();
+    uint32_t position;
+    uint16_t actualVolume;
+
+    if(!m_f_localfile || !mp3file)
+    {
+        ESP_LOGW(TAG, "Seeking is only possible in local files");
+        return false;
+    }
+
+    position=m_readAhead.position();
+
+    actualVolume=read_register(SCI_VOL);                    // From the shadow copy
+    write_register(SCI_VOL, 0xfefe);                        // Mute while cancelling
+
+    m_readAhead.stop();                                     // We need the file for ourselves now
+    cancelSong();                                           // The old position must not be heard or spliced
+
+    write_register(SCI_VOL, actualVolume);
+
+    m_mp3files[m_actualFile ^ 1].close();                   // A queued next entry is queued again later
+    m_playlistEnd=false;
+
+    // the index is built on the first seek in a file
+    if(m_frameIndex.open(mp3file, m_mp3paths[m_actualFile], tags.audioStart(), tags.audioEnd()) && m_frameIndex.duration())
+    {
+        position=m_frameIndex.positionOf(mp3file, seconds * 1000);
+        ESP_LOGI(TAG, "Seek to %u s of %u s (position %u) in %u ms", seconds, m_frameIndex.duration() / 1000, position, millis() - startTime);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "No frame index, continue at position %u", position);
+    }
+
+    mp3file.seek(position);
+    m_readAhead.start(&mp3file, m_ringbuf, m_ringbfsiz, tags.audioEnd());
+
+    return true;
+}
+//---------------------------------------------------------------------------------------
+bool VS1053::skip(bool forward)
+{
+    uint16_t target=0;                                      // Playlist entry to continue with
+    uint16_t actualVolume;
+    String   entry;
+    bool     result;
+
+    if(!m_f_localfile)
+    {
+        return false;
+    }
+
+    if(m_playlist.length())
+    {
+        if(forward)
+        {
+            if((m_playlist_num + 1) >= m_playlistIndex.count())
+            {
+                ESP_LOGD(TAG, "Last entry of the playlist, nothing to skip to");
+                return false;
+            }
+            target=m_playlist_num + 1;
+        }
+        else
+        {
+            target=(m_playlist_num > 0) ? (m_playlist_num - 1) : 0;
+        }
+    }
+    else if(forward)
+    {
+        ESP_LOGD(TAG, "Single file, nothing to skip to");
+        return false;
+    }
+
+    m_skipTime=millis();
+
+    actualVolume=read_register(SCI_VOL);                    // From the shadow copy
+    write_register(SCI_VOL, 0xfefe);                        // Mute while cancelling
+
+    m_readAhead.stop();                                     // Nothing of the old file must follow
+    cancelSong();
+
+    write_register(SCI_VOL, actualVolume);
+
+    m_mp3files[m_actualFile].close();
+    m_mp3files[m_actualFile ^ 1].close();                   // A queued next entry is obsolete
+    m_f_paused=false;
+    m_playlistEnd=false;
+    m_openTime=0;
+
+    if(m_SystemFlagGroup) xEventGroupClearBits(m_SystemFlagGroup, SF_AUDIO_STARTED);
+
+    if(m_playlist.length())
+    {
+        m_playlist_num=target;
+        entry=findNextPlaylistEntry();
+        m_mp3title=entry.substring(entry.lastIndexOf('/') + 1, entry.length());
+
+        ESP_LOGI(TAG, "Skipping to entry %u of the playlist \"%s\"", m_playlist_num + 1, m_mp3title.c_str());
+    }
+    else
+    {
+        entry=m_resumePath;                                 // The file itself
+    }
+
+    result=openMp3File(entry, 0);
+    if(!result)
+    {
+        m_skipTime=0;
+        stop_mp3client();
+        return false;
+    }
+
+    showstreamtitle(m_mp3title.c_str(), true);
+    return true;
+}
+//---------------------------------------------------------------------------------------
+bool VS1053::queueNextPlaylistEntry()
+{
+    fs::FS   &fs=SD;
+    uint8_t  nextFile=m_actualFile ^ 1;
+    uint16_t actualNum=m_playlist_num;                      // Stays valid for the resume position
+    String   nextTitle;
+
+    // find the next mp3 entry (an empty one marks the end of the list)
+    while(true)
+    {
+        m_playlist_num++;
+        nextTitle=findNextPlaylistEntry();
+
+        if((nextTitle.length() == 0) ||
+           nextTitle.substring(nextTitle.lastIndexOf('.') + 1, nextTitle.length()).equalsIgnoreCase("mp3"))
+        {
+            break;
+        }
+        ESP_LOGW(TAG, "Invalid Entry from playlist \"%s\"", nextTitle.c_str());
+    }
+    m_nextPlaylistNum=m_playlist_num;
+    m_playlist_num=actualNum;
+
+    if(nextTitle.length() == 0)
+    {
+        ESP_LOGD(TAG, "No further entry in playlist");
+        m_playlistEnd=true;
+        return false;
+    }
+
+    m_mp3files[nextFile]=fs.open(nextTitle);
+    m_mp3paths[nextFile]=nextTitle;
+    if(!m_mp3files[nextFile])
+    {
+        ESP_LOGE(TAG, "Failed to open file %s for reading", nextTitle.c_str());
+        m_playlistEnd=true;
+        return false;
+    }
+
+    // the tags would be heard in the middle of the stream
+    m_tags[nextFile].read(m_mp3files[nextFile]);
+    m_mp3files[nextFile].seek(Mp3FrameIndex::frameSync(m_mp3files[nextFile], m_tags[nextFile].audioStart(), m_tags[nextFile].audioEnd()));
+
+    m_nextTitle=nextTitle.substring(nextTitle.lastIndexOf('/') + 1, nextTitle.length());
+
+    ESP_LOGD(TAG, "Queued next Entry from playlist \"%s\"", nextTitle.c_str());
+
+    return m_readAhead.queueNext(&m_mp3files[nextFile], m_tags[nextFile].audioEnd());
+}
+//---------------------------------------------------------------------------------------
+bool VS1053::allocateStreamBuffer(StreamSource_e source)
+{
+    uint32_t size;
+
+    // prefer the (big) external RAM, fall back to a smaller buffer in internal RAM
+    if(psramFound())
+    {
+        size=(source == SOURCE_SDCARD) ? m_sdBufferSizePsram : m_webBufferSizePsram;
+    }
+    else
+    {
+        size=(source == SOURCE_SDCARD) ? m_sdBufferSize : m_webBufferSize;
+    }
+
+    if((m_ringbuf != NULL) && (m_ringbfsiz == size))
+    {
+        m_ringbuffer.reset();                               // Already there, just empty it
+        return true;
+    }
+
+    releaseStreamBuffer();
+
+    if(psramFound())
+    {
+        m_ringbuf=(uint8_t *) heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        m_ringInPsram=(m_ringbuf != NULL);
+    }
+    if(m_ringbuf == NULL)
+    {
+        size=(source == SOURCE_SDCARD) ? m_sdBufferSize : m_webBufferSize;
+        m_ringbuf=(uint8_t *) heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        m_ringInPsram=false;
+    }
+    if(m_ringbuf == NULL)
+    {
+        ESP_LOGE(TAG, "Could not allocate %u bytes for the stream buffer", size);
+        return false;
+    }
+
+    m_ringbfsiz=size;
+    m_ringbuffer.attach(m_ringbuf, m_ringbfsiz);
+
+    ESP_LOGD(TAG, "Stream buffer: %u bytes in %s RAM, free internal RAM %u bytes", m_ringbfsiz,
+             m_ringInPsram ? "external" : "internal", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+
+    return true;
+}
+//---------------------------------------------------------------------------------------
+void VS1053::releaseStreamBuffer()
+{
+    if(m_ringbuf == NULL)
+    {
+        return;
+    }
+
+    m_readAhead.stop();                                     // Make sure nobody works with the memory
+    m_ringbuffer.attach(NULL, 0);
+
+    heap_caps_free(m_ringbuf);
+    m_ringbuf=NULL;
+    m_ringbfsiz=0;
+
+    ESP_LOGD(TAG, "Stream buffer released, free internal RAM %u bytes", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+}
+//---------------------------------------------------------------------------------------
 bool VS1053::connecttospeech(String speech, String lang)
 {
     String host="translate.google.com";
     String path="/translate_tts";
+
+    stop_mp3client();                           // Disconnect if still connected (before the flags are cleared)
     m_f_localfile=false;
     m_f_webstream=false;
     m_ssl=true;
 
-    stopSong();
-    stop_mp3client();                           // Disconnect if still connected
     clientsecure.stop(); clientsecure.flush();  // release memory if allocated
 
     String resp=   String("GET / HTTP/1.0\r\n") +
@@ -1485,6 +2142,11 @@ String VS1053::urlencode(String str)
     return encodedString;
 }
 //---------------------------------------------------------------------------------------
+void VS1053::setWakeup(SemaphoreHandle_t wakeup)
+{
+    m_readAhead.setWakeup(wakeup);
+}
+//---------------------------------------------------------------------------------------
 void VS1053::setSystemFlagGroup(EventGroupHandle_t eventGroup)
 {
     m_SystemFlagGroup = eventGroup;
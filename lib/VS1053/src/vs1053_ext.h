@@ -5,9 +5,17 @@
 #include "Arduino.h"
 #include "SPI.h"
 #include "WiFiClientSecure.h"
+#include "Preferences.h"
 #include "SD.h"
 #include "FS.h"
 
+#include "sdReadAhead.h"
+#include "playlistIndex.h"
+#include "resumeStore.h"
+#include "mp3FrameIndex.h"
+#include "mediaTags.h"
+#include "spscRingBuffer.h"
+
 extern __attribute__((weak)) void vs1053_info(const char*);
 extern __attribute__((weak)) void vs1053_showstreamtitle(const char*);
 extern __attribute__((weak)) void vs1053_showstation(const char*);
@@ -32,7 +40,20 @@ class VS1053
   private:
     WiFiClient client;
     WiFiClientSecure clientsecure;
-    File mp3file;
+    File m_mp3files[2];                             // Actual track and the queued next one (gapless playlists)
+    uint8_t m_actualFile=0;                         // Index of the actual track in m_mp3files
+    MediaTags m_tags[2];                            // Tags and audio data range of m_mp3files
+    String m_mp3paths[2];                           // Full paths of m_mp3files (name() is only the base name on newer cores)
+    uint32_t m_openTime=0;                          // millis() of connecttoSD() until the first audio is sent
+    uint32_t m_skipTime=0;                          // millis() of skip() until the first audio is sent
+    bool     m_traceDecode=false;                   // Latency trace waits for the decoder to recognise the stream
+    SdReadAhead m_readAhead;                        // Reads the mp3 files in front of the decoder
+    PlaylistIndex m_playlistIndex;                  // Entry offsets of the local playlist
+    ResumeStore m_resumeStore;                      // Positions of all local media
+    Mp3FrameIndex m_frameIndex;                     // Time to frame position of the actual file (seek)
+    String      m_resumePath;                       // Key of the actual media in m_resumeStore
+    uint32_t    m_lastCheckpoint=0;                 // millis() of the last saved position
+    const uint32_t m_checkpointInterval=30000;      // Save the position while playing (power cut)
   private:
 
     uint8_t       cs_pin ;                        	// Pin where CS line is connected
@@ -65,14 +86,63 @@ class VS1053
     const uint8_t SM_TESTS          = 5 ;         	// Bitnumber in SCI_MODE for tests
     const uint8_t SM_LINE1          = 14 ;        	// Bitnumber in SCI_MODE for Line input
 
-    SPISettings     VS1053_SPI;                     // SPI settings for this slave
+    // Shadow copy of the SCI registers that only change when we write them
+    uint16_t        m_sciShadow[16];
+    uint16_t        m_sciShadowValid;               // Bit n set: m_sciShadow[n] matches the chip
+    typedef struct {
+        uint8_t     Register;
+        uint16_t    Value;
+    } SciWrite_s;
+
+    // Clock calibration, the result is kept in the NVS so later boots skip the probe
+    const uint32_t  m_xtali            = 12288000;  // Crystal frequency in Hz
+    const uint16_t  m_clockfDefault    = 0x6000;    // SC_MULT 3.0x, 4 MHz SPI is safe then
+    const uint32_t  m_spiDefault       = 4000000;
+    const uint32_t  m_spiSlow          = 200000;    // Safe for every clock multiplier
+    const uint8_t   m_verifyRounds     = 8;         // Register write/readback rounds per step
+    const char     *m_nvsNamespace     = "vs1053";
+    uint16_t        m_clockf;                       // SCI_CLOCKF in use
+    uint32_t        m_spiClock;                     // SPI clock in use (SCI and SDI)
+    SemaphoreHandle_t m_dreqSemaphore;              // Given by the DREQ interrupt on every rising edge
+    const TickType_t  m_dreqTimeout = 10;           // Max. ticks to sleep before DREQ is polled again
     
-    uint8_t  m_ringbuf[0x5000]; // 20480d           // Ringbuffer for mp3 stream
-    const uint16_t m_ringbfsiz=sizeof(m_ringbuf);   // Ringbuffer size
-    uint16_t m_rbwindex=0;                          // Ringbuffer writeindex
-    uint16_t m_rbrindex=0;                          // Ringbuffer readindex
-    uint16_t m_ringspace=0;                         // Ringbuffer free space
-    uint16_t m_rcount=0;                            // Ringbuffer used space
+    // Health counters of the audio path, cheap enough to be always on
+    static const uint8_t FILL_BUCKETS = 8;          // Fill level histogram in steps of 12.5%
+    typedef struct {
+        uint32_t    StartTime;                      // millis() of the last reset
+        uint64_t    BytesFed;                       // Bytes sent to the decoder
+        uint32_t    DreqWaits;                      // Number of waits for a full decoder FIFO
+        uint64_t    DreqWaitTime;                   // Time spent waiting for DREQ in us
+        uint32_t    Underruns;                      // Stream buffer ran empty while playing
+        uint32_t    FillHistogram[FILL_BUCKETS];    // Buffer fill level, sampled every loop()
+        uint32_t    LastFeedCall;                   // micros() of the last loop() while playing
+        uint32_t    MaxFeedGap;                     // Longest time between two loop() calls in us
+        uint32_t    SciTransactions;                // SPI bus transactions for SCI commands
+        uint32_t    SdiTransactions;                // SPI bus transactions for audio data
+        uint32_t    SciReadsCached;                 // SCI reads served by the shadow registers
+        uint32_t    Skips;                          // Track skips by next/prev
+        uint32_t    SkipTimeSum;                    // ms from the skip request until the new audio
+        uint32_t    MaxSkipTime;                    // ms
+        uint32_t    MaxCancelTime;                  // us for the cancel of the decoder
+        bool        Starved;                        // Buffer is empty (count every gap once)
+    } Statistics_s;
+    Statistics_s    m_stats;
+
+    typedef enum {
+        SOURCE_SDCARD,                              // Read ahead buffer for local files
+        SOURCE_WEBSTREAM,                           // Ringbuffer for mp3 streams
+    } StreamSource_e;
+
+    // Sizes of the stream buffer depending on the source and the memory we got
+    const uint32_t m_sdBufferSize        = 0x4000;  // 16384d, ~1s at 128 kbit/s
+    const uint32_t m_sdBufferSizePsram   = 0x10000; // 65536d
+    const uint32_t m_webBufferSize       = 0x5000;  // 20480d
+    const uint32_t m_webBufferSizePsram  = 0x20000; // 131072d
+
+    uint8_t  *m_ringbuf=NULL;                       // Ringbuffer for mp3 stream, allocated with the source
+    uint32_t m_ringbfsiz=0;                         // Ringbuffer size
+    bool     m_ringInPsram=false;                   // Ringbuffer is located in external RAM
+    SpscRingBuffer<uint8_t> m_ringbuffer;           // Read/write indices of the stream in m_ringbuf
 
     EventGroupHandle_t m_SystemFlagGroup;
     
@@ -98,11 +168,15 @@ class VS1053
     String          m_icyname ;                     // Icecast station name
     String          m_icystreamtitle ;              // Streamtitle from metadata
     String          m_playlist ;                    // The URL of the specified playlist
-    int8_t          m_playlist_num = 0 ;            // Nonzero for selection from playlist
+    uint16_t        m_playlist_num = 0 ;            // Nonzero for selection from playlist
+    uint16_t        m_nextPlaylistNum = 0;          // Entry of the queued next file
+    String          m_nextTitle;                    // Name of the queued next file
+    boolean         m_playlistEnd=false;            // No further entry to queue
     boolean         m_firstmetabyte=false;          // True if first metabyte (counter)
     boolean         m_f_hostreq = false ;           // Request for new host
     boolean         m_f_localfile = false ;         // Play from local mp3-file
     boolean         m_f_webstream = false ;         // Play from URL
+    boolean         m_f_paused = false ;            // Feeding stopped, file, buffer and decoder are kept
     boolean         m_f_plsFile=false;              // Set if URL is known
     boolean         m_f_plsTitle=false;             // Set if StationName is knowm
     boolean         m_f_ogg=false;                  // Set if oggstream
@@ -123,13 +197,23 @@ class VS1053
         NOP() ;                                   	// Very short delay
       }
     }
+    void     wait_data_request();                        // Sleep (instead of spinning) until DREQ is HIGH
+    static void IRAM_ATTR dreq_isr(void *arg);
     void control_mode_on();
     void control_mode_off();
     void data_mode_on();
     void data_mode_off();
-    uint16_t read_register ( uint8_t _reg ) ;
+    uint16_t read_register ( uint8_t _reg ) ;                    // Served by the shadow copy if possible
+    uint16_t read_register_raw ( uint8_t _reg ) ;                // Always asks the chip
     void     write_register ( uint8_t _reg, uint16_t _value );
+    void     write_registers ( const SciWrite_s *writes, uint8_t count ); // Several writes in one bus transaction
+    inline bool sci_cacheable ( uint8_t _reg ) const
+    {
+      return ( ( _reg == SCI_BASS ) || ( _reg == SCI_CLOCKF ) || ( _reg == SCI_VOL ) ) ;
+    }
+    void     sci_shadow_update ( uint8_t _reg, uint16_t _value );
     void     sdi_send_buffer ( uint8_t* data, size_t len ) ;
+    size_t   sdi_send_available ( uint8_t* data, size_t len ) ; // Send only while DREQ is HIGH, never waits
     void     sdi_send_fillers ( size_t length ) ;
     void     wram_write ( uint16_t address, uint16_t data ) ;
     uint16_t wram_read ( uint16_t address ) ;
@@ -140,6 +224,7 @@ class VS1053
                                                          // time a new song starts.
     void     stopSong() ;                                // Finish playing a song. Call this after
                                                          // the last playChunk call.
+    void     cancelSong() ;                              // Drop the rest of a song as fast as possible
     String   urlencode(String str);
     long long int XL (long long int a, const char* b);
     char*    lltoa(long long val, int base);
@@ -148,6 +233,15 @@ class VS1053
       return ( digitalRead ( dreq_pin ) == HIGH ) ;
     }
     bool    openMp3File(String sdfile, uint32_t position);
+    bool    loadLegacyPosition(String sdfile, uint32_t *pPosition, uint16_t *pEntry);  // Old .pos file
+    bool    queueNextPlaylistEntry();               // Open the next entry and let it follow without a gap
+    void    calibrateClocks();                      // Use stored clocks or probe for the fastest reliable ones
+    void    probeClocks();
+    bool    applyClocks(uint16_t clockf, uint32_t spiClock);    // True if the chip works reliably with them
+    bool    verifyRegisters();
+    uint32_t internalClock(uint16_t clockf);        // CLKI in Hz for the given SCI_CLOCKF
+    bool    allocateStreamBuffer(StreamSource_e source);
+    void    releaseStreamBuffer();
 
   public:
     // Constructor.  Only sets pin values.  Doesn't touch the chip.  Be sure to call begin()!
@@ -158,17 +252,29 @@ class VS1053
                                                         // and prepares SPI bus.
 
     void     setSystemFlagGroup(EventGroupHandle_t eventGroup);
+    void     setWakeup(SemaphoreHandle_t wakeup);       // Given when the read ahead has data for loop()
     void     stop_mp3client(bool resetPosition = false);
     void     setVolume(uint8_t vol);                    // Set the player volume.Level from 0-21, higher is louder.
     void     setTone(uint8_t* rtone);                   // Set the player baas/treble, 4 nibbles for treble gain/freq and bass gain/freq
     uint8_t  getVolume();                               // Get the current volume setting, higher is louder.
     void     printDetails();                            // Print configuration details to serial output.
+    void     printStatistics(bool reset = false);       // Print the audio path health counters
+    void     resetStatistics();
     bool     printVersion();                            // Print ID and version of vs1053 chip
     void     softReset() ;                              // Do a soft reset
     void 	 loop();
-    uint16_t ringused();
+    bool     feedPending();                             // Decoder accepts data and there is data to send
+    bool     isRunning();                               // Playing from SD or stream
+    bool     pause();                                   // Stop feeding the decoder, only for local files
+    bool     resume();                                  // Continue feeding where pause() stopped
+    bool     isPaused();
+    uint32_t ringused();
+    void     setReadAheadTarget(uint32_t milliSeconds); // Audio to keep buffered when playing from SD
     bool     connecttohost(String host);
     bool	 connecttoSD(String sdfile, bool resume = false);
+    bool     seekTo(uint32_t seconds);                  // Continue the actual local file at the given time
+    bool     skip(bool forward);                        // Next/previous playlist entry (restart of a single file)
+    MediaTags &getTags() { return m_tags[m_actualFile]; }   // Tags of the actual local file
     String   findNextPlaylistEntry( bool restart = false );
     bool     connecttospeech(String speech, String lang);
     inline uint8_t getDatamode(){
@@ -5,9 +5,12 @@
 #include "mp3player.h"
 #include "UserInterface.h"
 #include "LedHandler.h"
+#include "mediaLibrary.h"
 
 
 #include "pinout.h"
+#include "spiBus.h"
+#include "latencyTrace.h"
 
 #include "SimpleCLI.h"
 using namespace simplecli;
@@ -30,6 +33,7 @@ using namespace simplecli;
 
 UserInterface   myInterface;
 Mp3player       MyPlayer(VS1053_CS, VS1053_DCS, VS1053_DREQ);
+MediaLibrary    MyLibrary;
 
 QueueHandle_t       PlayerCommandQueue;
 QueueHandle_t       *pCommandInterfaceQueue;
@@ -54,15 +58,20 @@ void setup() {
     Serial.begin(115200);
 
     SPI.begin(SPI_CLK, SPI_MISO, SPI_MOSI);
+    SpiBus::begin();
 
     //prepare the user interface    
     myInterface.setPlayerCommandQueue(&PlayerCommandQueue);
+    myInterface.setSystemFlagGroup(SystemFlagGroup);
     pCommandInterfaceQueue = myInterface.getInterfaceCommandQueue();
     myInterface.begin();
 
-    SD.begin(SDCARD_CS);
+    SD.begin(SDCARD_CS, SPI, SpiBus::getClock(SpiBus::DEVICE_SDCARD));
+
+    MyLibrary.begin();
 
     MyPlayer.SetSystemFlagGroup(SystemFlagGroup);
+    MyPlayer.setMediaLibrary(&MyLibrary);
     MyPlayer.begin(&PlayerCommandQueue);
 
     MyLedHandler.SetEventGroup(SystemFlagGroup);
@@ -124,15 +133,35 @@ void CommandLine_create(void)
         Serial.println("");
         Serial.println("- play <filename>       : start playing the given file name");
         Serial.println("                           from the beginning (must be a mp3 or m3u file)");
+        Serial.println("  play #<id>            : start playing the media with the given library id");
         Serial.println("- resume <filename>     : start playing the given file name");
         Serial.println("                           from previous position (must be a mp3 or m3u file)");
         Serial.println("- stop                  : stops the actual playback");
+        Serial.println("- seek <seconds>        : continue the actual file at the given time");
+        Serial.println("- next                  : skip to the next entry of the playlist");
+        Serial.println("- prev                  : back to the previous entry (or the start of the file)");
         Serial.println("");
         Serial.println("- volume <1..100>       : set volume to level");
         Serial.println("  volume up             : increase volume by 5 steps");
         Serial.println("  volume down           : decrease volume by 5 steps");
         Serial.println("");
         Serial.println(" - write <filename>     : setup RFID card with the given parameters");
+        Serial.println("");
+        Serial.println("- provision             : show the state of the card provisioning");
+        Serial.println("  provision start [csv] : write every blank card placed, jobs from the csv file");
+        Serial.println("                           (\"<filename>[,resume][,<volume>][,start=<s>]\" per line)");
+        Serial.println("  provision add <filename> [resume] : add a job for the next blank card");
+        Serial.println("  provision stop        : end the card provisioning");
+        Serial.println("");
+        Serial.println("- library               : show the state of the media library");
+        Serial.println("  library scan          : update the media library");
+        Serial.println("  library find <prefix> : list the media whose path starts with prefix");
+        Serial.println("  library #<id>         : show the media with the given id");
+        Serial.println("");
+        Serial.println("- stats                 : show the audio path statistics");
+        Serial.println("  stats reset           : show and reset the audio path statistics");
+        Serial.println("- trace                 : show the stages from a card to the first sound");
+        Serial.println("  trace reset           : clear the recorded traces");
     }));
     // ======================================== //
 
@@ -188,6 +217,42 @@ void CommandLine_create(void)
     }));
     // ======================================== //
 
+    // =========== Add next/prev command ========== //
+    pCli->addCmd(new EmptyCmd("next", [](Cmd* cmd) {
+        UserInterface::InterfaceCommandMessage_s newMessage = { .Command = UserInterface::CMD_PLAY_NEXT };
+
+        // the message is copied to the queue, so no need for the original one :)
+        if (!xQueueSend( *pCommandInterfaceQueue, &newMessage, ( TickType_t ) 0 ) )
+        {
+            ESP_LOGE(TAG, "Send to queue failed");
+        }
+    }));
+
+    pCli->addCmd(new EmptyCmd("prev", [](Cmd* cmd) {
+        UserInterface::InterfaceCommandMessage_s newMessage = { .Command = UserInterface::CMD_PLAY_PREV };
+
+        // the message is copied to the queue, so no need for the original one :)
+        if (!xQueueSend( *pCommandInterfaceQueue, &newMessage, ( TickType_t ) 0 ) )
+        {
+            ESP_LOGE(TAG, "Send to queue failed");
+        }
+    }));
+    // ======================================== //
+
+    // =========== Add seek command ========== //
+    pCli->addCmd(new SingleArgCmd("seek", [](Cmd* cmd) {
+        UserInterface::InterfaceCommandMessage_s newMessage = { .Command    = UserInterface::CMD_PLAY_SEEK,
+                                                                .pData      = NULL,
+                                                                .Value      = (uint32_t) cmd->getValue(0).toInt() };
+
+        // the message is copied to the queue, so no need for the original one :)
+        if (!xQueueSend( *pCommandInterfaceQueue, &newMessage, ( TickType_t ) 0 ) )
+        {
+            ESP_LOGE(TAG, "Send to queue failed");
+        }
+    }));
+    // ======================================== //
+
     // =========== Add volume command ========== //
     pCli->addCmd(new SingleArgCmd("volume", [](Cmd* cmd) {     
         UserInterface::InterfaceCommandMessage_s newMessage = { .Command = UserInterface::CMD_UNKNOWN};   
@@ -203,6 +268,12 @@ void CommandLine_create(void)
             newMessage.Command  = UserInterface::CMD_VOLUME_DOWN;
             newMessage.pData    = NULL;
         }
+        else if ((detail.toInt() > 0) && (detail.toInt() <= 100))
+        {
+            newMessage.Command  = UserInterface::CMD_SET_VOLUME;
+            newMessage.pData    = NULL;
+            newMessage.Value    = detail.toInt();
+        }
         
         if (newMessage.Command != UserInterface::CMD_UNKNOWN)
         {
@@ -259,6 +330,147 @@ void CommandLine_create(void)
     pCli->addCmd(writeCard);
     // ======================================== //
 
+    // =========== Add provision command ========== //
+    Command* provision = new Command("provision", [](Cmd* cmd) {
+        UserInterface::InterfaceCommandMessage_s newMessage = { .Command = UserInterface::CMD_PROVISION_STATUS, .pData = NULL };
+        String detail = cmd->getValue(0);
+
+        if (detail.equalsIgnoreCase("START"))
+        {
+            newMessage.Command = UserInterface::CMD_PROVISION_START;
+
+            if (cmd->getValue(1).length() > 0)
+            {
+                newMessage.pData = new String(cmd->getValue(1));
+            }
+        }
+        else if (detail.equalsIgnoreCase("ADD"))
+        {
+            if (cmd->getValue(1).length() == 0)
+            {
+                Serial.println("Illegal parameter (FileName)");
+                return;
+            }
+
+            CardData *pJob = new CardData();
+
+            pJob->m_fileName    = cmd->getValue(1);
+            pJob->m_Volume      = 0;
+            pJob->m_Resumeable  = (cmd->getValue(2).equalsIgnoreCase("resume"))?true:false;
+            pJob->m_valid       = true;
+
+            newMessage.Command  = UserInterface::CMD_PROVISION_ADD;
+            newMessage.pData    = pJob;
+        }
+        else if (detail.equalsIgnoreCase("STOP"))
+        {
+            newMessage.Command = UserInterface::CMD_PROVISION_STOP;
+        }
+
+        // the message is copied to the queue, so no need for the original one :)
+        if (!xQueueSend( *pCommandInterfaceQueue, &newMessage, ( TickType_t ) 0 ) )
+        {
+            ESP_LOGE(TAG, "Send to queue failed");
+
+            if (newMessage.Command == UserInterface::CMD_PROVISION_ADD)
+            {
+                delete (CardData *) newMessage.pData;
+            }
+            else
+            {
+                delete (String *) newMessage.pData;
+            }
+        }
+    });
+    provision->addArg(new AnonymOptArg());
+    provision->addArg(new AnonymOptArg());
+    provision->addArg(new AnonymOptArg());
+    pCli->addCmd(provision);
+    // ======================================== //
+
+    // =========== Add statistics command ========== //
+    Command* stats = new Command("stats", [](Cmd* cmd) {
+        UserInterface::InterfaceCommandMessage_s newMessage = { .Command = UserInterface::CMD_STATS, .pData = NULL };
+        String detail = cmd->getValue(0);
+
+        if (detail.equalsIgnoreCase("RESET"))
+        {
+            newMessage.Command = UserInterface::CMD_STATS_RESET;
+        }
+
+        // the message is copied to the queue, so no need for the original one :)
+        if (!xQueueSend( *pCommandInterfaceQueue, &newMessage, ( TickType_t ) 0 ) )
+        {
+            ESP_LOGE(TAG, "Send to queue failed");
+        }
+    });
+    stats->addArg(new AnonymOptArg());
+    pCli->addCmd(stats);
+    // ======================================== //
+
+    // =========== Add latency trace command ========== //
+    Command* trace = new Command("trace", [](Cmd* cmd) {
+        String detail = cmd->getValue(0);
+
+        if (detail.equalsIgnoreCase("RESET"))
+        {
+            LatencyTrace::reset();
+        }
+        else
+        {
+            LatencyTrace::print();
+        }
+    });
+    trace->addArg(new AnonymOptArg());
+    pCli->addCmd(trace);
+    // ======================================== //
+
+    // =========== Add media library command ========== //
+    Command* library = new Command("library", [](Cmd* cmd) {
+        MediaLibrary::CatalogRecord_s record;
+        String detail   = cmd->getValue(0);
+        String path;
+
+        if (detail.equalsIgnoreCase("SCAN"))
+        {
+            MyLibrary.startScan();
+        }
+        else if (detail.equalsIgnoreCase("FIND"))
+        {
+            uint32_t first;
+            uint32_t matches = MyLibrary.findByPrefix(cmd->getValue(1), &first);
+
+            for (uint32_t counter = 0; (counter < matches) && (counter < 20); counter++)
+            {
+                if (MyLibrary.readRecord(first + counter, &record, &path))
+                {
+                    Serial.printf("#%08X %s (%u s)\n", record.Id, path.c_str(), record.Duration / 1000);
+                }
+            }
+
+            Serial.printf("%u media found\n", matches);
+        }
+        else if (detail.charAt(0) == '#')
+        {
+            if (MyLibrary.findById(strtoul(detail.c_str() + 1, NULL, 16), &record, &path))
+            {
+                Serial.printf("#%08X %s (%u s, %u kbit/s, %u bytes)\n", record.Id, path.c_str(), record.Duration / 1000, record.Bitrate, record.FileSize);
+            }
+            else
+            {
+                Serial.println("Unknown media");
+            }
+        }
+        else
+        {
+            Serial.printf("%u media in the library%s\n", MyLibrary.count(), MyLibrary.isScanning() ? ", scan running" : "");
+        }
+    });
+    library->addArg(new AnonymOptArg());
+    library->addArg(new AnonymOptArg());
+    pCli->addCmd(library);
+    // ======================================== //
+
     // =========== Add change log level command ========== //
     pCli->addCmd(new SingleArgCmd("log", [](Cmd* cmd) {  
         String data = cmd->getValue(0);